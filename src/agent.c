@@ -0,0 +1,446 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// The agent keeps the session of a master password in memory and derives
+// passwords for `padre` processes that ask for them on a UNIX socket, much
+// like `ssh-agent` does for SSH keys.
+//
+// A client sends one request per line, which is an account in the format of
+// the database, i.e. `<domain>,<username>,<iteration>,<length>,<characters>`
+// with quoted fields, whose line breaks don't end the request, followed by
+// the scheme if it is not the first, by the cost parameters if they are not
+// the defaults, and by the KDF if it is not scrypt.
+// The agent answers each request with a line `OK <password>` or
+// `ERR <message>`.
+
+#include "padre.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The longest request or reply, including the newline.
+#define AGENT_MAX_LINE 1024
+
+// The time in seconds a client may take to send a request.
+#define AGENT_CLIENT_TIMEOUT 5
+
+#define AGENT_SOCKET_PATH_SIZE sizeof(((struct sockaddr_un *)nullptr)->sun_path)
+
+struct agent {
+  int fd; // the listening socket
+  char dir[AGENT_SOCKET_PATH_SIZE];
+  char path[AGENT_SOCKET_PATH_SIZE];
+  struct session *session; // in locked memory
+  struct scrypt_ctx ctx;   // kept warm for all requests, empty unless `has_ctx`
+  bool has_ctx;
+};
+
+static volatile sig_atomic_t agent__stop = 0;
+
+static void agent__on_signal(const int signum) {
+  (void)signum;
+  agent__stop = 1;
+}
+
+// Returns the newline that ends the first request in the `len` bytes at
+// `request`, i.e. the first one outside of quotes; `nullptr` if there is none
+// yet.  A doubled quote in a quoted field leaves it and enters it again.
+static char *agent__request_end(char *request, const size_t len) {
+  bool in_quotes = false;
+  for (size_t i = 0; i < len; ++i) {
+    if (request[i] == '"') {
+      in_quotes = !in_quotes;
+    } else if (request[i] == '\n' && !in_quotes) {
+      return &request[i];
+    }
+  }
+  return nullptr;
+}
+
+// Answers the `request` of `len` bytes, which must end in a newline, by writing
+// the reply into `reply`.
+static void agent__handle_request(struct agent *agent, char *request,
+                                  const size_t len,
+                                  char reply[static AGENT_MAX_LINE]) {
+  struct account_list list = parse_accounts(request, request + len);
+  if (list.size != 1 || list.accounts[0].iteration == nullptr ||
+      list.accounts[0].length == 0 ||
+      password_size(&list.accounts[0]) > AGENT_MAX_LINE - strlen("OK \n")) {
+    snprintf(reply, AGENT_MAX_LINE, "ERR invalid request\n");
+    free_account_list(&list);
+    return;
+  }
+
+  const struct account *account = &list.accounts[0];
+  char *password = reply + strlen("OK ");
+  // Costlier accounts than any before grow the context for good, so that they
+  // are not paid for by mapping scratch memory on every request.  Should that
+  // fail, the derivation maps its own.
+  agent->has_ctx = fit_ctx(&agent->ctx, account) == 0;
+  if (derive_account_password(agent->has_ctx ? &agent->ctx : nullptr,
+                              agent->session, account, password) != 0) {
+    snprintf(reply, AGENT_MAX_LINE, "ERR %s\n", strerror(errno));
+  } else {
+    memcpy(reply, "OK ", strlen("OK "));
+    const size_t password_len = strlen(password);
+    password[password_len] = '\n';
+    password[password_len + 1] = '\0';
+  }
+  free_account_list(&list);
+}
+
+// Serves the requests of one client until it hangs up or stalls.
+static void agent__serve_client(struct agent *agent, const int fd) {
+  struct ucred cred;
+  socklen_t cred_len = sizeof cred;
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+      cred.uid != getuid()) {
+    return;
+  }
+
+  const struct timeval timeout = {.tv_sec = AGENT_CLIENT_TIMEOUT};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+  char request[AGENT_MAX_LINE];
+  char reply[AGENT_MAX_LINE];
+  size_t len = 0;
+  for (ssize_t n; !agent__stop &&
+                  (n = read(fd, request + len, sizeof request - len)) > 0;) {
+    len += (size_t)n;
+
+    char *newline;
+    while ((newline = agent__request_end(request, len)) != nullptr) {
+      const size_t line_len = (size_t)(newline - request) + 1;
+      agent__handle_request(agent, request, line_len, reply);
+      const bool sent = write(fd, reply, strlen(reply)) >= 0;
+      explicit_bzero(reply, sizeof reply);
+      memmove(request, request + line_len, len - line_len);
+      len -= line_len;
+      if (!sent) {
+        return;
+      }
+    }
+
+    if (len == sizeof request) {
+      const char error[] = "ERR request too long\n";
+      write(fd, error, sizeof error - 1);
+      return;
+    }
+  }
+  explicit_bzero(request, sizeof request);
+}
+
+static void agent__cleanup(struct agent *agent) {
+  if (agent->fd >= 0) {
+    close(agent->fd);
+  }
+  unlink(agent->path);
+  rmdir(agent->dir);
+}
+
+// Creates the listening socket in a private directory.
+// Returns 0 on success; -1 in case of a failure.
+static int agent__listen(struct agent *agent) {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir == nullptr || *runtime_dir == '\0') {
+    runtime_dir = "/tmp";
+  }
+
+  const int len =
+      snprintf(agent->dir, sizeof agent->dir, "%s/padre-XXXXXX", runtime_dir);
+  if (len < 0 || (size_t)len >= sizeof agent->dir) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if (mkdtemp(agent->dir) == nullptr) {
+    return -1;
+  }
+
+  const int path_len = snprintf(agent->path, sizeof agent->path, "%s/agent.%ld",
+                                agent->dir, (long)getpid());
+  if (path_len < 0 || (size_t)path_len >= sizeof agent->path) {
+    rmdir(agent->dir);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  memcpy(addr.sun_path, agent->path, (size_t)path_len + 1);
+
+  agent->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (agent->fd < 0 ||
+      bind(agent->fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+      listen(agent->fd, 16) != 0) {
+    const int error = errno;
+    agent__cleanup(agent);
+    errno = error;
+    return -1;
+  }
+
+  return 0;
+}
+
+// Moves the session into memory that is neither swapped out nor dumped.
+// Returns 0 on success; -1 in case of a failure.
+static int agent__lock_session(struct agent *agent, struct session *session) {
+  void *memory = mmap(nullptr, sizeof *session, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return -1;
+  }
+  if (mlock(memory, sizeof *session) != 0) {
+    munmap(memory, sizeof *session);
+    return -1;
+  }
+  madvise(memory, sizeof *session, MADV_DONTDUMP);
+
+  agent->session = memory;
+  *agent->session = *session;
+  session_clear(session);
+  return 0;
+}
+
+static void agent__serve(struct agent *agent, const unsigned timeout) {
+  while (!agent__stop) {
+    struct pollfd pfd = {.fd = agent->fd, .events = POLLIN};
+    const int ret = poll(&pfd, 1, timeout > 0 ? (int)timeout * 1000 : -1);
+    if (ret == 0) {
+      break; // idle for too long
+    }
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    const int fd = accept4(agent->fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0) {
+      agent__serve_client(agent, fd);
+      close(fd);
+    }
+  }
+}
+
+// Starts an agent for `session` in the background and prints the shell
+// commands that make it known to `padre`, like `ssh-agent` does.  The agent
+// exits after `timeout` seconds without requests, unless `timeout` is 0.  The
+// session is cleared in the calling process.
+// Returns 0 on success; -1 in case of a failure.
+static int agent_start(struct session *session, const unsigned timeout) {
+  struct agent agent = {.fd = -1};
+  if (agent__listen(&agent) != 0) {
+    session_clear(session);
+    return -1;
+  }
+
+  // The terminal may hang up as soon as the calling process exits, which
+  // might be before the agent has left its session.
+  signal(SIGHUP, SIG_IGN);
+
+  const pid_t pid = fork();
+  if (pid < 0) {
+    agent__cleanup(&agent);
+    session_clear(session);
+    return -1;
+  }
+  if (pid > 0) {
+    session_clear(session);
+    printf("%s=%s; export %s;\n", AGENT_SOCKET_ENV, agent.path,
+           AGENT_SOCKET_ENV);
+    printf("echo Agent pid %ld;\n", (long)pid);
+    return 0;
+  }
+
+  // from here on, this is the agent
+  setsid();
+  if (chdir("/") != 0) {
+    // not a problem, just keeps a file system busy
+  }
+  const int null = open("/dev/null", O_RDWR);
+  if (null >= 0) {
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(null);
+  }
+
+  // don't let other processes of the user read the master password's state
+  prctl(PR_SET_DUMPABLE, 0);
+
+  struct sigaction action = {.sa_handler = agent__on_signal};
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (agent__lock_session(&agent, session) != 0) {
+    session_clear(session);
+    agent__cleanup(&agent);
+    _exit(EXIT_FAILURE);
+  }
+  agent.has_ctx = scrypt_ctx_init(&agent.ctx, 1, MP_N, MP_r, MP_p) == 0;
+
+  agent__serve(&agent, timeout);
+
+  if (agent.has_ctx) {
+    scrypt_ctx_free(&agent.ctx);
+  }
+  session_clear(agent.session);
+  agent__cleanup(&agent);
+  _exit(EXIT_SUCCESS);
+}
+
+// Connects to the agent named in the environment.
+// Returns the socket; -1 if there is no agent or it cannot be reached.
+static int agent_connect(void) {
+  const char *path = getenv(AGENT_SOCKET_ENV);
+  if (path == nullptr || *path == '\0') {
+    errno = ENOENT;
+    return -1;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof addr.sun_path) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(addr.sun_path, path, strlen(path) + 1);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+// Stores `str` quoted as a CSV field in `quoted` of `size` bytes, which must
+// be at least 3.
+// Returns 0 on success; -1 if it does not fit.
+static int agent__quote(const char *str, char *quoted, const size_t size) {
+  char *out = quoted;
+  const char *end = quoted + size - 2; // leaves room for `"` and `\0`
+  *out++ = '"';
+  for (; *str != '\0'; ++str) {
+    if (end - out < (*str == '"' ? 2 : 1)) {
+      return -1;
+    }
+    if (*str == '"') {
+      *out++ = '"';
+    }
+    *out++ = *str;
+  }
+  *out++ = '"';
+  *out = '\0';
+  return 0;
+}
+
+// Sends the request for `account` to the agent connected to by `fd`.  All
+// fields are quoted, so that commas, quotes and line breaks in them reach the
+// agent as they are.  Accounts of the first scheme at the default cost are
+// sent without the optional fields, so that older agents still understand them.
+// Returns 0 on success; -1 in case of a failure.
+static int agent__request(const int fd, const struct account *account) {
+  char domain[AGENT_MAX_LINE];
+  char username[AGENT_MAX_LINE];
+  char iteration[AGENT_MAX_LINE];
+  char characters[AGENT_MAX_LINE];
+  if (agent__quote(account->domain, domain, sizeof domain) != 0 ||
+      agent__quote(account->username, username, sizeof username) != 0 ||
+      agent__quote(account->iteration, iteration, sizeof iteration) != 0 ||
+      agent__quote(account->characters, characters, sizeof characters) != 0) {
+    errno = E2BIG;
+    return -1;
+  }
+
+  const bool default_cost = kdf_cost_is_default(&account->cost);
+  if (account->scheme == SCHEME_V1 && default_cost) {
+    return dprintf(fd, "%s,%s,%s,%zu,%s\n", domain, username, iteration,
+                   account->length, characters) < 0
+               ? -1
+               : 0;
+  }
+  if (default_cost) {
+    return dprintf(fd, "%s,%s,%s,%zu,%s,%d\n", domain, username, iteration,
+                   account->length, characters, (int)account->scheme + 1) < 0
+               ? -1
+               : 0;
+  }
+  const bool scrypt = account->cost.kdf == KDF_SCRYPT;
+  return dprintf(fd,
+                 "%s,%s,%s,%zu,%s,%d,%" PRIu64 ",%" PRIu32 ",%" PRIu32 "%s%s\n",
+                 domain, username, iteration, account->length, characters,
+                 (int)account->scheme + 1, account->cost.N, account->cost.r,
+                 account->cost.p, scrypt ? "" : ",",
+                 scrypt ? "" : kdf_backends[account->cost.kdf].name) < 0
+             ? -1
+             : 0;
+}
+
+// Has the agent connected to by `fd` derive the password for `account`.
+// Returns 0 on success; -1 in case of a failure.
+static int agent_derive_account_password(
+    const int fd, const struct account *account,
+    char password[static password_size(account)]) {
+  if (agent__request(fd, account) != 0) {
+    return -1;
+  }
+
+  char reply[AGENT_MAX_LINE];
+  size_t len = 0;
+  for (ssize_t n; len < sizeof reply && (n = read(fd, &reply[len], 1)) > 0;) {
+    if (reply[len++] == '\n') {
+      break;
+    }
+  }
+
+  // characters take one byte at least
+  const size_t password_len = len - strlen("OK \n");
+  int ret = -1;
+  if (len == 0 || reply[len - 1] != '\n') {
+    fputs("Error: no reply from the agent\n", stderr);
+  } else if (len > strlen("OK ") && memcmp(reply, "OK ", 3) == 0 &&
+             password_len >= account->length &&
+             password_len < password_size(account)) {
+    memcpy(password, reply + strlen("OK "), password_len);
+    password[password_len] = '\0';
+    ret = 0;
+  } else {
+    fprintf(stderr, "Error from the agent: %.*s", (int)len, reply);
+  }
+
+  explicit_bzero(reply, sizeof reply);
+  return ret;
+}
@@ -0,0 +1,539 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// An implementation of the Argon2id key derivation function, version 0x13, as
+// specified in RFC 9106, including the BLAKE2b hash function (RFC 7693) it is
+// built on.  The p lanes of the memory are filled on as many threads as there
+// are processors for them, which meet after each of the four slices of a pass.
+// Depends on scrypt.c for the scratch memory and the number of threads.
+
+#include "padre.h"
+
+#include <pthread.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static inline uint64_t rotr64(const uint64_t x, const int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+static inline uint64_t le64dec(const uint8_t *p) {
+  return (uint64_t)le32dec(p) | (uint64_t)le32dec(p + 4) << 32;
+}
+
+static inline void le64enc(uint8_t *p, const uint64_t x) {
+  le32enc(p, (uint32_t)x);
+  le32enc(p + 4, (uint32_t)(x >> 32));
+}
+
+// ---------------------------------------------------------------------------
+// BLAKE2b (RFC 7693), without a key
+
+#define BLAKE2B_BLOCK_SIZE 128
+#define BLAKE2B_MAX_SIZE 64
+
+struct blake2b {
+  uint64_t h[8];
+  uint64_t t[2]; // the number of bytes compressed so far
+  uint8_t buf[BLAKE2B_BLOCK_SIZE];
+  size_t buf_len;
+  size_t out_len;
+};
+
+static const uint64_t blake2b__iv[8] = {
+    0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b,
+    0xa54ff53a5f1d36f1, 0x510e527fade682d1, 0x9b05688c2b3e6c1f,
+    0x1f83d9abfb41bd6b, 0x5be0cd19137e2179,
+};
+
+static const uint8_t blake2b__sigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+#define BLAKE2B_G(v, a, b, c, d, x, y)                                         \
+  do {                                                                         \
+    v[a] += v[b] + (x);                                                        \
+    v[d] = rotr64(v[d] ^ v[a], 32);                                            \
+    v[c] += v[d];                                                              \
+    v[b] = rotr64(v[b] ^ v[c], 24);                                            \
+    v[a] += v[b] + (y);                                                        \
+    v[d] = rotr64(v[d] ^ v[a], 16);                                            \
+    v[c] += v[d];                                                              \
+    v[b] = rotr64(v[b] ^ v[c], 63);                                            \
+  } while (0)
+
+static void blake2b__compress(struct blake2b *ctx, const bool last) {
+  uint64_t m[16];
+  for (size_t i = 0; i < 16; ++i) {
+    m[i] = le64dec(&ctx->buf[i * 8]);
+  }
+  uint64_t v[16];
+  memcpy(v, ctx->h, sizeof ctx->h);
+  memcpy(&v[8], blake2b__iv, sizeof blake2b__iv);
+  v[12] ^= ctx->t[0];
+  v[13] ^= ctx->t[1];
+  if (last) {
+    v[14] = ~v[14];
+  }
+
+  for (size_t i = 0; i < 12; ++i) {
+    const uint8_t *s = blake2b__sigma[i];
+    BLAKE2B_G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    BLAKE2B_G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    BLAKE2B_G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    BLAKE2B_G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    BLAKE2B_G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    BLAKE2B_G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    BLAKE2B_G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    BLAKE2B_G(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+
+  for (size_t i = 0; i < 8; ++i) {
+    ctx->h[i] ^= v[i] ^ v[i + 8];
+  }
+  explicit_bzero(m, sizeof m);
+  explicit_bzero(v, sizeof v);
+}
+
+// Starts hashing into a digest of `out_len` bytes, at most 64.
+static void blake2b_init(struct blake2b *ctx, const size_t out_len) {
+  *ctx = (struct blake2b){.buf_len = 0, .out_len = out_len};
+  memcpy(ctx->h, blake2b__iv, sizeof blake2b__iv);
+  ctx->h[0] ^= 0x01010000 ^ (uint64_t)out_len;
+}
+
+static void blake2b_update(struct blake2b *ctx, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  while (len > 0) {
+    // The last block is compressed differently, so a full buffer is only
+    // compressed once more data follows.
+    if (ctx->buf_len == BLAKE2B_BLOCK_SIZE) {
+      ctx->t[0] += BLAKE2B_BLOCK_SIZE;
+      ctx->t[1] += ctx->t[0] < BLAKE2B_BLOCK_SIZE;
+      blake2b__compress(ctx, false);
+      ctx->buf_len = 0;
+    }
+    const size_t n = BLAKE2B_BLOCK_SIZE - ctx->buf_len < len
+                         ? BLAKE2B_BLOCK_SIZE - ctx->buf_len
+                         : len;
+    memcpy(&ctx->buf[ctx->buf_len], bytes, n);
+    ctx->buf_len += n;
+    bytes += n;
+    len -= n;
+  }
+}
+
+static void blake2b_final(struct blake2b *ctx, uint8_t *digest) {
+  ctx->t[0] += ctx->buf_len;
+  ctx->t[1] += ctx->t[0] < ctx->buf_len;
+  memset(&ctx->buf[ctx->buf_len], 0, BLAKE2B_BLOCK_SIZE - ctx->buf_len);
+  blake2b__compress(ctx, true);
+
+  uint8_t out[BLAKE2B_MAX_SIZE];
+  for (size_t i = 0; i < 8; ++i) {
+    le64enc(&out[i * 8], ctx->h[i]);
+  }
+  memcpy(digest, out, ctx->out_len);
+  explicit_bzero(out, sizeof out);
+  explicit_bzero(ctx, sizeof *ctx);
+}
+
+static void blake2b_update_le32(struct blake2b *ctx, const uint32_t x) {
+  uint8_t bytes[4];
+  le32enc(bytes, x);
+  blake2b_update(ctx, bytes, sizeof bytes);
+}
+
+// Computes the variable-length hash H' of `in_len` bytes of `in` into
+// `out_len` bytes of `out` (RFC 9106, section 3.3).
+static void argon2__hash(uint8_t *out, const size_t out_len, const void *in,
+                         const size_t in_len) {
+  struct blake2b ctx;
+  blake2b_init(&ctx, out_len <= BLAKE2B_MAX_SIZE ? out_len : BLAKE2B_MAX_SIZE);
+  blake2b_update_le32(&ctx, (uint32_t)out_len);
+  blake2b_update(&ctx, in, in_len);
+  if (out_len <= BLAKE2B_MAX_SIZE) {
+    blake2b_final(&ctx, out);
+    return;
+  }
+
+  // the first half of each of the 64-byte hashes, and all of the last one
+  uint8_t v[BLAKE2B_MAX_SIZE];
+  blake2b_final(&ctx, v);
+  size_t pos = 0;
+  for (; out_len - pos > BLAKE2B_MAX_SIZE; pos += BLAKE2B_MAX_SIZE / 2) {
+    memcpy(&out[pos], v, BLAKE2B_MAX_SIZE / 2);
+    const size_t next_len = out_len - pos - BLAKE2B_MAX_SIZE / 2;
+    blake2b_init(&ctx, next_len < BLAKE2B_MAX_SIZE ? next_len
+                                                   : BLAKE2B_MAX_SIZE);
+    blake2b_update(&ctx, v, sizeof v);
+    blake2b_final(&ctx, v);
+  }
+  memcpy(&out[pos], v, out_len - pos);
+  explicit_bzero(v, sizeof v);
+}
+
+// ---------------------------------------------------------------------------
+// Argon2id (RFC 9106)
+
+#define ARGON2_VERSION 0x13
+#define ARGON2_TYPE_ID 2
+#define ARGON2_BLOCK_SIZE 1024
+#define ARGON2_BLOCK_WORDS (ARGON2_BLOCK_SIZE / 8)
+#define ARGON2_SYNC_POINTS 4
+#define ARGON2_MIN_SALT_LENGTH 8
+#define ARGON2_MIN_TAG_LENGTH 4
+#define ARGON2_MAX_LANES 0xffffff
+
+struct argon2__block {
+  uint64_t v[ARGON2_BLOCK_WORDS];
+};
+
+#define ARGON2_GB(a, b, c, d)                                                  \
+  do {                                                                         \
+    a += b + 2 * (uint64_t)(uint32_t)a * (uint32_t)b;                          \
+    d = rotr64(d ^ a, 32);                                                     \
+    c += d + 2 * (uint64_t)(uint32_t)c * (uint32_t)d;                          \
+    b = rotr64(b ^ c, 24);                                                     \
+    a += b + 2 * (uint64_t)(uint32_t)a * (uint32_t)b;                          \
+    d = rotr64(d ^ a, 16);                                                     \
+    c += d + 2 * (uint64_t)(uint32_t)c * (uint32_t)d;                          \
+    b = rotr64(b ^ c, 63);                                                     \
+  } while (0)
+
+// The permutation P on the 16 words `v[i0]`, `v[i0 + 1]`, `v[i0 + d]`,
+// `v[i0 + d + 1]`, `v[i0 + 2·d]`, ... of a block.
+#define ARGON2_P(v, i0, d)                                                     \
+  do {                                                                         \
+    uint64_t *const w = &v[i0];                                                \
+    ARGON2_GB(w[0], w[2 * d], w[4 * d], w[6 * d]);                             \
+    ARGON2_GB(w[1], w[2 * d + 1], w[4 * d + 1], w[6 * d + 1]);                 \
+    ARGON2_GB(w[d], w[3 * d], w[5 * d], w[7 * d]);                             \
+    ARGON2_GB(w[d + 1], w[3 * d + 1], w[5 * d + 1], w[7 * d + 1]);             \
+    ARGON2_GB(w[0], w[2 * d + 1], w[5 * d], w[7 * d + 1]);                     \
+    ARGON2_GB(w[1], w[3 * d], w[5 * d + 1], w[6 * d]);                         \
+    ARGON2_GB(w[d], w[3 * d + 1], w[4 * d], w[6 * d + 1]);                     \
+    ARGON2_GB(w[d + 1], w[2 * d], w[4 * d + 1], w[7 * d]);                     \
+  } while (0)
+
+// The compression function G: `next = G(prev, ref)`, or `next ^= G(prev, ref)`
+// if `xor` is set, as in the passes after the first.
+static void argon2__fill_block(const struct argon2__block *prev,
+                               const struct argon2__block *ref,
+                               struct argon2__block *next, const bool xor) {
+  struct argon2__block r;
+  struct argon2__block z;
+  for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) {
+    r.v[k] = prev->v[k] ^ ref->v[k];
+    z.v[k] = xor ? r.v[k] ^ next->v[k] : r.v[k];
+  }
+
+  // the eight rows of 16 words, then the eight columns of two words each
+  for (size_t i = 0; i < 8; ++i) {
+    ARGON2_P(r.v, 16 * i, 2);
+  }
+  for (size_t i = 0; i < 8; ++i) {
+    ARGON2_P(r.v, 2 * i, 16);
+  }
+
+  for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) {
+    next->v[k] = z.v[k] ^ r.v[k];
+  }
+}
+
+// The memory of a derivation and its shape.
+struct argon2__instance {
+  struct argon2__block *memory;
+  uint32_t passes;
+  uint32_t lanes;
+  uint32_t lane_length;    // in blocks
+  uint32_t segment_length; // in blocks
+  uint32_t num_blocks;     // m', the number of blocks in all lanes
+};
+
+// Returns the index in its lane of the block that the block at `index` in
+// `slice` of `pass` refers to, given the 32 low bits of its pseudo-random
+// number `rand` (RFC 9106, section 3.4.1.2).
+static uint32_t argon2__ref_index(const struct argon2__instance *instance,
+                                  const uint32_t pass, const uint32_t slice,
+                                  const uint32_t index, const uint32_t rand,
+                                  const bool same_lane) {
+  // the number of blocks that may be referred to
+  uint64_t area;
+  if (pass == 0) {
+    area = slice == 0 ? index - 1
+           : same_lane
+               ? (uint64_t)slice * instance->segment_length + index - 1
+               : (uint64_t)slice * instance->segment_length - (index == 0);
+  } else {
+    area = same_lane ? (uint64_t)instance->lane_length -
+                           instance->segment_length + index - 1
+                     : (uint64_t)instance->lane_length -
+                           instance->segment_length - (index == 0);
+  }
+
+  const uint64_t x = (uint64_t)rand * rand >> 32;
+  const uint64_t relative = area - 1 - (area * x >> 32);
+  const uint64_t start =
+      pass == 0 || slice == ARGON2_SYNC_POINTS - 1
+          ? 0
+          : (uint64_t)(slice + 1) * instance->segment_length;
+  return (uint32_t)((start + relative) % instance->lane_length);
+}
+
+// Fills the segment of `lane` in `slice` of `pass`.
+static void argon2__fill_segment(const struct argon2__instance *instance,
+                                 const uint32_t pass, const uint32_t lane,
+                                 const uint32_t slice) {
+  // Argon2id refers to blocks independently of the password in the first half
+  // of the first pass, to resist side channels, and depending on it after.
+  const bool independent = pass == 0 && slice < ARGON2_SYNC_POINTS / 2;
+  struct argon2__block zero = {{0}};
+  struct argon2__block input = {{0}};
+  struct argon2__block addresses;
+  if (independent) {
+    input.v[0] = pass;
+    input.v[1] = lane;
+    input.v[2] = slice;
+    input.v[3] = instance->num_blocks;
+    input.v[4] = instance->passes;
+    input.v[5] = ARGON2_TYPE_ID;
+  }
+
+  // the first two blocks of each lane have been filled already
+  const uint32_t first = pass == 0 && slice == 0 ? 2 : 0;
+  struct argon2__block *lane_memory =
+      &instance->memory[(size_t)lane * instance->lane_length];
+  for (uint32_t i = first; i < instance->segment_length; ++i) {
+    const uint32_t current = slice * instance->segment_length + i;
+    const uint32_t previous =
+        current == 0 ? instance->lane_length - 1 : current - 1;
+
+    uint64_t rand;
+    if (independent) {
+      if (i == first || i % ARGON2_BLOCK_WORDS == 0) {
+        ++input.v[6];
+        argon2__fill_block(&zero, &input, &addresses, false);
+        argon2__fill_block(&zero, &addresses, &addresses, false);
+      }
+      rand = addresses.v[i % ARGON2_BLOCK_WORDS];
+    } else {
+      rand = lane_memory[previous].v[0];
+    }
+
+    const uint32_t ref_lane = pass == 0 && slice == 0
+                                  ? lane
+                                  : (uint32_t)((rand >> 32) % instance->lanes);
+    const uint32_t ref_index = argon2__ref_index(
+        instance, pass, slice, i, (uint32_t)rand, ref_lane == lane);
+    argon2__fill_block(
+        &lane_memory[previous],
+        &instance->memory[(size_t)ref_lane * instance->lane_length +
+                          ref_index],
+        &lane_memory[current], pass > 0);
+  }
+  explicit_bzero(&addresses, sizeof addresses);
+}
+
+// The lanes of a slice that one thread fills: those from `first` on in steps
+// of `step`.
+struct argon2__share {
+  const struct argon2__instance *instance;
+  uint32_t pass;
+  uint32_t slice;
+  uint32_t first;
+  uint32_t step;
+};
+
+static void *argon2__worker(void *arg) {
+  const struct argon2__share *share = arg;
+  for (uint32_t lane = share->first; lane < share->instance->lanes;
+       lane += share->step) {
+    argon2__fill_segment(share->instance, share->pass, lane, share->slice);
+  }
+  return nullptr;
+}
+
+// Fills the memory of `instance` on `threads` threads, the calling one
+// included.  All threads finish a slice before any starts the next, as the
+// segments of a slice refer only to those of the slices before.  Lanes whose
+// thread cannot be started are filled by the calling thread.
+static void argon2__fill_memory(const struct argon2__instance *instance,
+                                const size_t threads) {
+  for (uint32_t pass = 0; pass < instance->passes; ++pass) {
+    for (uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; ++slice) {
+      struct argon2__share shares[KDF_MAX_THREADS];
+      pthread_t ids[KDF_MAX_THREADS];
+      bool started[KDF_MAX_THREADS] = {false};
+      for (size_t t = 0; t < threads; ++t) {
+        shares[t] = (struct argon2__share){instance, pass, slice, (uint32_t)t,
+                                           (uint32_t)threads};
+        started[t] = t > 0 && pthread_create(&ids[t], nullptr, argon2__worker,
+                                             &shares[t]) == 0;
+      }
+      for (size_t t = 0; t < threads; ++t) {
+        if (!started[t]) {
+          argon2__worker(&shares[t]);
+        }
+      }
+      for (size_t t = 0; t < threads; ++t) {
+        if (started[t]) {
+          pthread_join(ids[t], nullptr);
+        }
+      }
+    }
+  }
+}
+
+// Returns whether Argon2id can be computed with `m` KiB of memory, `t` passes
+// and `p` lanes.
+static bool argon2_valid_params(const uint64_t m, const uint32_t t,
+                                const uint32_t p) {
+  return p >= 1 && p <= ARGON2_MAX_LANES && t >= 1 && m >= 8 * (uint64_t)p &&
+         m <= UINT32_MAX && m <= SIZE_MAX / ARGON2_BLOCK_SIZE;
+}
+
+// Returns the number of bytes of scratch memory Argon2id takes with `m` KiB of
+// memory and `p` lanes.
+static size_t argon2_memory_size(const uint64_t m, const uint32_t p) {
+  return (size_t)(m / (ARGON2_SYNC_POINTS * p) * ARGON2_SYNC_POINTS * p) *
+         ARGON2_BLOCK_SIZE;
+}
+
+// Like `argon2id_kdf()`, but with a secret and associated data, as well as the
+// number of threads given explicitly.
+static int argon2id_kdf_with(struct scrypt_ctx *ctx, const uint8_t *passwd,
+                             const size_t passwd_len, const uint8_t *salt,
+                             const size_t salt_len, const uint8_t *secret,
+                             const size_t secret_len, const uint8_t *ad,
+                             const size_t ad_len, const uint64_t m,
+                             const uint32_t t, const uint32_t p, uint8_t *buf,
+                             const size_t buf_len, const size_t threads) {
+  if (!argon2_valid_params(m, t, p) || salt_len < ARGON2_MIN_SALT_LENGTH ||
+      buf_len < ARGON2_MIN_TAG_LENGTH || buf_len > UINT32_MAX ||
+      passwd_len > UINT32_MAX || salt_len > UINT32_MAX ||
+      secret_len > UINT32_MAX || ad_len > UINT32_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  const size_t size = argon2_memory_size(m, p);
+  struct scrypt_ctx temporary = {.memory = nullptr, .mapping = nullptr};
+  if (ctx == nullptr || ctx->size < size) {
+    if (scrypt_ctx_init_size(&temporary, size) != 0) {
+      return -1;
+    }
+    ctx = &temporary;
+  }
+  const uint32_t num_blocks = (uint32_t)(size / ARGON2_BLOCK_SIZE);
+  const struct argon2__instance instance = {
+      .memory = (struct argon2__block *)ctx->memory,
+      .passes = t,
+      .lanes = p,
+      .lane_length = num_blocks / p,
+      .segment_length = num_blocks / p / ARGON2_SYNC_POINTS,
+      .num_blocks = num_blocks,
+  };
+
+  // H0, from all the parameters and inputs
+  uint8_t h0[BLAKE2B_MAX_SIZE + 8];
+  struct blake2b hash;
+  blake2b_init(&hash, BLAKE2B_MAX_SIZE);
+  const uint32_t params[] = {p,         (uint32_t)buf_len, (uint32_t)m,
+                             t,         ARGON2_VERSION,    ARGON2_TYPE_ID,
+                             (uint32_t)passwd_len};
+  for (size_t i = 0; i < sizeof params / sizeof params[0]; ++i) {
+    blake2b_update_le32(&hash, params[i]);
+  }
+  blake2b_update(&hash, passwd, passwd_len);
+  blake2b_update_le32(&hash, (uint32_t)salt_len);
+  blake2b_update(&hash, salt, salt_len);
+  blake2b_update_le32(&hash, (uint32_t)secret_len);
+  blake2b_update(&hash, secret, secret_len);
+  blake2b_update_le32(&hash, (uint32_t)ad_len);
+  blake2b_update(&hash, ad, ad_len);
+  blake2b_final(&hash, h0);
+
+  // the first two blocks of each lane, from H0, the index and the lane
+  uint8_t bytes[ARGON2_BLOCK_SIZE];
+  for (uint32_t lane = 0; lane < p; ++lane) {
+    for (uint32_t i = 0; i < 2; ++i) {
+      le32enc(&h0[BLAKE2B_MAX_SIZE], i);
+      le32enc(&h0[BLAKE2B_MAX_SIZE + 4], lane);
+      argon2__hash(bytes, sizeof bytes, h0, sizeof h0);
+      struct argon2__block *block =
+          &instance.memory[(size_t)lane * instance.lane_length + i];
+      for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) {
+        block->v[k] = le64dec(&bytes[k * 8]);
+      }
+    }
+  }
+
+  argon2__fill_memory(&instance, threads);
+
+  // the tag, from the last blocks of all lanes
+  struct argon2__block last = instance.memory[instance.lane_length - 1];
+  for (uint32_t lane = 1; lane < p; ++lane) {
+    const struct argon2__block *block =
+        &instance.memory[(size_t)lane * instance.lane_length +
+                         instance.lane_length - 1];
+    for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) {
+      last.v[k] ^= block->v[k];
+    }
+  }
+  for (size_t k = 0; k < ARGON2_BLOCK_WORDS; ++k) {
+    le64enc(&bytes[k * 8], last.v[k]);
+  }
+  argon2__hash(buf, buf_len, bytes, sizeof bytes);
+
+  explicit_bzero(h0, sizeof h0);
+  explicit_bzero(bytes, sizeof bytes);
+  explicit_bzero(&last, sizeof last);
+  explicit_bzero(ctx->memory, size);
+  scrypt_ctx_free(&temporary);
+
+  return 0;
+}
+
+// Computes Argon2id(passwd, salt) with `m` KiB of memory, `t` passes and `p`
+// lanes into `buf`, which takes at least 4 bytes, using the scratch memory of
+// `ctx`.  If `ctx` is `nullptr` or too small, scratch memory is allocated just
+// for this derivation.  The lanes are filled on up to p threads; the memory
+// does not grow with them.  The salt takes at least 8 bytes.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int argon2id_kdf(struct scrypt_ctx *ctx, const uint8_t *passwd,
+                        const size_t passwd_len, const uint8_t *salt,
+                        const size_t salt_len, const uint64_t m,
+                        const uint32_t t, const uint32_t p, uint8_t *buf,
+                        const size_t buf_len) {
+  return argon2id_kdf_with(ctx, passwd, passwd_len, salt, salt_len, nullptr, 0,
+                           nullptr, 0, m, t, p, buf, buf_len,
+                           kdf_num_threads(p));
+}
@@ -0,0 +1,228 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// Picks the cost parameters of scrypt for this machine, for `padre calibrate`.
+// N is doubled, starting small, and each derivation is timed as padre derives
+// a single password and as it derives many at once, in the lanes of the SIMD
+// unit, until a derivation takes too long or too much memory.  The largest N
+// that fits both is recommended, with p raised to use up the processors and
+// the time that are left: the instances of ROMix that p adds run on threads of
+// their own as long as there are processors for them, which costs memory but
+// no time, and one after another beyond that, which costs time but no memory.
+
+#include "padre.h"
+
+#include <unistd.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The number of derivations timed for each N, of which the median counts.
+#define CALIBRATE_RUNS 3
+
+// The smallest N that is tried.
+#define CALIBRATE_MIN_N 1024
+
+// N is not doubled any more once a derivation takes this many times the
+// target latency, so that the curve shows a little beyond the target.
+#define CALIBRATE_OVERSHOOT 2
+
+static double calibrate__now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int calibrate__compare(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Returns the memory an instance of ROMix at `cost` takes, in bytes.
+static uint64_t calibrate__instance_memory(const struct kdf_cost *cost) {
+  return 128 * (uint64_t)cost->r * cost->N;
+}
+
+// Returns the memory a derivation at `cost` takes, in bytes.
+static uint64_t calibrate__memory(const struct kdf_cost *cost) {
+  return calibrate__instance_memory(cost) * kdf_num_threads(cost->p);
+}
+
+// Times deriving `num_accounts` passwords at `cost` at once, with the scratch
+// memory allocated in advance, as the batch and the agent do.  Unless `batch`
+// is set, a single account is derived as by `derive_account_password()`, on
+// several threads for p > 1; otherwise on one thread, in lanes if there are
+// enough accounts for them.
+// Returns the median time per derivation in milliseconds; a negative number in
+// case of a failure.
+static double calibrate__time(const struct session *session,
+                              const struct kdf_cost cost,
+                              const size_t num_accounts, const bool batch) {
+  struct scrypt_ctx ctx;
+  if (scrypt_ctx_init(&ctx, num_accounts, cost.N, cost.r, cost.p) != 0) {
+    return -1;
+  }
+
+  struct account accounts[SCRYPT_LANES];
+  char passwords[SCRYPT_LANES][17];
+  char *ptrs[SCRYPT_LANES];
+  for (size_t i = 0; i < num_accounts; ++i) {
+    accounts[i] = (struct account){
+        .domain = "example.com",
+        .username = "calibration",
+        .iteration = "0",
+        .characters = "*",
+        .length = sizeof passwords[i] - 1,
+        .scheme = SCHEME_V2,
+        .cost = cost,
+    };
+    ptrs[i] = passwords[i];
+  }
+
+  double samples[CALIBRATE_RUNS];
+  int ret = 0;
+  for (size_t i = 0; ret == 0 && i < CALIBRATE_RUNS; ++i) {
+    const double start = calibrate__now_ms();
+    ret = !batch ? derive_account_password(&ctx, session, &accounts[0],
+                                           ptrs[0])
+                 : derive_account_passwords(&ctx, session, num_accounts,
+                                            accounts, ptrs);
+    samples[i] = (calibrate__now_ms() - start) / (double)num_accounts;
+  }
+  scrypt_ctx_free(&ctx);
+  if (ret != 0) {
+    return -1;
+  }
+
+  qsort(samples, CALIBRATE_RUNS, sizeof samples[0], calibrate__compare);
+  return samples[CALIBRATE_RUNS / 2];
+}
+
+// Measures the latency of a derivation at `cost` and the throughput of
+// `padre --all` at it, in derivations per second.  Each thread of the batch
+// derives the accounts in lanes if the memory of all lanes fits in `memory`,
+// and the instances of ROMix of each one after another.
+// The threads are assumed not to slow each other down, which they do if the
+// memory bandwidth runs short.
+// Returns 0 on success; -1 in case of a failure.
+static int calibrate__measure(const struct session *session,
+                              const struct kdf_cost cost,
+                              const uint64_t memory, const size_t num_threads,
+                              double *latency_ms, double *throughput) {
+  *latency_ms = calibrate__time(session, cost, 1, false);
+  if (*latency_ms < 0) {
+    return -1;
+  }
+  const double batch_ms = calibrate__time(
+      session, cost,
+      SCRYPT_LANES * calibrate__instance_memory(&cost) <= memory ? SCRYPT_LANES
+                                                                 : 1,
+      true);
+  if (batch_ms < 0) {
+    return -1;
+  }
+  *throughput = 1e3 * (double)num_threads / batch_ms;
+  return 0;
+}
+
+// Prints the latency of a derivation for growing N to `out`, together with
+// the throughput of `padre --all`, and recommends the cost parameters for a
+// derivation that takes about `latency_ms` milliseconds and at most `memory`
+// bytes.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int calibrate(const double latency_ms, const uint64_t memory,
+                     FILE *out) {
+  const long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+  const size_t num_threads = nprocs > 0 ? (size_t)nprocs : 1;
+
+  struct kdf_cost cost = {KDF_SCRYPT, CALIBRATE_MIN_N, MP_r, 1};
+  if (calibrate__memory(&cost) > memory) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct session session;
+  session_init(&session, 11, "calibration");
+
+  fprintf(out,
+          "scrypt with r = %" PRIu32 " and p = 1 on %zu processors\n\n"
+          "%10s %10s %12s %16s\n",
+          cost.r, num_threads, "N", "memory", "latency", "batch");
+
+  struct kdf_cost best = cost;
+  double best_ms = -1;
+  double best_throughput = 0;
+  int ret = 0;
+  for (; calibrate__memory(&cost) <= memory &&
+         scrypt_valid_params(cost.N, cost.r, cost.p);
+       cost.N *= 2) {
+    double ms;
+    double throughput;
+    if ((ret = calibrate__measure(&session, cost, memory, num_threads, &ms,
+                                  &throughput)) != 0) {
+      break;
+    }
+    fprintf(out, "%10" PRIu64 " %6" PRIu64 " MiB %9.1f ms %12.0f / s\n",
+            cost.N, calibrate__memory(&cost) >> 20, ms, throughput);
+
+    if (ms <= latency_ms || best_ms < 0) {
+      best = cost;
+      best_ms = ms;
+      best_throughput = throughput;
+    }
+    if (ms > CALIBRATE_OVERSHOOT * latency_ms) {
+      break;
+    }
+  }
+
+  // Whatever processors are left go to p, as far as there is memory for their
+  // instances of ROMix, and then whatever time is left.  Beyond the memory,
+  // more instances would still run on threads of their own.
+  if (ret == 0 && best_ms > 0) {
+    const uint64_t instances = memory / calibrate__instance_memory(&best);
+    const size_t threads = kdf_num_threads(UINT32_MAX);
+    const uint64_t rounds =
+        latency_ms > best_ms ? (uint64_t)(latency_ms / best_ms) : 1;
+    const uint64_t p = instances < threads ? instances : threads * rounds;
+    if (p > 1 && p <= UINT32_MAX &&
+        scrypt_valid_params(best.N, best.r, (uint32_t)p)) {
+      best.p = (uint32_t)p;
+      ret = calibrate__measure(&session, best, memory, num_threads, &best_ms,
+                               &best_throughput);
+    }
+  }
+  session_clear(&session);
+  if (ret != 0) {
+    return -1;
+  }
+
+  fprintf(out,
+          "\nFor a latency of %.0f ms and at most %" PRIu64
+          " MiB per derivation:\n\n"
+          "    --scrypt-N %" PRIu64 " --scrypt-r %" PRIu32
+          " --scrypt-p %" PRIu32 "\n\n"
+          "or `,%" PRIu64 ",%" PRIu32 ",%" PRIu32 "` after the scheme in the"
+          " database.\nA derivation takes %.1f ms; `--all` derives %.0f per"
+          " second.\n",
+          latency_ms, memory >> 20, best.N, best.r, best.p, best.N, best.r,
+          best.p, best_ms, best_throughput);
+  return 0;
+}
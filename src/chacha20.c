@@ -0,0 +1,111 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// The ChaCha20 stream cipher (RFC 8439), of which only the keystream is used,
+// to expand a key derived by scrypt into as many bytes as a password needs.
+// Depends on the byte order helpers of scrypt.c.
+
+#include "padre.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 12
+#define CHACHA20_BLOCK_SIZE 64
+
+struct chacha20 {
+  uint32_t state[16];
+  uint8_t block[CHACHA20_BLOCK_SIZE]; // the current block of the keystream
+  size_t used;                        // the bytes of `block` already used
+};
+
+#define CHACHA20_QUARTER_ROUND(x, a, b, c, d)                                  \
+  do {                                                                         \
+    x[a] += x[b];                                                              \
+    x[d] = rotl32(x[d] ^ x[a], 16);                                            \
+    x[c] += x[d];                                                              \
+    x[b] = rotl32(x[b] ^ x[c], 12);                                            \
+    x[a] += x[b];                                                              \
+    x[d] = rotl32(x[d] ^ x[a], 8);                                             \
+    x[c] += x[d];                                                              \
+    x[b] = rotl32(x[b] ^ x[c], 7);                                             \
+  } while (0)
+
+// Computes the keystream block of `state` into `out`.
+static void chacha20__block(const uint32_t state[static 16],
+                            uint8_t out[static CHACHA20_BLOCK_SIZE]) {
+  uint32_t x[16];
+  memcpy(x, state, sizeof x);
+  for (int i = 0; i < 10; ++i) {
+    CHACHA20_QUARTER_ROUND(x, 0, 4, 8, 12);
+    CHACHA20_QUARTER_ROUND(x, 1, 5, 9, 13);
+    CHACHA20_QUARTER_ROUND(x, 2, 6, 10, 14);
+    CHACHA20_QUARTER_ROUND(x, 3, 7, 11, 15);
+    CHACHA20_QUARTER_ROUND(x, 0, 5, 10, 15);
+    CHACHA20_QUARTER_ROUND(x, 1, 6, 11, 12);
+    CHACHA20_QUARTER_ROUND(x, 2, 7, 8, 13);
+    CHACHA20_QUARTER_ROUND(x, 3, 4, 9, 14);
+  }
+  for (size_t i = 0; i < 16; ++i) {
+    le32enc(&out[4 * i], x[i] + state[i]);
+  }
+  explicit_bzero(x, sizeof x);
+}
+
+// Starts the keystream of `key` and `nonce` at the block `counter`.
+static void chacha20_init(struct chacha20 *ctx,
+                          const uint8_t key[static CHACHA20_KEY_SIZE],
+                          const uint8_t nonce[static CHACHA20_NONCE_SIZE],
+                          const uint32_t counter) {
+  // "expand 32-byte k"
+  ctx->state[0] = 0x61707865;
+  ctx->state[1] = 0x3320646e;
+  ctx->state[2] = 0x79622d32;
+  ctx->state[3] = 0x6b206574;
+  for (size_t i = 0; i < 8; ++i) {
+    ctx->state[4 + i] = le32dec(&key[4 * i]);
+  }
+  ctx->state[12] = counter;
+  for (size_t i = 0; i < 3; ++i) {
+    ctx->state[13 + i] = le32dec(&nonce[4 * i]);
+  }
+  ctx->used = CHACHA20_BLOCK_SIZE; // no block computed yet
+}
+
+// Stores the next `len` bytes of the keystream in `out`.
+static void chacha20_keystream(struct chacha20 *ctx, uint8_t *out,
+                               size_t len) {
+  while (len > 0) {
+    if (ctx->used == CHACHA20_BLOCK_SIZE) {
+      chacha20__block(ctx->state, ctx->block);
+      ++ctx->state[12];
+      ctx->used = 0;
+    }
+    const size_t n = CHACHA20_BLOCK_SIZE - ctx->used < len
+                         ? CHACHA20_BLOCK_SIZE - ctx->used
+                         : len;
+    memcpy(out, &ctx->block[ctx->used], n);
+    ctx->used += n;
+    out += n;
+    len -= n;
+  }
+}
+
+static void chacha20_clear(struct chacha20 *ctx) {
+  explicit_bzero(ctx, sizeof *ctx);
+}
@@ -0,0 +1,391 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// Compiles the spec of the characters of a password, e.g. `a-zA-Z0-9_` or
+// `:alnum:`, into the table of characters the password is drawn from.  The
+// spec lists characters and ranges of characters `<first>-<last>`; a `-` that
+// does not make a range stands for itself and white space is ignored.
+//
+// In scheme 1, the spec is taken byte by byte and the table keeps duplicates,
+// exactly as passwords of scheme 1 have always been derived.  In scheme 2,
+// the spec is UTF-8 and each character is in the table once, where it first
+// appears.
+//
+// The tables are cached per spec, so that a database that repeats the same
+// few specs has each of them parsed only once.
+
+#include "padre.h"
+
+#include <pthread.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The largest table of scheme 1, which never had room for more characters.
+#define CHARSET_MAX_LEGACY_SIZE 94
+
+// The largest table of scheme 2.
+#define CHARSET_MAX_SIZE 65536
+
+// The most bytes a character of scheme 2 takes in UTF-8.
+#define CHARSET_MAX_CHAR_SIZE 4
+
+// The number of tables that are cached; a power of two.
+#define CHARSET_CACHE_SIZE 256
+
+struct charset {
+  const char *spec;   // the spec it was compiled from, as it was given
+  enum scheme scheme; // the scheme it was compiled for
+  bool cached;        // whether it is in the cache, which owns it
+  size_t size;        // the number of characters
+  uint32_t chars[];   // the code points; the bytes in scheme 1
+};
+
+// The names of classes of characters and the specs they stand for.
+static const struct {
+  const char *name;
+  const char *spec;
+} charset__classes[] = {
+    {"", "!-~"},
+    {"*", "!-~"},
+    {":graph:", "!-~"},
+    {":alnum:", "a-zA-Z0-9"},
+    {":alpha:", "a-zA-Z"},
+    {":digit:", "0-9"},
+    {":lower:", "a-z"},
+    {":punct:", "!-/:-@[-`{-~"},
+    {":upper:", "A-Z"},
+    {":word:", "A-Za-z0-9_"},
+    {":xdigit:", "A-Fa-f0-9"},
+};
+
+// Decodes the character of scheme 1 at `*str`, a byte that is taken as signed
+// as it has always been, and advances `*str` behind it.
+// Returns 0.
+static int charset__next_byte(const char **str, int32_t *c) {
+  *c = (signed char)**str;
+  ++*str;
+  return 0;
+}
+
+// Decodes the UTF-8 character at `*str` and advances `*str` behind it.
+// Returns 0 on success; -1 if it is not valid UTF-8.
+static int charset__next_utf8(const char **str, int32_t *c) {
+  const uint8_t *s = (const uint8_t *)*str;
+  size_t len;
+  uint32_t cp;
+  if (s[0] < 0x80) {
+    len = 1;
+    cp = s[0];
+  } else if ((s[0] & 0xe0) == 0xc0) {
+    len = 2;
+    cp = s[0] & 0x1fu;
+  } else if ((s[0] & 0xf0) == 0xe0) {
+    len = 3;
+    cp = s[0] & 0x0fu;
+  } else if ((s[0] & 0xf8) == 0xf0) {
+    len = 4;
+    cp = s[0] & 0x07u;
+  } else {
+    return -1;
+  }
+  for (size_t i = 1; i < len; ++i) {
+    if ((s[i] & 0xc0) != 0x80) {
+      return -1;
+    }
+    cp = cp << 6 | (s[i] & 0x3fu);
+  }
+  // neither overlong nor a surrogate nor beyond Unicode
+  static const uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (cp < min[len] || (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) {
+    return -1;
+  }
+  *c = (int32_t)cp;
+  *str += len;
+  return 0;
+}
+
+// Encodes the code point `c` in UTF-8 at `out`.
+// Returns the number of bytes written.
+static size_t charset__encode(const uint32_t c, char *out) {
+  if (c < 0x80) {
+    out[0] = (char)c;
+    return 1;
+  }
+  if (c < 0x800) {
+    out[0] = (char)(0xc0 | c >> 6);
+    out[1] = (char)(0x80 | (c & 0x3f));
+    return 2;
+  }
+  if (c < 0x10000) {
+    out[0] = (char)(0xe0 | c >> 12);
+    out[1] = (char)(0x80 | (c >> 6 & 0x3f));
+    out[2] = (char)(0x80 | (c & 0x3f));
+    return 3;
+  }
+  out[0] = (char)(0xf0 | c >> 18);
+  out[1] = (char)(0x80 | (c >> 12 & 0x3f));
+  out[2] = (char)(0x80 | (c >> 6 & 0x3f));
+  out[3] = (char)(0x80 | (c & 0x3f));
+  return 4;
+}
+
+// The table as it is being compiled.
+struct charset__table {
+  int32_t *chars;
+  size_t size;
+  size_t max_size;
+};
+
+// Appends the characters from `first` to `last` to `table`, but for the
+// surrogates, which are not characters.
+// Returns 0 on success; -1 if the table would grow too large.
+static int charset__push(struct charset__table *table, const int32_t first,
+                         const int32_t last) {
+  for (int32_t c = first; c <= last; ++c) {
+    if (c >= 0xd800 && c <= 0xdfff) {
+      continue;
+    }
+    if (table->size == table->max_size) {
+      return -1;
+    }
+    table->chars[table->size++] = c;
+  }
+  return 0;
+}
+
+static int charset__compare(const void *a, const void *b) {
+  const int64_t *x = a;
+  const int64_t *y = b;
+  return (*x > *y) - (*x < *y);
+}
+
+// Removes the characters from `table` that are in it before, keeping the
+// order of the others.
+// Returns 0 on success; -1 in case of a failure.
+static int charset__deduplicate(struct charset__table *table) {
+  // sort the characters, each along with its position, so that the first of
+  // equal ones comes first
+  int64_t *sorted =
+      malloc((table->size > 0 ? table->size : 1) * sizeof(int64_t));
+  if (sorted == nullptr) {
+    return -1;
+  }
+  for (size_t i = 0; i < table->size; ++i) {
+    sorted[i] = (int64_t)table->chars[i] << 32 | (int64_t)i;
+  }
+  qsort(sorted, table->size, sizeof *sorted, charset__compare);
+
+  // mark the duplicates, then drop them
+  for (size_t i = 1; i < table->size; ++i) {
+    if (sorted[i] >> 32 == sorted[i - 1] >> 32) {
+      table->chars[sorted[i] & UINT32_MAX] = -1;
+    }
+  }
+  free(sorted);
+  size_t size = 0;
+  for (size_t i = 0; i < table->size; ++i) {
+    if (table->chars[i] >= 0) {
+      table->chars[size++] = table->chars[i];
+    }
+  }
+  table->size = size;
+  return 0;
+}
+
+// Parses `spec` into `table`, taking its characters with `next`.
+// Returns 0 on success; -1 if `spec` is invalid or in case of a failure.
+static int charset__parse(const char *spec,
+                          int (*next)(const char **str, int32_t *c),
+                          struct charset__table *table) {
+  int32_t first = 0; // the first character of a range, if `has_first`
+  bool has_first = false;
+  bool range = false; // a `-` follows `first`
+  int ret = 0;
+  while (ret == 0 && *spec != '\0') {
+    if (*spec == ' ' || (*spec >= '\t' && *spec <= '\r')) {
+      ++spec;
+      continue;
+    }
+    int32_t c;
+    if (next(&spec, &c) != 0) {
+      errno = EILSEQ;
+      return -1;
+    }
+
+    if (c == '-' && !has_first) {
+      ret = charset__push(table, c, c);
+    } else if (c == '-') {
+      range = true;
+    } else if (range) {
+      ret = charset__push(table, first, c);
+      has_first = false;
+      range = false;
+    } else {
+      if (has_first) {
+        ret = charset__push(table, first, first);
+      }
+      first = c;
+      has_first = true;
+    }
+  }
+  if (ret == 0 && has_first) {
+    ret = charset__push(table, first, first);
+  }
+  if (ret == 0 && range) {
+    ret = charset__push(table, '-', '-');
+  }
+  if (ret != 0) {
+    errno = EINVAL;
+  }
+  return ret;
+}
+
+// Compiles `spec` for `scheme`.  The table must be freed with `free()`.
+// Returns the table; `nullptr` if `spec` is invalid, with `errno` set, or in
+// case of a failure.
+static struct charset *charset_compile(const char *const spec,
+                                       const enum scheme scheme) {
+  const char *resolved = spec;
+  for (size_t i = 0; i < sizeof charset__classes / sizeof charset__classes[0];
+       ++i) {
+    if (strcmp(spec, charset__classes[i].name) == 0) {
+      resolved = charset__classes[i].spec;
+      break;
+    }
+  }
+
+  const bool legacy = scheme == SCHEME_V1;
+  struct charset__table table = {
+      .chars = nullptr,
+      .size = 0,
+      .max_size = legacy ? CHARSET_MAX_LEGACY_SIZE : CHARSET_MAX_SIZE,
+  };
+  table.chars = malloc(table.max_size * sizeof(int32_t));
+  if (table.chars == nullptr) {
+    return nullptr;
+  }
+  if (charset__parse(resolved,
+                     legacy ? charset__next_byte : charset__next_utf8,
+                     &table) != 0 ||
+      (!legacy && charset__deduplicate(&table) != 0)) {
+    free(table.chars);
+    return nullptr;
+  }
+  if (legacy) {
+    // the table used to be a string, which ended at a null byte
+    for (size_t i = 0; i < table.size; ++i) {
+      if (table.chars[i] == 0) {
+        table.size = i;
+        break;
+      }
+    }
+  }
+  if (table.size == 0) {
+    free(table.chars);
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  const size_t spec_size = strlen(spec) + 1;
+  struct charset *set = malloc(sizeof *set + table.size * sizeof(uint32_t) +
+                               spec_size);
+  if (set == nullptr) {
+    free(table.chars);
+    return nullptr;
+  }
+  set->scheme = scheme;
+  set->cached = false;
+  set->size = table.size;
+  for (size_t i = 0; i < table.size; ++i) {
+    // in scheme 1, the characters are the bytes they have always been
+    set->chars[i] = legacy ? (uint8_t)table.chars[i] : (uint32_t)table.chars[i];
+  }
+  set->spec = memcpy(&set->chars[table.size], spec, spec_size);
+  free(table.chars);
+  return set;
+}
+
+static struct {
+  pthread_mutex_t lock;
+  struct charset *sets[CHARSET_CACHE_SIZE];
+  size_t size;
+} charset__cache = {PTHREAD_MUTEX_INITIALIZER, {nullptr}, 0};
+
+// Returns the slot of `spec` of `scheme` in the cache, which is either empty
+// or holds its table.  Must be called with the cache locked.
+static size_t charset__slot(const char *spec, const enum scheme scheme) {
+  uint64_t hash = 14695981039346656037u ^ (uint64_t)scheme;
+  for (const char *c = spec; *c != '\0'; ++c) {
+    hash = (hash ^ (uint8_t)*c) * 1099511628211u;
+  }
+  size_t slot = hash & (CHARSET_CACHE_SIZE - 1);
+  for (const struct charset *set; (set = charset__cache.sets[slot]) != nullptr;
+       slot = (slot + 1) & (CHARSET_CACHE_SIZE - 1)) {
+    if (set->scheme == scheme && strcmp(set->spec, spec) == 0) {
+      break;
+    }
+  }
+  return slot;
+}
+
+// Returns the table of `spec` for `scheme`, which is compiled only the first
+// time it is asked for.  It must be handed back with `charset_put()`.  May be
+// called from any thread.
+// Returns `nullptr` if `spec` is invalid, with `errno` set, or in case of a
+// failure.
+static const struct charset *charset_get(const char *spec,
+                                         const enum scheme scheme) {
+  pthread_mutex_lock(&charset__cache.lock);
+  struct charset *set = charset__cache.sets[charset__slot(spec, scheme)];
+  pthread_mutex_unlock(&charset__cache.lock);
+  if (set != nullptr) {
+    return set;
+  }
+
+  struct charset *compiled = charset_compile(spec, scheme);
+  if (compiled == nullptr) {
+    return nullptr;
+  }
+  pthread_mutex_lock(&charset__cache.lock);
+  const size_t slot = charset__slot(spec, scheme);
+  set = charset__cache.sets[slot];
+  if (set == nullptr && 2 * (charset__cache.size + 1) <= CHARSET_CACHE_SIZE) {
+    // keep the cache at most half full, the other tables are not cached
+    compiled->cached = true;
+    charset__cache.sets[slot] = compiled;
+    ++charset__cache.size;
+  }
+  pthread_mutex_unlock(&charset__cache.lock);
+
+  if (set != nullptr) {
+    // another thread has been faster
+    free(compiled);
+    return set;
+  }
+  return compiled;
+}
+
+// Hands back `set`, which `charset_get()` returned.
+static void charset_put(const struct charset *set) {
+  if (set != nullptr && !set->cached) {
+    free((struct charset *)set);
+  }
+}
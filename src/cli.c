@@ -18,7 +18,12 @@
 
 #include <argp.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Provides access to all command-line arguments that were parsed.
 struct cli_opts {
@@ -27,14 +32,141 @@ struct cli_opts {
   const char *iteration;
   const char *characters;
   size_t length;
+  bool all;            // derive all accounts of the database
+  bool compile;        // compile the database instead of deriving a password
+  const char *output;  // the file the database is compiled to
+  bool agent;          // start an agent instead of deriving a password
+  bool password_first; // ask for the master password before the account
+  unsigned timeout;    // idle seconds after which the agent exits
+  size_t budget;       // the size of the largest database that is loaded
+  const char *select;  // the key of the account to select from the database
+  enum scheme scheme;  // the scheme of the account given by domain and username
+  bool timings;        // report the time spent in each phase at exit
+  struct kdf_cost cost; // of the account given by domain and username
+  enum kdf cost_kdf;    // whose cost parameters were given; NUM_KDFS if none
+  bool calibrate;       // recommend cost parameters instead of deriving
+  unsigned latency;     // the latency to calibrate for, in milliseconds
+  size_t memory;        // bytes for calibrate or all derivations; 0 if unset
+  bool serve_stdio;     // answer requests on the standard input instead
 };
 
+// Parses a number of bytes with an optional suffix K, M or G (powers of 1024).
+// Returns 0 on success; -1 if `arg` is not such a number.
+static int cli__parse_size(const char *arg, size_t *size) {
+  char *end;
+  errno = 0;
+  const unsigned long long n = strtoull(arg, &end, 10);
+  if (errno != 0 || end == arg || *arg == '-') {
+    return -1;
+  }
+
+  unsigned shift = 0;
+  switch (*end) {
+  case '\0':
+    break;
+  case 'K':
+    shift = 10;
+    break;
+  case 'M':
+    shift = 20;
+    break;
+  case 'G':
+    shift = 30;
+    break;
+  default:
+    return -1;
+  }
+  if (shift > 0 && end[1] != '\0') {
+    return -1;
+  }
+  if (n > SIZE_MAX >> shift) {
+    return -1;
+  }
+
+  *size = (size_t)n << shift;
+  return 0;
+}
+
+// The keys of the options that have no short name.
+enum {
+  CLI_ARGON2_M = 0x100,
+  CLI_ARGON2_T,
+  CLI_ARGON2_P,
+  CLI_SERVE_STDIO,
+};
+
+// Parses a cost parameter, which must be at least 1 and at most `max`.
+// Returns 0 on success; -1 if `arg` is not such a number.
+static int cli__parse_cost(const char *arg, const uint64_t max,
+                           uint64_t *value) {
+  char *end;
+  errno = 0;
+  const unsigned long long n = strtoull(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || *arg == '-' || n < 1 ||
+      n > max) {
+    return -1;
+  }
+  *value = n;
+  return 0;
+}
+
+// Notes that a cost parameter of `kdf` was given.
+// Returns 0 on success; -1 if those of another KDF were given before.
+static int cli__cost_of(struct cli_opts *options, const enum kdf kdf) {
+  if (options->cost_kdf != NUM_KDFS && options->cost_kdf != kdf) {
+    fputs("Error: the cost parameters of different KDFs cannot be mixed\n",
+          stderr);
+    return -1;
+  }
+  options->cost_kdf = kdf;
+  return 0;
+}
+
 static error_t parse_opt(const int key, char *arg, struct argp_state *state) {
   int tmp;
+  char *end;
+  unsigned long ul;
 
   struct cli_opts *options = state->input;
 
   switch (key) {
+  case 'a':
+    options->all = true;
+    break;
+  case 'A':
+    options->agent = true;
+    break;
+  case 'b':
+    if (cli__parse_size(arg, &options->budget) != 0) {
+      fputs("Error: invalid memory budget\n", stderr);
+      return EINVAL;
+    }
+    break;
+  case 'L':
+    errno = 0;
+    ul = strtoul(arg, &end, 10);
+    if (errno != 0 || *arg == '\0' || *end != '\0' || ul == 0 ||
+        ul > UINT_MAX) {
+      fputs("Error: invalid latency\n", stderr);
+      return EINVAL;
+    }
+    options->latency = (unsigned)ul;
+    break;
+  case 'M':
+    if (cli__parse_size(arg, &options->memory) != 0 || options->memory == 0) {
+      fputs("Error: invalid memory limit\n", stderr);
+      return EINVAL;
+    }
+    break;
+  case 't':
+    errno = 0;
+    ul = strtoul(arg, &end, 10);
+    if (errno != 0 || *arg == '\0' || *end != '\0' || ul > INT_MAX / 1000) {
+      fputs("Error: invalid timeout\n", stderr);
+      return EINVAL;
+    }
+    options->timeout = (unsigned)ul;
+    break;
   case 'c':
     options->characters = arg;
     break;
@@ -51,27 +183,187 @@ static error_t parse_opt(const int key, char *arg, struct argp_state *state) {
   case 'i':
     options->iteration = arg;
     break;
+  case 'o':
+    options->output = arg;
+    break;
+  case 'p':
+    options->password_first = true;
+    break;
+  case 's':
+    options->select = arg;
+    break;
+  case 'S':
+    errno = 0;
+    ul = strtoul(arg, &end, 10);
+    if (errno != 0 || *arg == '\0' || *end != '\0' || ul < 1 ||
+        ul > NUM_SCHEMES) {
+      fputs("Error: unknown scheme\n", stderr);
+      return EINVAL;
+    }
+    options->scheme = (enum scheme)(ul - 1);
+    break;
+  case 'T':
+    options->timings = true;
+    break;
+  case CLI_SERVE_STDIO:
+    options->serve_stdio = true;
+    break;
+  case 'K':
+    if (parse_kdf(arg, &options->cost.kdf) != 0) {
+      fputs("Error: unknown KDF\n", stderr);
+      return EINVAL;
+    }
+    break;
+  case 'N':
+    if (cli__cost_of(options, KDF_SCRYPT) != 0) {
+      return EINVAL;
+    }
+    if (cli__parse_cost(arg, UINT64_MAX, &options->cost.N) != 0 ||
+        options->cost.N < 2 || (options->cost.N & (options->cost.N - 1)) != 0) {
+      fputs("Error: the cost parameter N must be a power of 2\n", stderr);
+      return EINVAL;
+    }
+    break;
+  case 'r':
+  case 'P': {
+    uint64_t value;
+    if (cli__cost_of(options, KDF_SCRYPT) != 0) {
+      return EINVAL;
+    }
+    if (cli__parse_cost(arg, UINT32_MAX, &value) != 0) {
+      fprintf(stderr, "Error: invalid cost parameter %s\n",
+              key == 'r' ? "r" : "p");
+      return EINVAL;
+    }
+    *(key == 'r' ? &options->cost.r : &options->cost.p) = (uint32_t)value;
+    break;
+  }
+  case CLI_ARGON2_M:
+  case CLI_ARGON2_T:
+  case CLI_ARGON2_P: {
+    uint64_t value;
+    if (cli__cost_of(options, KDF_ARGON2ID) != 0) {
+      return EINVAL;
+    }
+    if (cli__parse_cost(arg, UINT32_MAX, &value) != 0) {
+      fprintf(stderr, "Error: invalid cost parameter %s\n",
+              key == CLI_ARGON2_M   ? "m"
+              : key == CLI_ARGON2_T ? "t"
+                                    : "p");
+      return EINVAL;
+    }
+    if (key == CLI_ARGON2_M) {
+      options->cost.N = value;
+    } else {
+      *(key == CLI_ARGON2_T ? &options->cost.r : &options->cost.p) =
+          (uint32_t)value;
+    }
+    break;
+  }
 
-  case ARGP_KEY_ARG:
-    switch (state->arg_num) {
-    case 0:
+  case ARGP_KEY_ARG: {
+    // after `--`, `compile` and `calibrate` are domains like any other
+    const bool quoted = state->quoted != 0 && state->next > state->quoted;
+    if (state->arg_num == 0 && !quoted && strcmp(arg, "compile") == 0) {
+      options->compile = true;
+    } else if (state->arg_num == 0 && !quoted &&
+               strcmp(arg, "calibrate") == 0) {
+      options->calibrate = true;
+    } else if (options->calibrate) {
+      fputs("Error: calibrate takes no further arguments\n", stderr);
+      argp_usage(state); // exits
+    } else if (options->domain_or_database == nullptr) {
       options->domain_or_database = arg;
-      break;
-    case 1:
+    } else if (options->username == nullptr && !options->compile) {
       options->username = arg;
-      break;
-    default:
+    } else {
       fputs("Error: too many arguments\n", stderr);
       argp_usage(state); // exits
     }
     break;
+  }
 
-  case ARGP_KEY_END:
+  case ARGP_KEY_END: {
+    // the cost parameters that were not given are the defaults of the KDF
+    const struct kdf_backend *kdf = &kdf_backends[options->cost.kdf];
+    if (options->cost_kdf != NUM_KDFS &&
+        options->cost_kdf != options->cost.kdf) {
+      fprintf(stderr, "Error: the cost parameters given are not those of %s\n",
+              kdf->name);
+      argp_usage(state); // exits
+    }
+    if (options->cost.N == 0) {
+      options->cost.N = kdf->default_cost.N;
+    }
+    if (options->cost.r == 0) {
+      options->cost.r = kdf->default_cost.r;
+    }
+    if (options->cost.p == 0) {
+      options->cost.p = kdf->default_cost.p;
+    }
+    if (!kdf->valid_cost(&options->cost)) {
+      fputs("Error: invalid cost parameters\n", stderr);
+      argp_usage(state); // exits
+    }
+
+    if (options->agent) {
+      if (state->arg_num > 0 || options->all || options->select != nullptr) {
+        fputs("Error: --agent takes no further arguments\n", stderr);
+        argp_usage(state); // exits
+      }
+      break;
+    }
+    if (options->serve_stdio) {
+      if (state->arg_num > 0 || options->all || options->select != nullptr) {
+        fputs("Error: --serve-stdio takes no further arguments\n", stderr);
+        argp_usage(state); // exits
+      }
+      break;
+    }
+    if (options->calibrate) {
+      if (options->all || options->select != nullptr) {
+        fputs("Error: calibrate takes no further arguments\n", stderr);
+        argp_usage(state); // exits
+      }
+      break;
+    }
+    if (options->compile) {
+      if (options->domain_or_database == nullptr ||
+          options->output == nullptr || options->all ||
+          options->select != nullptr) {
+        fputs("Error: compile requires a database and --output\n", stderr);
+        argp_usage(state); // exits
+      }
+      break;
+    }
     if (state->arg_num < 1) {
       fputs("Error: missing required argument(s)\n", stderr);
       argp_usage(state); // exits
     }
+    if (options->all && options->username != nullptr) {
+      fputs("Error: --all requires a database\n", stderr);
+      argp_usage(state); // exits
+    }
+    if (options->select != nullptr &&
+        (options->username != nullptr || options->all)) {
+      fputs("Error: --select requires a database and excludes --all\n",
+            stderr);
+      argp_usage(state); // exits
+    }
+    if (options->scheme != SCHEME_V1 && options->username == nullptr) {
+      fputs("Error: --scheme requires <domain> and <username>, the scheme of"
+            " the accounts of a database is part of the database\n",
+            stderr);
+      argp_usage(state); // exits
+    }
+    if (!kdf_cost_is_default(&options->cost) && options->username == nullptr) {
+      fputs("Error: the cost parameters require <domain> and <username>, those"
+            " of the accounts of a database are part of the database\n",
+            stderr);
+      argp_usage(state); // exits
+    }
     break;
+  }
 
   default:
     return ARGP_ERR_UNKNOWN;
@@ -87,12 +379,92 @@ static struct argp_option cli_options[] = {
      "List of characters or the name of a POSIX character class to use in"
      " the generated password (regexp notation).",
      0},
+    {"scheme", 'S', "1", 0,
+     "The scheme by which the password is derived. Scheme 2 draws every"
+     " character with the same probability and costs the same for any length."
+     " Changing the scheme changes the password.",
+     0},
+    {"scrypt-N", 'N', "16384", 0,
+     "The CPU/memory cost of scrypt, a power of 2. Together with -r, it sets"
+     " the memory a derivation takes, 128 * N * r bytes. Changing a cost"
+     " parameter changes the password.",
+     0},
+    {"scrypt-r", 'r', "8", 0, "The block size of scrypt.", 0},
+    {"scrypt-p", 'P', "1", 0,
+     "The parallelization of scrypt, which multiplies the time a derivation"
+     " takes.",
+     0},
+    {"kdf", 'K', "scrypt", 0,
+     "The key derivation function, `scrypt` or `argon2id`. Changing the KDF"
+     " changes the password.",
+     0},
+    {"argon2-m", CLI_ARGON2_M, "65536", 0,
+     "The memory an Argon2id derivation takes, in KiB, at least 8 times -p.",
+     0},
+    {"argon2-t", CLI_ARGON2_T, "3", 0, "The number of passes of Argon2id.", 0},
+    {"argon2-p", CLI_ARGON2_P, "4", 0,
+     "The number of lanes of Argon2id, which are filled in parallel.", 0},
+    {"latency", 'L', "250", 0,
+     "The time a derivation may take, in milliseconds, see `calibrate`.", 0},
+    {"memory", 'M', "64M", 0,
+     "The memory a derivation may take, in bytes or with a suffix K, M or G,"
+     " see `calibrate`. With --all or --password-first, the memory all"
+     " derivations at once may take, a quarter of the physical memory by"
+     " default, which limits the number of threads.",
+     0},
+    {"all", 'a', nullptr, 0,
+     "Derive the passwords of all accounts in <database> and print them as"
+     " CSV records `<domain>,<username>,<iteration>,<password>`.",
+     0},
+    {"select", 's', "KEY", 0,
+     "Select the account of <database> given by"
+     " <domain>[:<username>[:<iteration>]] instead of showing a menu. If no"
+     " account matches exactly, the fields are taken as prefixes. Fails if"
+     " none or more than one account matches. A CSV file is parsed in full,"
+     " a compiled database is searched without that.",
+     0},
+    {"password-first", 'p', nullptr, 0,
+     "Ask for the master password before showing the accounts of <database>."
+     " The passwords of the accounts around the highlighted one are derived"
+     " while browsing, so that the selected one is shown without delay.",
+     0},
+    {"budget", 'b', "256M", 0,
+     "The size of the largest database that is loaded, in bytes or with a"
+     " suffix K, M or G.",
+     0},
+    {"output", 'o', "FILE", 0,
+     "The file to write the compiled database to, see `compile`.", 0},
+    {"agent", 'A', nullptr, 0,
+     "Ask for the master password once and start an agent in the background,"
+     " which derives the passwords for later calls of padre. Prints the shell"
+     " commands that set " AGENT_SOCKET_ENV ", through which padre finds the"
+     " agent.",
+     0},
+    {"serve-stdio", CLI_SERVE_STDIO, nullptr, 0,
+     "Read the master password once, from the first line of the standard"
+     " input unless it is a terminal, and then derive a password for each"
+     " further line, which is an account as in <database>. Each is answered"
+     " by a line `OK <password>` or `ERR <message>` on the standard output."
+     " The master password is read even if an agent is running.",
+     0},
+    {"timeout", 't', "900", 0,
+     "Number of seconds without requests after which the agent exits, or 0 to"
+     " keep it running until it is killed.",
+     0},
+    {"timings", 'T', nullptr, 0,
+     "Report the time spent reading and parsing the database, setting up the"
+     " terminal, waiting for the user, deriving and mapping the passwords, the"
+     " peak memory usage and the number of key derivations on the standard"
+     " error at exit.",
+     0},
     {nullptr}};
 
 static struct argp cli_parser = {
     cli_options,
     &parse_opt,
-    "<domain> <username>\n<database>",
+    "<domain> <username>\n<database>\ncompile <database> --output <file>\n"
+    "calibrate [--latency <ms>] [--memory <size>]\n--agent\n"
+    "--serve-stdio",
     "Derives a deterministic password from <domain> and <username> and a"
     " master password. Optionally a password iteration number may be given to"
     " generate new passwords for a combination of domain and username.\n"
@@ -100,15 +472,36 @@ static struct argp cli_parser = {
     "Instead of giving domain and username, the path to a CSV file can be"
     " given as first argument. If a dash is given, the file is read from"
     " the standard input. The file must be structured as follows.\n"
-    "    <domain>,<username>,<iteration>,<length>,<characters>",
+    "    <domain>,<username>,<iteration>,<length>,<characters>\n"
+    "If the characters are quoted, the number of the scheme, three cost"
+    " parameters and the KDF may follow as further fields, each of which may"
+    " be empty to keep its default. The cost parameters are N, r and p for"
+    " scrypt and m, t and p for argon2id.\n"
+    "\n"
+    "`compile` writes <database> to <file> in a binary format, which can be"
+    " given instead of the CSV file and is used without being parsed.\n"
+    "\n"
+    "`calibrate` measures how long scrypt takes on this machine and"
+    " recommends the cost parameters for a derivation that takes about"
+    " --latency milliseconds and at most --memory bytes.\n"
+    "\n"
+    "A domain or database named `compile` or `calibrate` is given after `--`,"
+    " e.g. `padre -- compile my_username`.",
     nullptr,
     nullptr,
     nullptr};
 
 static struct cli_opts cli_parse(const int argc, char *argv[]) {
-  struct cli_opts options = {nullptr, nullptr, nullptr, nullptr, 0};
+  struct cli_opts options = {nullptr, nullptr, nullptr, nullptr, 0,
+                             false,   false,   nullptr, false,   false,
+                             900,     DEFAULT_DATABASE_BUDGET, nullptr,
+                             SCHEME_V1, false,   {KDF_SCRYPT, 0, 0, 0},
+                             NUM_KDFS, false,  250,     0,
+                             false};
 
-  argp_parse(&cli_parser, argc, argv, 0, 0, &options);
+  if (argp_parse(&cli_parser, argc, argv, 0, 0, &options) != 0) {
+    exit(EXIT_FAILURE); // the error has been reported already
+  }
 
   return options;
 }
@@ -0,0 +1,391 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// A reader for CSV as specified in RFC 4180, which splits the records into
+// null-terminated fields in place.
+//
+// The data is scanned 64 bytes at a time for the characters that may be of
+// structural meaning, i.e. commas, newlines and quotes, using the widest
+// vector instructions the processor supports.  Only these characters are
+// looked at one by one, to decide whether they actually delimit something.
+//
+// Other than RFC 4180 demands, quotes only have a meaning at the start of a
+// field and within a quoted field.  Elsewhere they are taken literally, so
+// that older databases, in which no field was quoted, remain valid.
+
+#include "padre.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define CSV_X86 1
+#include <immintrin.h>
+#else
+#define CSV_X86 0
+#endif
+
+#define CSV_BLOCK_SIZE 64
+
+// Returns a mask with bit `i` set if `block[i]` is a comma, newline or quote.
+typedef uint64_t csv_mask_fn(const char block[static CSV_BLOCK_SIZE]);
+
+static uint64_t csv__mask_generic(const char block[static CSV_BLOCK_SIZE]) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < CSV_BLOCK_SIZE; ++i) {
+    const char c = block[i];
+    mask |= (uint64_t)(c == ',' || c == '\n' || c == '"') << i;
+  }
+  return mask;
+}
+
+#if CSV_X86
+
+__attribute__((target("sse2"))) static uint64_t
+csv__mask_sse2(const char block[static CSV_BLOCK_SIZE]) {
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i quote = _mm_set1_epi8('"');
+  uint64_t mask = 0;
+  for (size_t i = 0; i < CSV_BLOCK_SIZE / 16; ++i) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)&block[16 * i]);
+    const __m128i eq = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, newline)),
+        _mm_cmpeq_epi8(v, quote));
+    mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(eq) << (16 * i);
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+csv__mask_avx2(const char block[static CSV_BLOCK_SIZE]) {
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i quote = _mm256_set1_epi8('"');
+  uint64_t mask = 0;
+  for (size_t i = 0; i < CSV_BLOCK_SIZE / 32; ++i) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)&block[32 * i]);
+    const __m256i eq = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+                        _mm256_cmpeq_epi8(v, newline)),
+        _mm256_cmpeq_epi8(v, quote));
+    mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(eq) << (32 * i);
+  }
+  return mask;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+csv__mask_avx512(const char block[static CSV_BLOCK_SIZE]) {
+  const __m512i v = _mm512_loadu_si512(block);
+  return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(',')) |
+         _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n')) |
+         _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('"'));
+}
+
+static bool csv__avx512_supported(void) {
+  return __builtin_cpu_supports("avx512f") &&
+         __builtin_cpu_supports("avx512bw");
+}
+static bool csv__avx2_supported(void) {
+  return __builtin_cpu_supports("avx2");
+}
+static bool csv__sse2_supported(void) {
+  return __builtin_cpu_supports("sse2");
+}
+
+#endif // CSV_X86
+
+struct csv_kernel {
+  const char *name;
+  bool (*supported)(void); // `nullptr` if always supported
+  csv_mask_fn *mask;
+};
+
+// from best to worst
+static const struct csv_kernel csv_kernels[] = {
+#if CSV_X86
+    {"avx512", csv__avx512_supported, csv__mask_avx512},
+    {"avx2", csv__avx2_supported, csv__mask_avx2},
+    {"sse2", csv__sse2_supported, csv__mask_sse2},
+#endif
+    {"generic", nullptr, csv__mask_generic},
+};
+
+#define NUM_CSV_KERNELS (sizeof csv_kernels / sizeof csv_kernels[0])
+
+static bool csv_kernel_supported(const struct csv_kernel *kernel) {
+  return kernel->supported == nullptr || kernel->supported();
+}
+
+static const struct csv_kernel *csv_select_kernel(void) {
+  for (size_t i = 0; i < NUM_CSV_KERNELS; ++i) {
+    if (csv_kernel_supported(&csv_kernels[i])) {
+      return &csv_kernels[i];
+    }
+  }
+  return &csv_kernels[NUM_CSV_KERNELS - 1];
+}
+
+struct csv_reader {
+  csv_mask_fn *mask_fn;
+  char *begin;
+  const char *end; // must be followed by a null byte
+  size_t block;    // offset of the block `mask` belongs to
+  uint64_t mask;   // the characters in the block that are yet to be looked at
+
+  size_t line;        // the line at the current position, from 1
+  char *line_start;   // the start of that line
+  const char *record; // the start of the last record read
+  size_t record_line; // the line the last record starts on
+
+  const char *error; // the last error, see `csv_read_record()`
+  size_t error_line;
+  size_t error_column;
+};
+
+// Returns the mask of the block at offset `block`.
+static uint64_t csv__load(const struct csv_reader *reader,
+                          const size_t block) {
+  const size_t size = (size_t)(reader->end - reader->begin);
+  if (size - block >= CSV_BLOCK_SIZE) {
+    return reader->mask_fn(reader->begin + block);
+  }
+  // don't read beyond the end
+  char tail[CSV_BLOCK_SIZE] = {0};
+  memcpy(tail, reader->begin + block, size - block);
+  return csv__mask_generic(tail);
+}
+
+// Like `csv_init()`, but with the kernel given explicitly.
+static void csv_init_with(const struct csv_kernel *kernel,
+                          struct csv_reader *reader, char *begin,
+                          const char *end) {
+  *reader = (struct csv_reader){
+      .mask_fn = kernel->mask,
+      .begin = begin,
+      .end = end,
+      .block = 0,
+      .line = 1,
+      .line_start = begin,
+      .record = begin,
+  };
+  if (begin < end) {
+    reader->mask = csv__load(reader, 0);
+  }
+}
+
+// Prepares `reader` to read the CSV data from `begin` to `end`.  The data must
+// be followed by a null byte.
+static void csv_init(struct csv_reader *reader, char *begin,
+                     const char *end) {
+  csv_init_with(csv_select_kernel(), reader, begin, end);
+}
+
+// Returns the next comma, newline or quote; `end` if there is none.
+static inline char *csv__next(struct csv_reader *reader) {
+  while (reader->mask == 0) {
+    reader->block += CSV_BLOCK_SIZE;
+    if (reader->block >= (size_t)(reader->end - reader->begin)) {
+      return (char *)reader->end;
+    }
+    reader->mask = csv__load(reader, reader->block);
+  }
+  const int i = __builtin_ctzll(reader->mask);
+  reader->mask &= reader->mask - 1;
+  return reader->begin + reader->block + (size_t)i;
+}
+
+static void csv__error(struct csv_reader *reader, const char *at,
+                       const char *message) {
+  reader->error = message;
+  reader->error_line = reader->line;
+  reader->error_column = (size_t)(at - reader->line_start) + 1;
+}
+
+// Skips to the start of the next line after an error.
+static void csv__skip_line(struct csv_reader *reader) {
+  for (char *p; (p = csv__next(reader)) != reader->end;) {
+    if (*p == '\n') {
+      ++reader->line;
+      reader->line_start = p + 1;
+      return;
+    }
+  }
+  reader->line_start = (char *)reader->end;
+}
+
+// Terminates the field that starts at `start` and is delimited by `stop`,
+// removing its quotes.  `close` is the closing quote of a quoted field;
+// `nullptr` if the field is not quoted.
+// Returns the terminated field; `nullptr` if it is malformed.
+static char *csv__end_field(struct csv_reader *reader, char *start,
+                            char *stop, const char *close,
+                            const bool escapes) {
+  // a carriage return is part of the line break
+  const bool at_line_end = stop == reader->end || *stop == '\n';
+  if (at_line_end && stop > start && stop[-1] == '\r') {
+    --stop;
+  }
+
+  if (close == nullptr) {
+    if (stop != reader->end) {
+      *stop = '\0';
+    }
+    return start;
+  }
+
+  if (close + 1 != stop) {
+    csv__error(reader, close + 1, "unexpected character after closing quote");
+    return nullptr;
+  }
+
+  char *out = start;
+  for (const char *in = start + 1; in < close; ++in) {
+    *out++ = *in;
+    if (escapes && *in == '"') {
+      ++in; // skip the second quote of `""`
+    }
+  }
+  *out = '\0';
+  return start;
+}
+
+// Reads the next record into `fields`.  `fields[i]` points to the i-th field,
+// for the first `max_fields` fields, and `*num_fields` is set to the number of
+// fields in the record, which may be more than `max_fields`.  If the field at
+// index `rest_field` is not quoted, it extends to the end of the line,
+// commas included.  Empty lines are skipped.
+// Returns 1 if a record was read; 0 at the end of the data; -1 if the record is
+// malformed, in which case the error is stored in `reader` and the rest of the
+// line is skipped.
+static int csv_read_record(struct csv_reader *reader, const size_t max_fields,
+                           const size_t rest_field,
+                           char *fields[static max_fields],
+                           size_t *num_fields) {
+  char *start = reader->line_start;
+  if (start >= reader->end) {
+    return 0;
+  }
+
+  reader->record = start;
+  reader->record_line = reader->line;
+  size_t n = 0;
+  bool in_quotes = false;
+  const char *close = nullptr; // the closing quote of a quoted field
+  bool escapes = false;        // whether the quoted field contains `""`
+  size_t open_line = 0;        // where the quoted field starts
+  char *open_line_start = nullptr;
+
+  for (;;) {
+    char *p = csv__next(reader);
+
+    if (p != reader->end && *p == '"') {
+      if (p == start) {
+        in_quotes = true;
+        open_line = reader->line;
+        open_line_start = reader->line_start;
+      } else if (in_quotes) {
+        if (p + 1 < reader->end && p[1] == '"') {
+          csv__next(reader);
+          escapes = true;
+        } else {
+          in_quotes = false;
+          close = p;
+        }
+      } else if (close != nullptr) {
+        csv__error(reader, p, "unexpected quote after closing quote");
+        csv__skip_line(reader);
+        return -1;
+      }
+      // otherwise, the quote is taken literally
+      continue;
+    }
+
+    if (p != reader->end && in_quotes) {
+      if (*p == '\n') {
+        ++reader->line;
+        reader->line_start = p + 1;
+      }
+      continue;
+    }
+    if (p == reader->end && in_quotes) {
+      // report the opening quote, which may be lines before
+      reader->line = open_line;
+      reader->line_start = open_line_start;
+      csv__error(reader, start, "missing closing quote");
+      reader->line_start = (char *)reader->end;
+      return -1;
+    }
+
+    if (p != reader->end && *p == ',' && n == rest_field && close == nullptr &&
+        *start != '"') {
+      continue; // the rest of the line belongs to this field
+    }
+
+    // the end of a field
+    const bool empty_line =
+        n == 0 && (p == reader->end || *p == '\n') &&
+        (p == start || (p == start + 1 && *start == '\r'));
+    if (empty_line && p != reader->end) {
+      // nothing to see here, start over on the next line
+      ++reader->line;
+      start = p + 1;
+      reader->line_start = start;
+      reader->record = start;
+      reader->record_line = reader->line;
+      continue;
+    }
+    if (empty_line) {
+      reader->line_start = (char *)reader->end;
+      return 0;
+    }
+
+    // the field's terminator overwrites the delimiter
+    const bool at_line_end = p == reader->end || *p == '\n';
+    char *field = csv__end_field(reader, start, p, close, escapes);
+    if (field == nullptr) {
+      if (p == reader->end) {
+        reader->line_start = (char *)reader->end;
+      } else if (at_line_end) {
+        ++reader->line;
+        reader->line_start = p + 1;
+      } else {
+        csv__skip_line(reader);
+      }
+      return -1;
+    }
+    if (n < max_fields) {
+      fields[n] = field;
+    }
+    ++n;
+    start = p + 1;
+    close = nullptr;
+    escapes = false;
+
+    if (at_line_end) {
+      if (p == reader->end) {
+        reader->line_start = (char *)reader->end;
+      } else {
+        ++reader->line;
+        reader->line_start = p + 1;
+      }
+      *num_fields = n;
+      return 1;
+    }
+  }
+}
@@ -0,0 +1,164 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// Loads the database into memory, where `parse_accounts()` splits it in place.
+// Regular files are mapped into memory privately, so that the parser's
+// changes stay in memory and only the pages it touches are copied.  Pipes and
+// other streams are read into an anonymous mapping that grows by remapping
+// its pages rather than by copying them.
+
+#include "padre.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// The initial size of the mapping a stream is read into.
+#define DATABASE_STREAM_CHUNK_SIZE ((size_t)64 * 1024)
+
+struct database {
+  char *data;          // followed by at least one null byte
+  size_t size;         // number of bytes in `data`
+  size_t mapping_size; // number of bytes mapped at `data`
+};
+
+static size_t database__page_size(void) {
+  const long page_size = sysconf(_SC_PAGESIZE);
+  return page_size > 0 ? (size_t)page_size : 4096;
+}
+
+// Maps the regular file `fd` of `size` bytes.
+// Returns 0 on success; -1 in case of a failure.
+static int database__map_file(struct database *db, const int fd,
+                              const size_t size) {
+  // Reserve one more byte than the file has, so that the data is always
+  // terminated, even if the file does not end with a newline.  Mapping the
+  // file over an anonymous mapping makes sure there are pages behind it.
+  const size_t page_size = database__page_size();
+  const size_t mapping_size =
+      (size + 1 + page_size - 1) / page_size * page_size;
+  char *data = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+  if (size > 0 &&
+      mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+           0) == MAP_FAILED) {
+    const int error = errno;
+    munmap(data, mapping_size);
+    errno = error;
+    return -1;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  *db = (struct database){data, size, mapping_size};
+  return 0;
+}
+
+// Reads the stream `fd` until its end, but at most `budget` bytes.
+// Returns 0 on success; -1 in case of a failure.
+static int database__read_stream(struct database *db, const int fd,
+                                 const size_t budget) {
+  size_t mapping_size = DATABASE_STREAM_CHUNK_SIZE;
+  char *data = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+
+  size_t size = 0;
+  for (ssize_t n;
+       (n = read(fd, data + size, mapping_size - size - 1)) != 0;) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const int error = errno;
+      munmap(data, mapping_size);
+      errno = error;
+      return -1;
+    }
+    size += (size_t)n;
+
+    if (size > budget) {
+      munmap(data, mapping_size);
+      errno = EFBIG;
+      return -1;
+    }
+    if (size + 1 == mapping_size) {
+      char *grown =
+          mremap(data, mapping_size, 2 * mapping_size, MREMAP_MAYMOVE);
+      if (grown == MAP_FAILED) {
+        const int error = errno;
+        munmap(data, mapping_size);
+        errno = error;
+        return -1;
+      }
+      data = grown;
+      mapping_size *= 2;
+    }
+  }
+
+  *db = (struct database){data, size, mapping_size};
+  return 0;
+}
+
+// Loads the database at `path`, or from the standard input if `path` is "-",
+// into `db`.  Fails with `EFBIG` if the database has more than `budget` bytes.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int database_load(struct database *db, const char *path,
+                         const size_t budget) {
+  const bool is_stdin = strcmp(path, "-") == 0;
+  const int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  int ret;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if ((uintmax_t)st.st_size > budget) {
+      errno = EFBIG;
+      ret = -1;
+    } else {
+      ret = database__map_file(db, fd, (size_t)st.st_size);
+    }
+  } else {
+    ret = database__read_stream(db, fd, budget);
+  }
+
+  if (!is_stdin) {
+    const int error = errno;
+    close(fd); // the mapping stays valid
+    errno = error;
+  }
+  return ret;
+}
+
+static void database_free(struct database *db) {
+  if (db->data != nullptr) {
+    munmap(db->data, db->mapping_size);
+  }
+  *db = (struct database){nullptr, 0, 0};
+}
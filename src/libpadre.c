@@ -0,0 +1,383 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// libpadre, see libpadre.h.  It is built from padre.c like `padre` itself, so
+// that both derive the same passwords; only the functions of libpadre.h are
+// exported.  A derivation runs on the calling thread, with the salt on the
+// stack and the scratch memory and tables given by the caller.  A batch is
+// derived on a pool of threads that is started for it, which pick up one
+// account after the other.
+
+#include "padre.h"
+#include "libpadre.h"
+#include "padre.c"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert((int)PADRE_KDF_SCRYPT == KDF_SCRYPT &&
+                   (int)PADRE_KDF_ARGON2ID == KDF_ARGON2ID,
+               "the KDFs of libpadre.h are those of padre.h");
+_Static_assert((int)PADRE_SCHEME_V1 == SCHEME_V1 &&
+                   (int)PADRE_SCHEME_V2 == SCHEME_V2,
+               "the schemes of libpadre.h are those of padre.h");
+
+// The longest salt, which is taken on the stack: the domain, the username and
+// the iteration of an account together take a little less.
+#define LIBPADRE_MAX_SALT_SIZE 1024
+
+struct padre_session {
+  struct session session;
+};
+
+struct padre_charset {
+  const struct charset *set;
+};
+
+struct padre_ctx {
+  struct scrypt_ctx scratch;
+};
+
+static const char *const libpadre__errors[PADRE_NUM_ERRORS] = {
+    [PADRE_OK] = "success",
+    [PADRE_ERR_INVALID] = "invalid argument",
+    [PADRE_ERR_COST] = "invalid KDF or cost parameters",
+    [PADRE_ERR_CHARSET] = "invalid characters",
+    [PADRE_ERR_CONTEXT] = "context too small for the cost parameters",
+    [PADRE_ERR_RANGE] = "password or salt too long",
+    [PADRE_ERR_NOMEM] = "out of memory",
+    [PADRE_ERR_BATCH] = "some passwords could not be derived",
+    [PADRE_ERR_CANCELED] = "canceled",
+};
+
+PADRE_API const char *padre_strerror(const int error) {
+  return error >= 0 && error < PADRE_NUM_ERRORS ? libpadre__errors[error]
+                                                : "unknown error";
+}
+
+PADRE_API int padre_session_new(struct padre_session **session,
+                                const char *master_password, const size_t len) {
+  if (session == nullptr || master_password == nullptr) {
+    return PADRE_ERR_INVALID;
+  }
+  *session = malloc(sizeof **session);
+  if (*session == nullptr) {
+    return PADRE_ERR_NOMEM;
+  }
+  session_init(&(*session)->session, len, master_password);
+  return PADRE_OK;
+}
+
+PADRE_API void padre_session_free(struct padre_session *session) {
+  if (session != nullptr) {
+    session_clear(&session->session);
+    free(session);
+  }
+}
+
+PADRE_API int padre_charset_new(struct padre_charset **charset,
+                                const char *spec,
+                                const enum padre_scheme scheme) {
+  if (charset == nullptr || spec == nullptr ||
+      (scheme != PADRE_SCHEME_V1 && scheme != PADRE_SCHEME_V2)) {
+    return PADRE_ERR_INVALID;
+  }
+  *charset = malloc(sizeof **charset);
+  if (*charset == nullptr) {
+    return PADRE_ERR_NOMEM;
+  }
+  errno = 0;
+  (*charset)->set = charset_compile(spec, (enum scheme)scheme);
+  if ((*charset)->set == nullptr) {
+    const int error = errno == ENOMEM ? PADRE_ERR_NOMEM : PADRE_ERR_CHARSET;
+    free(*charset);
+    *charset = nullptr;
+    return error;
+  }
+  return PADRE_OK;
+}
+
+PADRE_API void padre_charset_free(struct padre_charset *charset) {
+  if (charset != nullptr) {
+    free((struct charset *)charset->set);
+    free(charset);
+  }
+}
+
+// Converts `cost` into that of padre.
+// Returns `PADRE_OK` on success; `PADRE_ERR_COST` if it is invalid.
+static int libpadre__cost(const struct padre_cost *cost,
+                          struct kdf_cost *kdf_cost) {
+  if (cost->kdf != PADRE_KDF_SCRYPT && cost->kdf != PADRE_KDF_ARGON2ID) {
+    return PADRE_ERR_COST;
+  }
+  *kdf_cost = (struct kdf_cost){(enum kdf)cost->kdf, cost->N, cost->r, cost->p};
+  return kdf_backends[kdf_cost->kdf].valid_cost(kdf_cost) ? PADRE_OK
+                                                          : PADRE_ERR_COST;
+}
+
+PADRE_API int padre_cost_memory(const struct padre_cost *cost, size_t *size) {
+  if (cost == nullptr || size == nullptr) {
+    return PADRE_ERR_INVALID;
+  }
+  struct kdf_cost kdf_cost;
+  const int error = libpadre__cost(cost, &kdf_cost);
+  if (error == PADRE_OK) {
+    *size = kdf_backends[kdf_cost.kdf].memory_size(&kdf_cost, 1);
+  }
+  return error;
+}
+
+PADRE_API int padre_ctx_new(struct padre_ctx **ctx, const size_t size) {
+  if (ctx == nullptr || size == 0) {
+    return PADRE_ERR_INVALID;
+  }
+  *ctx = malloc(sizeof **ctx);
+  if (*ctx == nullptr) {
+    return PADRE_ERR_NOMEM;
+  }
+  if (scrypt_ctx_init_size(&(*ctx)->scratch, size) != 0) {
+    free(*ctx);
+    *ctx = nullptr;
+    return PADRE_ERR_NOMEM;
+  }
+  return PADRE_OK;
+}
+
+PADRE_API void padre_ctx_free(struct padre_ctx *ctx) {
+  if (ctx != nullptr) {
+    scrypt_ctx_free(&ctx->scratch);
+    free(ctx);
+  }
+}
+
+PADRE_API size_t padre_password_size(const struct padre_account *account) {
+  if (account == nullptr || account->charset == nullptr) {
+    return 0;
+  }
+  return account->length * (account->charset->set->scheme == SCHEME_V2
+                                ? CHARSET_MAX_CHAR_SIZE
+                                : 1) +
+         1;
+}
+
+PADRE_API int padre_derive(struct padre_ctx *ctx,
+                           const struct padre_session *session,
+                           const struct padre_account *account, char *password,
+                           const size_t size) {
+  if (ctx == nullptr || session == nullptr || account == nullptr ||
+      account->domain == nullptr || account->username == nullptr ||
+      account->iteration == nullptr || account->charset == nullptr ||
+      account->length == 0 || password == nullptr) {
+    return PADRE_ERR_INVALID;
+  }
+  if (account->length > SIZE_MAX / CHARSET_MAX_CHAR_SIZE - 1 ||
+      size < padre_password_size(account)) {
+    return PADRE_ERR_RANGE;
+  }
+  struct kdf_cost cost;
+  int error = libpadre__cost(&account->cost, &cost);
+  if (error != PADRE_OK) {
+    return error;
+  }
+  const struct kdf_backend *kdf = &kdf_backends[cost.kdf];
+  if (kdf->memory_size(&cost, 1) > ctx->scratch.size) {
+    return PADRE_ERR_CONTEXT;
+  }
+
+  const struct charset *set = account->charset->set;
+  uint8_t salt[LIBPADRE_MAX_SALT_SIZE];
+  const size_t salt_len = write_salt(
+      salt, sizeof salt, account->domain, account->domain_len,
+      account->username, account->username_len, account->iteration,
+      account->iteration_len, set->scheme, cost.kdf);
+  if (salt_len > sizeof salt) {
+    return PADRE_ERR_RANGE;
+  }
+
+  // in scheme 1, the KDF derives a byte per character right into `password`
+  uint8_t key[SCHEME_V2_KEY_SIZE];
+  uint8_t *raw = set->scheme == SCHEME_V2 ? key : (uint8_t *)password;
+  const size_t raw_len =
+      set->scheme == SCHEME_V2 ? SCHEME_V2_KEY_SIZE : account->length;
+  if (kdf->derive(&ctx->scratch, &session->session, salt, salt_len, &cost, raw,
+                  raw_len, 1) == 0) {
+    map_chars(set, raw, password, account->length);
+  } else {
+    error = errno == ENOMEM ? PADRE_ERR_NOMEM : PADRE_ERR_INVALID;
+  }
+  explicit_bzero(key, sizeof key);
+  explicit_bzero(salt, salt_len);
+
+  return error;
+}
+
+// A batch of `padre_derive_batch()`, which the threads of its pool share.
+struct libpadre__batch {
+  const struct padre_session *session;
+  size_t num_items;
+  struct padre_batch_item *items;
+  const struct padre_batch_options *options;
+  atomic_size_t next; // index of the next item to be picked up
+  atomic_bool canceled;
+  pthread_mutex_t progress_lock; // held while the callback is called
+  size_t done;                   // number of items done, under the lock
+};
+
+// A thread of the pool of a batch, with its own context.
+struct libpadre__worker {
+  struct libpadre__batch *batch;
+  struct padre_ctx ctx;
+  pthread_t id;
+  bool started;
+};
+
+static void *libpadre__work(void *arg) {
+  struct libpadre__worker *worker = arg;
+  struct libpadre__batch *batch = worker->batch;
+  for (size_t i = atomic_fetch_add(&batch->next, 1);
+       i < batch->num_items && !atomic_load(&batch->canceled);
+       i = atomic_fetch_add(&batch->next, 1)) {
+    struct padre_batch_item *item = &batch->items[i];
+    // the items that are invalid from the start have their error already
+    if (item->error == PADRE_ERR_CANCELED) {
+      item->error = padre_derive(&worker->ctx, batch->session, &item->account,
+                                 item->password, item->size);
+    }
+
+    if (batch->options->progress != nullptr) {
+      pthread_mutex_lock(&batch->progress_lock);
+      const size_t done = ++batch->done;
+      if (!atomic_load(&batch->canceled) &&
+          batch->options->progress(batch->options->progress_arg, done,
+                                   batch->num_items) != 0) {
+        atomic_store(&batch->canceled, true);
+      }
+      pthread_mutex_unlock(&batch->progress_lock);
+    }
+  }
+  return nullptr;
+}
+
+// Stores `error` in all `num_items` items.
+// Returns `error`.
+static int libpadre__fail(const size_t num_items,
+                          struct padre_batch_item items[num_items],
+                          const int error) {
+  for (size_t i = 0; i < num_items; ++i) {
+    items[i].error = error;
+  }
+  return error;
+}
+
+PADRE_API int padre_derive_batch(const struct padre_session *session,
+                                 const size_t num_items,
+                                 struct padre_batch_item items[],
+                                 const struct padre_batch_options *options) {
+  static const struct padre_batch_options defaults = {0, 0, nullptr, nullptr};
+  if (session == nullptr || (items == nullptr && num_items > 0)) {
+    return PADRE_ERR_INVALID;
+  }
+  if (options == nullptr) {
+    options = &defaults;
+  }
+
+  // every context takes as much memory as the costliest account, and until
+  // an item is done, its error is that of a canceled batch
+  size_t size = 0;
+  for (size_t i = 0; i < num_items; ++i) {
+    size_t item_size;
+    items[i].error = padre_cost_memory(&items[i].account.cost, &item_size);
+    if (items[i].error == PADRE_OK) {
+      items[i].error = PADRE_ERR_CANCELED;
+      size = item_size > size ? item_size : size;
+    }
+  }
+  if (size == 0) {
+    return num_items == 0 ? PADRE_OK : PADRE_ERR_BATCH;
+  }
+
+  size_t num_threads = options->threads;
+  if (num_threads == 0) {
+    const long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = nprocs > 0 ? (size_t)nprocs : 1;
+  }
+  if (num_threads > num_items) {
+    num_threads = num_items;
+  }
+  if (options->memory != 0 && options->memory / size < num_threads) {
+    num_threads = options->memory / size;
+  }
+  if (num_threads == 0) {
+    return libpadre__fail(num_items, items, PADRE_ERR_CONTEXT);
+  }
+
+  struct libpadre__worker *workers = calloc(num_threads, sizeof *workers);
+  if (workers == nullptr) {
+    return libpadre__fail(num_items, items, PADRE_ERR_NOMEM);
+  }
+  // as many threads as there is scratch memory for
+  size_t num_workers = 0;
+  while (num_workers < num_threads &&
+         scrypt_ctx_init_size(&workers[num_workers].ctx.scratch, size) == 0) {
+    ++num_workers;
+  }
+  if (num_workers == 0) {
+    free(workers);
+    return libpadre__fail(num_items, items, PADRE_ERR_NOMEM);
+  }
+
+  struct libpadre__batch batch = {
+      .session = session,
+      .num_items = num_items,
+      .items = items,
+      .options = options,
+  };
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.canceled, false);
+  pthread_mutex_init(&batch.progress_lock, nullptr);
+  for (size_t t = 0; t < num_workers; ++t) {
+    workers[t].batch = &batch;
+    workers[t].started =
+        t > 0 && pthread_create(&workers[t].id, nullptr, libpadre__work,
+                                &workers[t]) == 0;
+  }
+  libpadre__work(&workers[0]);
+  for (size_t t = 0; t < num_workers; ++t) {
+    if (workers[t].started) {
+      pthread_join(workers[t].id, nullptr);
+    }
+    scrypt_ctx_free(&workers[t].ctx.scratch);
+  }
+  pthread_mutex_destroy(&batch.progress_lock);
+  free(workers);
+
+  int ret = PADRE_OK;
+  for (size_t i = 0; i < num_items && ret != PADRE_ERR_CANCELED; ++i) {
+    if (items[i].error != PADRE_OK) {
+      ret = items[i].error == PADRE_ERR_CANCELED ? PADRE_ERR_CANCELED
+                                                 : PADRE_ERR_BATCH;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,177 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// libpadre derives the passwords of padre in other programs, e.g. in services
+// that run for a long time.  The passwords are the same as those of `padre`.
+//
+// The master password is kept in a session and the characters of a password
+// in a charset, both of which are created once and never change, so that any
+// number of threads may share them.  The scratch memory of the KDF is kept in
+// a context, which the caller creates large enough for the costliest account
+// and uses from one thread at a time.  Deriving a password then allocates no
+// memory and starts no threads; threads that derive at the same time take a
+// context each.  Batches of accounts are derived on a pool of threads with a
+// context each.
+//
+// All functions return 0 or a positive `enum padre_error` and print nothing.
+
+#ifndef LIBPADRE_H_INCLUDED
+#define LIBPADRE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PADRE_API __attribute__((visibility("default")))
+
+enum padre_error {
+  PADRE_OK,
+  PADRE_ERR_INVALID,  // an argument is missing or invalid
+  PADRE_ERR_COST,     // the KDF or its cost parameters are invalid
+  PADRE_ERR_CHARSET,  // the spec of the characters is invalid
+  PADRE_ERR_CONTEXT,  // the context is too small for the cost parameters
+  PADRE_ERR_RANGE,    // the password or the salt does not fit
+  PADRE_ERR_NOMEM,    // memory could not be allocated
+  PADRE_ERR_BATCH,    // some passwords of a batch could not be derived
+  PADRE_ERR_CANCELED, // the batch was canceled before the password was derived
+  PADRE_NUM_ERRORS
+};
+
+// The key derivation functions, as `enum kdf` of padre.
+enum padre_kdf {
+  PADRE_KDF_SCRYPT,
+  PADRE_KDF_ARGON2ID,
+};
+
+// The schemes by which passwords are derived, as `enum scheme` of padre.
+enum padre_scheme {
+  PADRE_SCHEME_V1,
+  PADRE_SCHEME_V2,
+};
+
+// The KDF of an account and its cost parameters: N, r and p for scrypt; the
+// memory in KiB, the number of passes and of lanes for Argon2id.
+struct padre_cost {
+  enum padre_kdf kdf;
+  uint64_t N;
+  uint32_t r;
+  uint32_t p;
+};
+
+#define PADRE_DEFAULT_COST {PADRE_KDF_SCRYPT, 16384, 8, 1}
+
+struct padre_session;
+struct padre_charset;
+struct padre_ctx;
+
+// An account.  The fields are given with their lengths and need not be
+// null-terminated.  Its scheme is the one `charset` was created for.
+struct padre_account {
+  const char *domain;
+  size_t domain_len;
+  const char *username;
+  size_t username_len;
+  const char *iteration;
+  size_t iteration_len;
+  const struct padre_charset *charset;
+  size_t length; // the number of characters of the password
+  struct padre_cost cost;
+};
+
+// Returns a description of `error`.
+PADRE_API const char *padre_strerror(int error);
+
+// Opens a session with the master password, which is not kept.
+PADRE_API int padre_session_new(struct padre_session **session,
+                                const char *master_password, size_t len);
+
+// Wipes and frees `session`, which may be null.
+PADRE_API void padre_session_free(struct padre_session *session);
+
+// Compiles the spec of the characters of passwords of `scheme`, e.g.
+// `a-zA-Z0-9_` or `:alnum:`, as in the database of padre.
+PADRE_API int padre_charset_new(struct padre_charset **charset,
+                                const char *spec, enum padre_scheme scheme);
+
+// Frees `charset`, which may be null.
+PADRE_API void padre_charset_free(struct padre_charset *charset);
+
+// Stores the number of bytes of scratch memory a derivation at `cost` takes in
+// `size`.
+PADRE_API int padre_cost_memory(const struct padre_cost *cost, size_t *size);
+
+// Creates a context with `size` bytes of scratch memory, which is locked into
+// RAM where possible and wiped after each derivation.
+PADRE_API int padre_ctx_new(struct padre_ctx **ctx, size_t size);
+
+// Frees `ctx`, which may be null.
+PADRE_API void padre_ctx_free(struct padre_ctx *ctx);
+
+// Returns the number of bytes the password of `account` takes at most,
+// including the terminating null byte.
+PADRE_API size_t padre_password_size(const struct padre_account *account);
+
+// Derives the password of `account` into `password`, which holds `size`
+// bytes, as a null-terminated string.  Nothing is written to `password` unless
+// it takes at least `padre_password_size(account)` bytes.
+PADRE_API int padre_derive(struct padre_ctx *ctx,
+                           const struct padre_session *session,
+                           const struct padre_account *account, char *password,
+                           size_t size);
+
+// An account of a batch and the buffer its password is derived into.
+struct padre_batch_item {
+  struct padre_account account;
+  char *password; // holds `size` bytes
+  size_t size;
+  int error; // set by `padre_derive_batch()`
+};
+
+// Called after each password of a batch, with the number of passwords done
+// and in the batch.  It is called from the threads of the batch, but never
+// twice at the same time.  The batch is canceled if it returns nonzero.
+typedef int padre_progress_fn(void *arg, size_t done, size_t total);
+
+// How a batch is derived.
+struct padre_batch_options {
+  // the most threads to derive on; 0 for one per processor
+  size_t threads;
+  // the most scratch memory of all threads together, in bytes; 0 for no limit
+  size_t memory;
+  padre_progress_fn *progress; // may be null
+  void *progress_arg;
+};
+
+// Derives the passwords of `num_items` accounts on a pool of threads, each
+// with a context large enough for the costliest account, as many as
+// `options` allows; the calling thread is one of them.  The error of each
+// account is stored in its item.  `options` may be null for the defaults.
+// Returns `PADRE_OK` if all passwords were derived; `PADRE_ERR_BATCH` if some
+// were not; `PADRE_ERR_CANCELED` if the batch was canceled, or another error
+// if it could not be started, which all items share then.
+PADRE_API int padre_derive_batch(const struct padre_session *session,
+                                 size_t num_items,
+                                 struct padre_batch_item items[],
+                                 const struct padre_batch_options *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBPADRE_H_INCLUDED
@@ -14,99 +14,218 @@
 //   limitations under the License.
 //
 
-#include "cli.c"
 #include "padre.c"
-#include "tui.c"
+#include "cli.c" // depends on padre.c
+#include "agent.c" // depends on padre.c
+#include "database.c"
+#include "padb.c" // depends on padre.c
+#include "calibrate.c" // depends on padre.c
+#include "tui.c" // depends on padre.c
 
 #include <locale.h>
 
-struct buffer {
-  char *data;
-  size_t size;
-  size_t capacity;
-};
+// Loads the database at `path`, which may not be larger than `budget` bytes.
+// Returns 0 on success; -1 in case of a failure, which has been reported.
+// The database is never unloaded, as the accounts point into it.  Resources
+// are going to be released eventually when the program exits.
+static int load_database(struct database *db, const char *path,
+                         const size_t budget) {
+  const uint64_t start = timing_start();
+  const int ret = database_load(db, path, budget);
+  timing_stop(TIMING_READ, start);
+  if (ret != 0) {
+    if (errno == EFBIG) {
+      fprintf(stderr,
+              "Error: %s exceeds the memory budget of %zu bytes, see "
+              "--budget\n",
+              path, budget);
+    } else {
+      perror(path);
+    }
+    return -1;
+  }
+  return 0;
+}
 
-void free_buffer(struct buffer *buffer) {
-  free(buffer->data);
-  *buffer = (struct buffer){nullptr, 0, 0};
+// Opens the compiled database `db` from `path` as `padb`.
+// Returns 0 on success; -1 in case of a failure, which has been reported.
+static int open_compiled_database(struct padb *padb, const struct database *db,
+                                  const char *path) {
+  if (padb_open(padb, db->data, db->size) != 0) {
+    if (errno == ENOTSUP) {
+      fprintf(stderr,
+              "Error: %s was compiled by another version of padre, compile it"
+              " again\n",
+              path);
+    } else {
+      perror(path);
+    }
+    return -1;
+  }
+  return 0;
 }
 
-#define CHUNK_SIZE 1024
+// Reads and parses the database at `path`, which may not be larger than
+// `budget` bytes.  A compiled database is used as it is, without parsing it.
+// Returns an empty list in case of a failure.
+static struct account_list load_accounts(const char *path,
+                                         const size_t budget) {
+  struct database db;
+  if (load_database(&db, path, budget) != 0) {
+    return (struct account_list){nullptr, 0, 0};
+  }
+
+  const uint64_t start = timing_start();
+  struct account_list accounts;
+  if (padb_is_compiled(db.data, db.size)) {
+    struct padb padb;
+    if (open_compiled_database(&padb, &db, path) != 0) {
+      return (struct account_list){nullptr, 0, 0};
+    }
+    accounts = padb_accounts(&padb);
+  } else {
+    accounts = parse_accounts(db.data, db.data + db.size);
+  }
+  timing_stop(TIMING_PARSE, start);
 
-// The buffer allocating in this function is never freed. This is on purpose.
-// The file opened in this function is never closed. This is also on purpose.
-// Resources are going to be released eventually when the program exits.
-static struct buffer read_entire_file(const char *path) {
-  struct buffer buf = {.data = nullptr, .capacity = 0};
+  if (accounts.size == 0) {
+    fputs("Error: could not read any accounts from given file\n", stderr);
+  }
 
-  FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
-  if (!f) {
-    perror(path);
-    return buf;
+  return accounts;
+}
+
+static void account_fields(void *arg, const size_t index,
+                           const char *fields[static SEARCH_FIELDS]) {
+  const struct account_list *accounts = arg;
+  fields[0] = accounts->accounts[index].domain;
+  fields[1] = accounts->accounts[index].username;
+}
+
+static void describe_account(void *arg, const size_t index, char *description,
+                             const size_t size) {
+  const struct account_list *accounts = arg;
+  snprintf(description, size, "iteration %s",
+           accounts->accounts[index].iteration);
+}
+
+// Lets the user select one of `accounts` and returns its index; -1 if the
+// user selected none.  `on_highlight` is passed on to `tui_show_menu()`.
+static int select_account(const struct account_list *accounts,
+                          tui_highlight_fn *on_highlight, void *arg) {
+  if (accounts->size == 1) {
+    fputs("Warning: automatically selected the only available account\n",
+          stderr);
+    return 0;
+  }
+
+  return tui_show_menu(accounts->size, account_fields, describe_account,
+                       (void *)accounts, on_highlight, arg);
+}
+
+// Adds the accounts of the database `db` from `path` that match `key` to
+// `matches`, exactly or, if none does, by prefix.  A compiled database is
+// searched without reading all of it, any other is parsed in full.
+// Returns 0 on success; -1 in case of a failure, which has been reported.
+static int find_accounts_in(struct database *db, const char *path,
+                            const struct account_key *key,
+                            struct account_matches *matches) {
+  if (padb_is_compiled(db->data, db->size)) {
+    struct padb padb;
+    if (open_compiled_database(&padb, db, path) != 0) {
+      return -1;
+    }
+    madvise(db->data, db->size, MADV_RANDOM);
+    padb_find_accounts(&padb, key, false, matches);
+    if (matches->size == 0) {
+      padb_find_accounts(&padb, key, true, matches);
+    }
+    return 0;
   }
 
-  buf.data = malloc(CHUNK_SIZE);
-  buf.capacity = CHUNK_SIZE;
+  struct account_list accounts = parse_accounts(db->data, db->data + db->size);
+  find_accounts(&accounts, key, matches);
+  free_account_list(&accounts);
+  return 0;
+}
+
+// Like `find_accounts_in()`, but measures the time it takes.
+static int find_accounts_timed(struct database *db, const char *path,
+                               const struct account_key *key,
+                               struct account_matches *matches) {
+  const uint64_t start = timing_start();
+  const int ret = find_accounts_in(db, path, key, matches);
+  timing_stop(TIMING_PARSE, start);
+  return ret;
+}
 
-  for (size_t bytes_read;
-       (bytes_read = fread(buf.data + buf.size, 1, CHUNK_SIZE, f)) > 0;) {
-    buf.size += bytes_read;
-    if (buf.size + CHUNK_SIZE > buf.capacity) {
-      buf.capacity *= 2;
-      if (buf.capacity > MAX_DATABASE_FILE_SIZE) {
-        fputs("Error: database file exceeds size limit\n", stderr);
-        free(buf.data);
-        buf.data = nullptr;
-        return buf;
+// Selects the account given by `select`, i.e.
+// `<domain>[:<username>[:<iteration>]]`, from the database at `path`.
+// Returns the account; one without a domain if not exactly one account
+// matches, which has been reported.
+static struct account find_account(const char *path, const size_t budget,
+                                   const char *select) {
+  struct account account = {nullptr, nullptr, nullptr, nullptr,
+                            0,       nullptr, SCHEME_V1,
+                            DEFAULT_KDF_COST};
+
+  char *str = strdup(select);
+  if (str == nullptr) {
+    perror("Error allocating memory for the key");
+    return account;
+  }
+  const struct account_key key = parse_account_key(str);
+
+  struct database db;
+  struct account_matches matches = {0};
+  if (key.domain == nullptr) {
+    fputs("Error: the key to select an account by has no domain\n", stderr);
+  } else if (load_database(&db, path, budget) == 0 &&
+             find_accounts_timed(&db, path, &key, &matches) == 0) {
+    if (matches.size == 0) {
+      fprintf(stderr, "Error: no account matches `%s`\n", select);
+    } else if (matches.size > 1) {
+      fprintf(stderr, "Error: `%s` is ambiguous, it matches\n", select);
+      for (size_t i = 0; i < matches.size && i < MAX_MATCHES; ++i) {
+        fprintf(stderr, "    %s:%s:%s\n", matches.accounts[i].domain,
+                matches.accounts[i].username, matches.accounts[i].iteration);
+      }
+      if (matches.size > MAX_MATCHES) {
+        fputs("    ...\n", stderr);
       }
-      buf.data = realloc(buf.data, buf.capacity);
+    } else {
+      account = matches.accounts[0];
     }
   }
 
-  return buf;
+  free(str);
+  return account;
 }
 
 static struct account determine_account(const struct cli_opts options) {
-  struct account account = {nullptr, nullptr, nullptr, nullptr, 0};
-
-  if (options.username == nullptr) {
-    // a database is specified on the command-line
+  struct account account = {nullptr, nullptr, nullptr, nullptr,
+                            0,       nullptr, SCHEME_V1,
+                            DEFAULT_KDF_COST};
 
-    const struct buffer buf = read_entire_file(options.domain_or_database);
-    if (buf.data == nullptr) {
-      return account;
-    }
+  if (options.select != nullptr) {
+    account = find_account(options.domain_or_database, options.budget,
+                           options.select);
 
-    const struct account_list accounts =
-        parse_accounts(buf.data, buf.data + buf.size);
+  } else if (options.username == nullptr) {
+    // a database is specified on the command-line
 
+    struct account_list accounts =
+        load_accounts(options.domain_or_database, options.budget);
     if (accounts.size == 0) {
-      fputs("Error: could not read any accounts from given file\n", stderr);
       return account;
     }
 
-    if (accounts.size == 1) {
-      account = accounts.accounts[0];
-      fputs("Warning: automatically selected the only available account\n",
-            stderr);
-      return account;
-    }
-
-    struct tui_item *items = malloc(accounts.size * sizeof(struct tui_item));
-    for (size_t i = 0; i < accounts.size; ++i) {
-      items[i].name = accounts.accounts[i].domain;
-      snprintf(items[i].description, sizeof items[i].description,
-               "%s, iteration %s", accounts.accounts[i].username,
-               accounts.accounts[i].iteration);
-    }
-
-    const int selected_account = tui_show_menu(accounts.size, items);
+    const int selected_account = select_account(&accounts, nullptr, nullptr);
     if (selected_account >= 0) {
       account = accounts.accounts[selected_account];
     }
 
-    free(accounts.accounts);
-    free(items);
+    free_account_list(&accounts);
 
   } else {
     // the account is specified on the command-line
@@ -116,58 +235,437 @@ static struct account determine_account(const struct cli_opts options) {
         .username = options.username,
         .iteration = options.iteration ? options.iteration : "0",
         .characters = options.characters ? options.characters : "",
-        .length = options.length ? options.length : 64};
+        .length = options.length ? options.length : 64,
+        .scheme = options.scheme,
+        .cost = options.cost};
   }
 
   return account;
 }
 
+// Asks the user for the master password and opens a session with it.  The
+// password itself is wiped right away.
+// Returns 0 on success; -1 in case of a failure.
+static int ask_session(struct session *session) {
+  char master_pwd[MAX_MASTER_PASSWORD_LENGTH + 1];
+  size_t master_pwd_len = MAX_MASTER_PASSWORD_LENGTH;
+  const int ret = tui_ask_password(master_pwd, &master_pwd_len);
+  if (ret == 0) {
+    session_init(session, master_pwd_len, master_pwd);
+  }
+  explicit_bzero(master_pwd, sizeof master_pwd);
+  return ret;
+}
+
+// Returns the memory the derivations of `--all` or `--password-first` may
+// take at once, unless configured
+// otherwise: a quarter of the physical memory; 0 if unknown.
+static size_t default_batch_memory(void) {
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long page_size = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page_size <= 0) {
+    return 0;
+  }
+  return (size_t)pages / 4 * (size_t)page_size;
+}
+
+static void focus_speculation(void *arg, const size_t index) {
+  speculation_focus(arg, index);
+}
+
+// Like selecting an account from the database at `path` and deriving its
+// password, but asks for the master password first.  While the user browses
+// the menu, the passwords of the accounts around the highlighted one are
+// derived in the background, so that the selected one is ready right away.
+// These derivations take at most `memory` bytes at once; 0 for no limit.
+static int derive_selected_account(const char *path, const size_t budget,
+                                   const size_t memory) {
+  struct account_list accounts = load_accounts(path, budget);
+  if (accounts.size == 0) {
+    return EXIT_FAILURE;
+  }
+
+  // ask the user for his master password    | no program exit between here ...
+  struct session session;
+  if (ask_session(&session) != 0) {
+    perror("Error reading the master password from the standard input");
+    return EXIT_FAILURE;
+  }
+
+  struct speculation spec;
+  const bool speculating =
+      speculation_start(&spec, &session, accounts.size, accounts.accounts,
+                        memory) == 0;
+
+  int ret = -1;
+  char *password = nullptr;
+  const int selected = select_account(
+      &accounts, speculating ? focus_speculation : nullptr, &spec);
+  if (selected >= 0) {
+    const struct account *account = &accounts.accounts[selected];
+    password = malloc(password_size(account));
+    if (password == nullptr) {
+      perror("Error allocating memory for the derived password");
+    } else if (speculating) {
+      ret = speculation_take(&spec, (size_t)selected, password);
+    } else {
+      ret = derive_account_password(nullptr, &session, account, password);
+    }
+  }
+
+  if (speculating) {
+    speculation_stop(&spec);
+  }
+
+  // clear the master password               | ... and here
+  session_clear(&session);
+
+  if (selected < 0 || password == nullptr) {
+    return EXIT_FAILURE;
+  }
+  if (ret != 0) {
+    perror("Error deriving the domain password");
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stdout, "%s\n", password);
+
+  return EXIT_SUCCESS;
+}
+
+// Connects to the agent, if one has been started.
+// Returns the socket; -1 if the master password has to be asked for instead.
+static int connect_agent(void) {
+  const int fd = agent_connect();
+  if (fd < 0 && errno != ENOENT) {
+    perror("Warning: could not reach the agent");
+  }
+  return fd;
+}
+
+// Writes `field` to `stream`, quoting it if it contains special characters.
+static void print_csv_field(FILE *stream, const char *field) {
+  if (strpbrk(field, ",\"\r\n") == nullptr) {
+    fputs(field, stream);
+    return;
+  }
+  fputc('"', stream);
+  for (; *field != '\0'; ++field) {
+    if (*field == '"') {
+      fputc('"', stream);
+    }
+    fputc(*field, stream);
+  }
+  fputc('"', stream);
+}
+
+// Derives the passwords of all accounts in the database at `path` and prints
+// them as CSV records in the order of the database.  The derivations take at
+// most `memory` bytes at once, as far as they can; 0 for no limit.
+static int derive_all_accounts(const char *path, const size_t budget,
+                               const size_t memory) {
+  struct account_list accounts = load_accounts(path, budget);
+  if (accounts.size == 0) {
+    return EXIT_FAILURE;
+  }
+
+  char **passwords = calloc(accounts.size, sizeof(char *));
+  if (passwords == nullptr) {
+    perror("Error allocating memory for the derived passwords");
+    free_account_list(&accounts);
+    return EXIT_FAILURE;
+  }
+
+  size_t failures = 0;
+  const int agent = connect_agent();
+  if (agent >= 0) {
+    for (size_t i = 0; i < accounts.size; ++i) {
+      const struct account *account = &accounts.accounts[i];
+      passwords[i] = malloc(password_size(account));
+      if (passwords[i] == nullptr ||
+          agent_derive_account_password(agent, account, passwords[i]) != 0) {
+        fprintf(stderr, "Error: could not derive the password for %s, %s\n",
+                account->domain, account->username);
+        free(passwords[i]);
+        passwords[i] = nullptr;
+        ++failures;
+      }
+    }
+    close(agent);
+  } else {
+    // ask the user for his master password  | no program exit between here ...
+    struct session session;
+    if (ask_session(&session) != 0) {
+      perror("Error reading the master password from the standard input");
+      free(passwords);
+      free_account_list(&accounts);
+      return EXIT_FAILURE;
+    }
+
+    failures = derive_accounts(&session, accounts.size, accounts.accounts,
+                               passwords, memory);
+
+    // clear the master password             | ... and here
+    session_clear(&session);
+  }
+
+  for (size_t i = 0; i < accounts.size; ++i) {
+    if (passwords[i] == nullptr) {
+      continue;
+    }
+    const struct account *account = &accounts.accounts[i];
+    print_csv_field(stdout, account->domain);
+    fputc(',', stdout);
+    print_csv_field(stdout, account->username);
+    fputc(',', stdout);
+    print_csv_field(stdout, account->iteration);
+    fputc(',', stdout);
+    print_csv_field(stdout, passwords[i]);
+    fputc('\n', stdout);
+  }
+
+  // wipe the passwords, so that none lingers in freed memory
+  for (size_t i = 0; i < accounts.size; ++i) {
+    if (passwords[i] != nullptr) {
+      explicit_bzero(passwords[i], password_size(&accounts.accounts[i]));
+      free(passwords[i]);
+    }
+  }
+  free(passwords);
+  free_account_list(&accounts);
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Reads the master password for `--serve-stdio` and opens a session with it:
+// from the terminal if the standard input is one, else from its first line,
+// which the requests follow.  The line is read byte by byte, past the buffer
+// of `stdin`, so that it is only kept in `line`, which is wiped right away.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int read_session(struct session *session) {
+  if (isatty(STDIN_FILENO)) {
+    return ask_session(session);
+  }
+
+  char line[MAX_MASTER_PASSWORD_LENGTH + 2]; // and a carriage return
+  size_t len = 0;
+  ssize_t n;
+  char c;
+  while ((n = read(STDIN_FILENO, &c, 1)) > 0 && c != '\n' &&
+         len < sizeof line) {
+    line[len++] = c;
+  }
+  if (len > 0 && line[len - 1] == '\r') {
+    --len;
+  }
+  int ret = -1;
+  if (n < 0) {
+    // `errno` is set by `read()`
+  } else if (n == 0 && len == 0) {
+    errno = ENODATA;
+  } else if (len > MAX_MASTER_PASSWORD_LENGTH) {
+    errno = EMSGSIZE;
+  } else {
+    session_init(session, len, line);
+    ret = 0;
+  }
+  explicit_bzero(line, sizeof line);
+  return ret;
+}
+
+// Derives the password of `account` for `--serve-stdio` with `session` and the
+// scratch memory of `ctx`, which grows to that of the costliest account so
+// far.
+// Returns `nullptr` on success; the message of the failure otherwise.
+static const char *serve_account(const struct session *session,
+                                 struct scrypt_ctx *ctx,
+                                 const struct account *account,
+                                 char *password) {
+  if (fit_ctx(ctx, account) != 0) {
+    return strerror(errno);
+  }
+  return derive_account_password(ctx, session, account, password) == 0
+             ? nullptr
+             : strerror(errno);
+}
+
+// Derives a password for each line of the standard input, which is an
+// account as in the database, and answers it by a line `OK <password>` or
+// `ERR <message>` on the standard output right away, as the agent does.  The
+// master password comes first, whether an agent is running or not, so that
+// the requests are framed the same in any environment.
+static int serve_stdio(void) {
+  // ask the user for his master password    | no program exit between here ...
+  struct session session;
+  if (read_session(&session) != 0) {
+    perror("Error reading the master password from the standard input");
+    return EXIT_FAILURE;
+  }
+
+  struct scrypt_ctx ctx = {.memory = nullptr, .mapping = nullptr};
+  char password[AGENT_MAX_LINE];
+  char *line = nullptr;
+  size_t capacity = 0;
+  for (ssize_t len; (len = getline(&line, &capacity, stdin)) > 0;) {
+    struct account_list list = parse_accounts(line, line + len);
+    const char *error = "invalid request";
+    if (list.size == 1 && password_size(&list.accounts[0]) <=
+                              AGENT_MAX_LINE - strlen("OK \n")) {
+      error = serve_account(&session, &ctx, &list.accounts[0], password);
+    }
+    if (error == nullptr) {
+      fprintf(stdout, "OK %s\n", password);
+    } else {
+      fprintf(stdout, "ERR %s\n", error);
+    }
+    fflush(stdout);
+    explicit_bzero(password, sizeof password);
+    free_account_list(&list);
+  }
+  const bool failed = ferror(stdin);
+  if (line != nullptr) {
+    explicit_bzero(line, capacity);
+  }
+  free(line);
+  scrypt_ctx_free(&ctx);
+
+  // clear the master password               | ... and here
+  session_clear(&session);
+
+  if (failed) {
+    perror("Error reading the requests from the standard input");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Compiles the database at `path` into the file at `output`.
+static int compile_database(const char *path, const char *output,
+                            const size_t budget) {
+  struct account_list accounts = load_accounts(path, budget);
+  if (accounts.size == 0) {
+    return EXIT_FAILURE;
+  }
+
+  FILE *out = fopen(output, "wb");
+  if (out == nullptr) {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+  const int ret = padb_compile(&accounts, out);
+  if (fclose(out) != 0 || ret != 0) {
+    perror(output);
+    remove(output);
+    return EXIT_FAILURE;
+  }
+
+  free_account_list(&accounts);
+  return EXIT_SUCCESS;
+}
+
+// Asks the user for the master password and starts an agent with it.
+static int start_agent(const unsigned timeout) {
+  struct session session;
+  if (ask_session(&session) != 0) {
+    perror("Error reading the master password from the standard input");
+    return EXIT_FAILURE;
+  }
+
+  if (agent_start(&session, timeout) != 0) {
+    perror("Error starting the agent");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
 int main(const int argc, char *argv[]) {
   setlocale(LC_ALL, "");
 
-  const struct account account = determine_account(cli_parse(argc, argv));
+  const struct cli_opts options = cli_parse(argc, argv);
+  if (options.timings && timings_enable() != 0) {
+    perror("Warning: cannot report the timings");
+  }
+
+  if (options.agent) {
+    return start_agent(options.timeout);
+  }
+
+  if (options.serve_stdio) {
+    return serve_stdio();
+  }
+
+  if (options.calibrate) {
+    if (calibrate(options.latency,
+                  options.memory != 0 ? options.memory
+                                      : DEFAULT_CALIBRATE_MEMORY,
+                  stdout) != 0) {
+      perror("Error calibrating the cost parameters");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (options.compile) {
+    return compile_database(options.domain_or_database, options.output,
+                            options.budget);
+  }
+
+  if (options.all) {
+    return derive_all_accounts(options.domain_or_database, options.budget,
+                               options.memory != 0 ? options.memory
+                                                   : default_batch_memory());
+  }
+
+  // With an agent, there is no master password to ask for first.
+  if (options.password_first && options.username == nullptr &&
+      options.select == nullptr && getenv(AGENT_SOCKET_ENV) == nullptr) {
+    return derive_selected_account(
+        options.domain_or_database, options.budget,
+        options.memory != 0 ? options.memory : default_batch_memory());
+  }
+
+  const struct account account = determine_account(options);
 
   if (!account.domain) {
     return EXIT_FAILURE;
   }
 
-  char *password = malloc(account.length + 1);
+  char *password = malloc(password_size(&account));
   if (password == NULL) {
     perror("Error allocating memory for the derived password");
     return EXIT_FAILURE;
   }
 
-  // ask the user for his master password    | no program exit between here ...
-  char master_pwd[MAX_MASTER_PASSWORD_LENGTH];
+  const int agent = connect_agent();
+  if (agent >= 0) {
+    const int ret = agent_derive_account_password(agent, &account, password);
+    close(agent);
+    if (ret != 0) {
+      return EXIT_FAILURE;
+    }
+    fprintf(stdout, "%s\n", password);
+    return EXIT_SUCCESS;
+  }
 
-  size_t master_pwd_len = MAX_MASTER_PASSWORD_LENGTH;
-  int ret = tui_ask_password(master_pwd, &master_pwd_len);
-  if (ret != 0) {
+  // ask the user for his master password    | no program exit between here ...
+  struct session session;
+  if (ask_session(&session) != 0) {
     perror("Error reading the master password from the standard input");
     return EXIT_FAILURE;
   }
 
-  ret = derive_password(master_pwd_len, master_pwd, account.domain,
-                        account.username, account.iteration, account.length,
-                        password);
+  const int ret =
+      derive_account_password(nullptr, &session, &account, password);
 
   // clear the master password               | ... and here
-  memset(master_pwd, 0, MAX_MASTER_PASSWORD_LENGTH); // TODO explicit
-  master_pwd_len = 0;
+  session_clear(&session);
 
   if (ret != 0) {
     perror("Error deriving the domain password");
     return EXIT_FAILURE;
   }
 
-  char *chars;
-  size_t len;
-  ret = enumerate_charset(account.characters, &chars, &len);
-  if (ret != 0) {
-    perror("Error enumerating the charset");
-    return EXIT_FAILURE;
-  }
-  to_chars((uint8_t *)password, account.length, chars, len);
   fprintf(stdout, "%s\n", password);
 
   return EXIT_SUCCESS;
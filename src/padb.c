@@ -0,0 +1,460 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// A compiled database (`.padb`), which `padre compile` produces from the CSV
+// database.  It is used as it is loaded into memory, without being parsed, so
+// that looking up an account only touches the pages on the way to it.
+//
+// The file is in the byte order of the machine that compiled it and consists
+// of
+//
+// - a header (`struct padb_header`),
+// - the accounts (`struct padb_account`), sorted by domain, username and
+//   iteration, and
+// - a pool of null-terminated strings, which the accounts refer to by their
+//   offset in the pool.  Every string is stored only once.
+//
+// Besides the fields of the CSV database, each account refers to its
+// character set as enumerated for scheme 1, so that it does not have to be
+// enumerated again.  The cost parameter N is stored as its logarithm.
+
+#include "padre.h"
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Unlike any CSV database, starts with a control character.
+#define PADB_MAGIC "\x7fPADB\r\n"
+#define PADB_VERSION 4
+
+// The charset of an account, whose characters could not be enumerated.
+#define PADB_NO_CHARSET UINT32_MAX
+
+struct padb_header {
+  char magic[8]; // `PADB_MAGIC`
+  uint64_t version;
+  uint64_t num_accounts;
+  uint64_t accounts;     // the offset of the accounts in the file
+  uint64_t strings;      // the offset of the string pool in the file
+  uint64_t strings_size; // the size of the string pool in bytes
+};
+
+// The fields are the offsets of the strings in the pool, but for the length,
+// the scheme, the KDF and its cost parameters.
+struct padb_account {
+  uint32_t domain;
+  uint32_t username;
+  uint32_t iteration;
+  uint32_t characters;
+  uint32_t charset; // `characters` enumerated for scheme 1, if possible;
+                    // or `PADB_NO_CHARSET`
+  uint32_t length;
+  uint32_t scheme; // `enum scheme`
+  uint32_t kdf;    // `enum kdf`
+  uint32_t N;      // log2(N) for scrypt; the memory in KiB for Argon2id
+  uint32_t r;
+  uint32_t p;
+};
+
+struct padb {
+  const struct padb_account *accounts;
+  size_t num_accounts;
+  const char *strings; // the last string is terminated by the last byte
+  size_t strings_size;
+};
+
+// Returns whether the `size` bytes at `data` are a compiled database.
+static bool padb_is_compiled(const char *data, const size_t size) {
+  return size >= sizeof(struct padb_header) &&
+         memcmp(data, PADB_MAGIC, sizeof PADB_MAGIC) == 0;
+}
+
+// Opens the compiled database of `size` bytes at `data`, which has to be
+// aligned for `struct padb_header`.  Only the header is checked, the accounts
+// are checked as they are accessed.
+// Returns 0 on success; -1 if the database is invalid, with `errno` set.
+static int padb_open(struct padb *db, const char *data, const size_t size) {
+  if (!padb_is_compiled(data, size)) {
+    errno = EINVAL;
+    return -1;
+  }
+  const struct padb_header *header = (const struct padb_header *)data;
+  if (header->version != PADB_VERSION) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  if (header->accounts % alignof(struct padb_account) != 0 ||
+      header->accounts > size ||
+      header->num_accounts >
+          (size - header->accounts) / sizeof(struct padb_account) ||
+      header->strings > size || header->strings_size == 0 ||
+      header->strings_size > size - header->strings ||
+      data[header->strings + header->strings_size - 1] != '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *db = (struct padb){
+      .accounts = (const struct padb_account *)(data + header->accounts),
+      .num_accounts = header->num_accounts,
+      .strings = data + header->strings,
+      .strings_size = header->strings_size,
+  };
+  return 0;
+}
+
+// Returns the string at `offset` in the pool; `nullptr` if there is none.
+static const char *padb__string(const struct padb *db, const uint32_t offset) {
+  return offset < db->strings_size ? db->strings + offset : nullptr;
+}
+
+// Stores the account at `index` in `account`, which points into `db`.
+// Returns 0 on success; -1 if the account is invalid.
+static int padb_account(const struct padb *db, const size_t index,
+                        struct account *account) {
+  const struct padb_account *a = &db->accounts[index];
+  *account = (struct account){
+      .domain = padb__string(db, a->domain),
+      .username = padb__string(db, a->username),
+      .iteration = padb__string(db, a->iteration),
+      .characters = padb__string(db, a->characters),
+      .length = a->length,
+      .charset = a->charset == PADB_NO_CHARSET
+                     ? nullptr
+                     : padb__string(db, a->charset),
+      .scheme = (enum scheme)a->scheme,
+      .cost = {(enum kdf)a->kdf,
+               a->kdf != KDF_SCRYPT ? a->N
+               : a->N < 64          ? (uint64_t)1 << a->N
+                                    : 0,
+               a->r, a->p},
+  };
+  if (account->domain == nullptr || account->username == nullptr ||
+      account->iteration == nullptr || account->characters == nullptr ||
+      account->length == 0 || a->scheme >= NUM_SCHEMES ||
+      a->kdf >= NUM_KDFS || !kdf_backends[a->kdf].valid_cost(&account->cost) ||
+      (account->charset == nullptr) != (a->charset == PADB_NO_CHARSET)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+// Compares the account at `index` with `domain` and, unless `nullptr`,
+// `username`, like `strcmp()`.
+static int padb__compare(const struct padb *db, const size_t index,
+                         const char *domain, const char *username) {
+  const char *other = padb__string(db, db->accounts[index].domain);
+  int cmp = strcmp(other != nullptr ? other : "", domain);
+  if (cmp != 0 || username == nullptr) {
+    return cmp;
+  }
+  other = padb__string(db, db->accounts[index].username);
+  return strcmp(other != nullptr ? other : "", username);
+}
+
+// Returns the index of the first account that is not ordered before `domain`
+// and, unless `nullptr`, `username`.
+static size_t padb_lower_bound(const struct padb *db, const char *domain,
+                               const char *username) {
+  size_t begin = 0;
+  size_t end = db->num_accounts;
+  while (begin < end) {
+    const size_t middle = begin + (end - begin) / 2;
+    if (padb__compare(db, middle, domain, username) < 0) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+// Returns the index of the first account with `domain` and, unless `nullptr`,
+// `username`; `db->num_accounts` if there is none.  The accounts that match
+// as well follow it.
+static size_t padb_find(const struct padb *db, const char *domain,
+                        const char *username) {
+  const size_t index = padb_lower_bound(db, domain, username);
+  if (index == db->num_accounts ||
+      padb__compare(db, index, domain, username) != 0) {
+    return db->num_accounts;
+  }
+  return index;
+}
+
+// Adds the accounts of `db` that match `key` to `matches`, exactly or, if
+// `prefix` is set, by prefix.  As the accounts are sorted, only the matching
+// ones are looked at, plus one.
+static void padb_find_accounts(const struct padb *db,
+                               const struct account_key *key, const bool prefix,
+                               struct account_matches *matches) {
+  const char *username = prefix ? nullptr : key->username;
+  for (size_t i = padb_lower_bound(db, key->domain, username);
+       i < db->num_accounts; ++i) {
+    struct account account;
+    if (padb_account(db, i, &account) != 0) {
+      continue;
+    }
+    const int cmp =
+        prefix ? strncmp(account.domain, key->domain, strlen(key->domain))
+               : padb__compare(db, i, key->domain, username);
+    if (cmp != 0) {
+      return; // past the matching accounts
+    }
+    if (account_matches(&account, key, prefix) &&
+        !add_match(matches, &account)) {
+      return;
+    }
+  }
+}
+
+// Returns all accounts of `db`, which point into it.  Invalid accounts are
+// reported and skipped.
+static struct account_list padb_accounts(const struct padb *db) {
+  struct account_list list =
+      new_account_list(db->num_accounts > 0 ? db->num_accounts : 1);
+  for (size_t i = 0; i < db->num_accounts; ++i) {
+    struct account account;
+    if (padb_account(db, i, &account) != 0) {
+      fprintf(stderr, "Error: account %zu is corrupt, skipping\n", i + 1);
+      continue;
+    }
+    push_account(&list, account);
+  }
+  return list;
+}
+
+// The strings of a database that is being compiled.  Equal strings are stored
+// once, which a hash table of their offsets keeps track of.
+struct padb__pool {
+  char *data;
+  size_t size;
+  size_t capacity;
+  struct padb__entry {
+    uint32_t offset; // `UINT32_MAX` if the slot is empty
+    uint32_t charset; // the enumerated string, if it has been asked for
+    bool has_charset;
+  } *table;          // never more than half full
+  size_t table_size; // a power of two
+  size_t num_entries;
+};
+
+static uint64_t padb__hash(const char *str) {
+  uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+  for (; *str != '\0'; ++str) {
+    hash = (hash ^ (uint8_t)*str) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// Returns the entry of `str` in `pool`, adding it if necessary; `nullptr` in
+// case of a failure.
+static struct padb__entry *padb__intern(struct padb__pool *pool,
+                                        const char *str) {
+  size_t slot = padb__hash(str) & (pool->table_size - 1);
+  for (; pool->table[slot].offset != UINT32_MAX;
+       slot = (slot + 1) & (pool->table_size - 1)) {
+    if (strcmp(pool->data + pool->table[slot].offset, str) == 0) {
+      return &pool->table[slot];
+    }
+  }
+
+  const size_t len = strlen(str) + 1;
+  if (2 * (pool->num_entries + 1) > pool->table_size) {
+    errno = EOVERFLOW; // the table is sized for fewer strings
+    return nullptr;
+  }
+  if (pool->size + len >= UINT32_MAX) {
+    errno = EFBIG;
+    return nullptr;
+  }
+  if (pool->size + len > pool->capacity) {
+    size_t capacity = 2 * pool->capacity;
+    while (capacity < pool->size + len) {
+      capacity *= 2;
+    }
+    char *data = realloc(pool->data, capacity);
+    if (data == nullptr) {
+      return nullptr;
+    }
+    pool->data = data;
+    pool->capacity = capacity;
+  }
+  memcpy(pool->data + pool->size, str, len);
+
+  pool->table[slot] = (struct padb__entry){(uint32_t)pool->size, 0, false};
+  pool->size += len;
+  ++pool->num_entries;
+  return &pool->table[slot];
+}
+
+// Stores the offset of the enumerated `characters` in `pool` in `charset`,
+// adding them if necessary; `PADB_NO_CHARSET` if they cannot be enumerated.
+// Returns 0 on success; -1 in case of a failure.
+static int padb__charset(struct padb__pool *pool, const char *characters,
+                         uint32_t *charset) {
+  struct padb__entry *entry = padb__intern(pool, characters);
+  if (entry == nullptr) {
+    return -1;
+  }
+  if (!entry->has_charset) {
+    char *chars;
+    size_t len;
+    entry->charset = PADB_NO_CHARSET;
+    if (enumerate_charset(characters, &chars, &len) == 0) {
+      const struct padb__entry *enumerated = padb__intern(pool, chars);
+      free(chars);
+      if (enumerated == nullptr) {
+        return -1;
+      }
+      entry->charset = enumerated->offset;
+    }
+    entry->has_charset = true;
+  }
+  *charset = entry->charset;
+  return 0;
+}
+
+static int padb__order(const void *a, const void *b, void *arg) {
+  const struct account *accounts = arg;
+  const size_t i = *(const size_t *)a;
+  const size_t j = *(const size_t *)b;
+  int cmp = strcmp(accounts[i].domain, accounts[j].domain);
+  if (cmp == 0) {
+    cmp = strcmp(accounts[i].username, accounts[j].username);
+  }
+  if (cmp == 0) {
+    cmp = strcmp(accounts[i].iteration, accounts[j].iteration);
+  }
+  return cmp != 0 ? cmp : (i > j) - (i < j);
+}
+
+// Fills `record` with the strings of `account`, which are added to `pool`.
+// Returns 0 on success; -1 in case of a failure.
+static int padb__record(struct padb__pool *pool, const struct account *account,
+                        struct padb_account *record) {
+  if (account->length > UINT32_MAX ||
+      !kdf_backends[account->cost.kdf].valid_cost(&account->cost)) {
+    errno = EINVAL;
+    return -1;
+  }
+  const struct padb__entry *domain = padb__intern(pool, account->domain);
+  const struct padb__entry *username =
+      domain != nullptr ? padb__intern(pool, account->username) : nullptr;
+  const struct padb__entry *iteration =
+      username != nullptr ? padb__intern(pool, account->iteration) : nullptr;
+  if (iteration == nullptr ||
+      padb__charset(pool, account->characters, &record->charset) != 0) {
+    return -1;
+  }
+  record->domain = domain->offset;
+  record->username = username->offset;
+  record->iteration = iteration->offset;
+  record->characters = padb__intern(pool, account->characters)->offset;
+  record->length = (uint32_t)account->length;
+  record->scheme = (uint32_t)account->scheme;
+  record->kdf = (uint32_t)account->cost.kdf;
+  record->N = account->cost.kdf == KDF_SCRYPT
+                  ? (uint32_t)__builtin_ctzll(account->cost.N)
+                  : (uint32_t)account->cost.N;
+  record->r = account->cost.r;
+  record->p = account->cost.p;
+  return 0;
+}
+
+// Writes the `n` sorted `records` and their `pool` to `out`.
+// Returns 0 on success; -1 in case of a failure.
+static int padb__write(const size_t n, const struct padb_account *records,
+                       const struct padb__pool *pool, FILE *out) {
+  struct padb_header header = {
+      .version = PADB_VERSION,
+      .num_accounts = n,
+      .accounts = sizeof header,
+      .strings = sizeof header + n * sizeof *records,
+      .strings_size = pool->size,
+  };
+  memcpy(header.magic, PADB_MAGIC, sizeof header.magic);
+  if (fwrite(&header, sizeof header, 1, out) != 1 ||
+      fwrite(records, sizeof *records, n, out) != n ||
+      fwrite(pool->data, 1, pool->size, out) != pool->size) {
+    return -1;
+  }
+  return 0;
+}
+
+// Writes the compiled database of `accounts` to `out`.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int padb_compile(const struct account_list *accounts, FILE *out) {
+  const size_t n = accounts->size;
+  if (n > (UINT32_MAX - sizeof(struct padb_header)) /
+              sizeof(struct padb_account)) {
+    errno = EFBIG;
+    return -1;
+  }
+
+  // Each account interns five strings at most: its domain, username and
+  // iteration, its characters and the enumerated charset of these, which is
+  // a string of its own.  They take at most half of the slots.
+  size_t table_size = 16;
+  while (table_size < 10 * n) {
+    table_size *= 2;
+  }
+  struct padb__pool pool = {
+      .data = malloc(4096),
+      .capacity = 4096,
+      .table = malloc(table_size * sizeof *pool.table),
+      .table_size = table_size,
+  };
+  size_t *order = malloc((n > 0 ? n : 1) * sizeof *order);
+  struct padb_account *records = malloc((n > 0 ? n : 1) * sizeof *records);
+
+  int ret = -1;
+  if (order != nullptr && records != nullptr && pool.data != nullptr &&
+      pool.table != nullptr) {
+    for (size_t i = 0; i < table_size; ++i) {
+      pool.table[i].offset = UINT32_MAX;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      order[i] = i;
+    }
+    qsort_r(order, n, sizeof *order, padb__order, accounts->accounts);
+
+    ret = 0;
+    for (size_t i = 0; i < n && ret == 0; ++i) {
+      ret = padb__record(&pool, &accounts->accounts[order[i]], &records[i]);
+    }
+    // the pool may not be empty
+    if (ret == 0 && pool.size == 0 && padb__intern(&pool, "") == nullptr) {
+      ret = -1;
+    }
+    if (ret == 0) {
+      ret = padb__write(n, records, &pool, out);
+    }
+  }
+
+  free(order);
+  free(records);
+  free(pool.data);
+  free(pool.table);
+  return ret;
+}
@@ -15,33 +15,219 @@
 //
 
 #include "padre.h"
+#include "csv.c"
+#include "scrypt.c"
+#include "chacha20.c" // depends on scrypt.c
+#include "argon2.c" // depends on scrypt.c
+#include "charset.c"
+#include "timings.c"
 
-#include <scrypt-kdf.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static int
-derive_password(const size_t master_password_len,
-                const char master_password[static master_password_len],
-                const char *domain, const char *username, const char *passno,
-                const size_t buf_len, char buf[static buf_len]) {
-  const size_t salt_len = strlen(domain) + strlen(username) + strlen(passno);
+// The master password, as far as the derivations need it.  Every derivation
+// keys HMAC-SHA256 with the master password at the start and the end of
+// scrypt.  The session keeps the HMAC states keyed once, when the password is
+// read, so that neither the key setup is repeated for every account nor the
+// plaintext password has to be kept around.  For the same reason, Argon2id
+// takes a key derived from the master password by HMAC-SHA256 as its password.
+struct session {
+  struct hmac_sha256 prf;
+  uint8_t argon2id_password[32];
+};
+
+// Keyed with the master password, HMAC-SHA256 derives the password of
+// Argon2id from this.
+#define ARGON2ID_PASSWORD_LABEL "padre argon2id"
+
+static void
+session_init(struct session *session, const size_t master_password_len,
+             const char master_password[static master_password_len]) {
+  hmac_sha256_init(&session->prf, master_password, master_password_len);
+
+  struct hmac_sha256 prf = session->prf;
+  hmac_sha256_update(&prf, ARGON2ID_PASSWORD_LABEL,
+                     sizeof ARGON2ID_PASSWORD_LABEL - 1);
+  hmac_sha256_final(&prf, session->argon2id_password);
+  explicit_bzero(&prf, sizeof prf);
+}
+
+static void session_clear(struct session *session) {
+  explicit_bzero(session, sizeof *session);
+}
+
+// Appended to the salt in scheme 2.  No salt of scheme 1 contains a null
+// byte, so that the schemes never share a salt and thus never a key.
+#define SCHEME_V2_SALT_SUFFIX "\0padre v2"
+
+// The size of the key scrypt derives in scheme 2.
+#define SCHEME_V2_KEY_SIZE CHACHA20_KEY_SIZE
+
+// Appended to the salt for Argon2id, which takes salts of at least 8 bytes.
+#define ARGON2ID_SALT_SUFFIX "\0padre argon2id"
+
+// Writes the salt for an account of `scheme` derived by `kdf` into `salt`, if
+// it fits into `size` bytes.
+// Returns the length of the salt, whether it was written or not.
+static size_t write_salt(uint8_t *salt, const size_t size, const char *domain,
+                         const size_t domain_len, const char *username,
+                         const size_t username_len, const char *passno,
+                         const size_t passno_len, const enum scheme scheme,
+                         const enum kdf kdf) {
+  const char *suffix = scheme == SCHEME_V2 ? SCHEME_V2_SALT_SUFFIX : "";
+  const size_t suffix_len =
+      scheme == SCHEME_V2 ? sizeof SCHEME_V2_SALT_SUFFIX - 1 : 0;
+  const char *kdf_suffix = kdf == KDF_ARGON2ID ? ARGON2ID_SALT_SUFFIX : "";
+  const size_t kdf_suffix_len =
+      kdf == KDF_ARGON2ID ? sizeof ARGON2ID_SALT_SUFFIX - 1 : 0;
+  const size_t salt_len = domain_len + username_len + passno_len +
+                          suffix_len + kdf_suffix_len;
+  if (salt == nullptr || salt_len > size) {
+    return salt_len;
+  }
+  memcpy(salt, domain, domain_len);
+  memcpy(salt + domain_len, username, username_len);
+  memcpy(salt + domain_len + username_len, passno, passno_len);
+  memcpy(salt + domain_len + username_len + passno_len, suffix, suffix_len);
+  memcpy(salt + salt_len - kdf_suffix_len, kdf_suffix, kdf_suffix_len);
+  return salt_len;
+}
+
+// Concatenates the salt for an account of `scheme` derived by `kdf` and stores
+// its length in `len`.  The returned string must be freed.
+static char *make_salt(const char *domain, const char *username,
+                       const char *passno, const enum scheme scheme,
+                       const enum kdf kdf, size_t *len) {
+  const size_t domain_len = strlen(domain);
+  const size_t username_len = strlen(username);
+  const size_t passno_len = strlen(passno);
+  const size_t salt_len =
+      write_salt(nullptr, 0, domain, domain_len, username, username_len,
+                 passno, passno_len, scheme, kdf);
   char *const salt = malloc(salt_len + 1);
   if (salt == nullptr) {
     perror("Could not allocate memory for the salt");
+    return nullptr;
+  }
+  write_salt((uint8_t *)salt, salt_len, domain, domain_len, username,
+             username_len, passno, passno_len, scheme, kdf);
+  salt[salt_len] = '\0';
+
+  *len = salt_len;
+  return salt;
+}
+
+// A key derivation function that passwords can be derived with.
+struct kdf_backend {
+  const char *name; // as in the database and on the command line
+  struct kdf_cost default_cost;
+  // Returns whether the cost parameters can be used.
+  bool (*valid_cost)(const struct kdf_cost *cost);
+  // Returns the number of bytes of scratch memory a derivation takes on up to
+  // `threads` threads.
+  size_t (*memory_size)(const struct kdf_cost *cost, size_t threads);
+  // Derives `buf_len` bytes into `buf` from the master password of `session`
+  // and `salt` on up to `threads` threads, using the scratch memory of `ctx`.
+  int (*derive)(struct scrypt_ctx *ctx, const struct session *session,
+                const uint8_t *salt, size_t salt_len,
+                const struct kdf_cost *cost, uint8_t *buf, size_t buf_len,
+                size_t threads);
+};
+
+static bool kdf__scrypt_valid_cost(const struct kdf_cost *cost) {
+  return scrypt_valid_params(cost->N, cost->r, cost->p);
+}
+
+static size_t kdf__scrypt_memory_size(const struct kdf_cost *cost,
+                                      const size_t threads) {
+  return scrypt_memory_size(cost->N, cost->r, cost->p, threads);
+}
+
+static int kdf__scrypt_derive(struct scrypt_ctx *ctx,
+                              const struct session *session,
+                              const uint8_t *salt, const size_t salt_len,
+                              const struct kdf_cost *cost, uint8_t *buf,
+                              const size_t buf_len, const size_t threads) {
+  return scrypt_kdf_keyed_threads(ctx, &session->prf, salt, salt_len, cost->N,
+                                  cost->r, cost->p, buf, buf_len, threads);
+}
+
+static bool kdf__argon2id_valid_cost(const struct kdf_cost *cost) {
+  return argon2_valid_params(cost->N, cost->r, cost->p);
+}
+
+static size_t kdf__argon2id_memory_size(const struct kdf_cost *cost,
+                                        const size_t threads) {
+  (void)threads; // the lanes share the memory, however many threads fill them
+  return argon2_memory_size(cost->N, cost->p);
+}
+
+static int kdf__argon2id_derive(struct scrypt_ctx *ctx,
+                                const struct session *session,
+                                const uint8_t *salt, const size_t salt_len,
+                                const struct kdf_cost *cost, uint8_t *buf,
+                                const size_t buf_len, const size_t threads) {
+  return argon2id_kdf_with(ctx, session->argon2id_password,
+                           sizeof session->argon2id_password, salt, salt_len,
+                           nullptr, 0, nullptr, 0, cost->N, cost->r, cost->p,
+                           buf, buf_len, threads < cost->p ? threads : cost->p);
+}
+
+static const struct kdf_backend kdf_backends[NUM_KDFS] = {
+    [KDF_SCRYPT] = {"scrypt", DEFAULT_KDF_COST, kdf__scrypt_valid_cost,
+                    kdf__scrypt_memory_size, kdf__scrypt_derive},
+    [KDF_ARGON2ID] = {"argon2id", DEFAULT_ARGON2ID_COST,
+                      kdf__argon2id_valid_cost, kdf__argon2id_memory_size,
+                      kdf__argon2id_derive},
+};
+
+// Parses the name of a KDF into `kdf`.  The empty string is scrypt.
+// Returns 0 on success; -1 if there is no such KDF.
+static int parse_kdf(const char *str, enum kdf *kdf) {
+  if (*str == '\0') {
+    *kdf = KDF_SCRYPT;
+    return 0;
+  }
+  for (size_t i = 0; i < NUM_KDFS; ++i) {
+    if (strcmp(str, kdf_backends[i].name) == 0) {
+      *kdf = (enum kdf)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Derives the raw password for the account given by `domain`, `username` and
+// `passno` of `scheme` at `cost`, using the scratch memory of `ctx` (see
+// `scrypt_kdf()`).
+static int derive_password(struct scrypt_ctx *ctx,
+                           const struct session *session, const char *domain,
+                           const char *username, const char *passno,
+                           const enum scheme scheme,
+                           const struct kdf_cost cost, const size_t buf_len,
+                           char buf[static buf_len]) {
+  size_t salt_len;
+  char *const salt =
+      make_salt(domain, username, passno, scheme, cost.kdf, &salt_len);
+  if (salt == nullptr) {
     return -1;
   }
-  memcpy(salt, domain, strlen(domain) + 1);
-  memcpy(salt + strlen(salt), username, strlen(username) + 1);
-  memcpy(salt + strlen(salt), passno, strlen(passno) + 1);
 
-  const int ret = crypto_scrypt((const uint8_t *)master_password,
-                                master_password_len, (uint8_t *)salt, salt_len,
-                                MP_N, MP_r, MP_p, (uint8_t *)buf, buf_len);
+  const uint64_t start = timing_start();
+  const int ret = kdf_backends[cost.kdf].derive(
+      ctx, session, (uint8_t *)salt, salt_len, &cost, (uint8_t *)buf, buf_len,
+      kdf_num_threads(cost.p));
+  timing_stop(TIMING_KDF, start);
+  timings_count_kdf(1);
 
   free(salt);
 
@@ -61,96 +247,71 @@ static char *to_chars(uint8_t *bytes, size_t len, const char *chars,
   return (char *)bytes;
 }
 
-static char *push_char(char *begin, const char *end, const char c) {
-  if (begin != nullptr && begin < end) {
-    *begin = c;
-    return begin + 1;
+// Returns a number below `n`, drawn uniformly from the keystream of `stream`.
+// As many bits as `n - 1` has are taken from the keystream, and taken again as
+// long as they are `n` or more, which happens less than half of the time.
+static uint32_t draw_below(struct chacha20 *stream, const uint32_t n) {
+  if (n <= 1) {
+    return 0;
   }
-  return nullptr;
+  const unsigned bits = 32 - (unsigned)__builtin_clz(n - 1);
+  const size_t num_bytes = (bits + 7) / 8;
+  const uint32_t mask = (uint32_t)(((uint64_t)1 << bits) - 1);
+  for (;;) {
+    uint8_t bytes[sizeof(uint32_t)];
+    chacha20_keystream(stream, bytes, num_bytes);
+    uint32_t x = 0;
+    for (size_t i = 0; i < num_bytes; ++i) {
+      x |= (uint32_t)bytes[i] << (8 * i);
+    }
+    if ((x & mask) < n) {
+      return x & mask;
+    }
+  }
+}
+
+// Expands `key` into `len` characters from `set` in `password`, which is
+// null-terminated and takes up to `CHARSET_MAX_CHAR_SIZE * len + 1` bytes.
+// Every character is equally likely, no matter the size of `set`.
+static void expand_chars(const uint8_t key[static SCHEME_V2_KEY_SIZE],
+                         char *password, const size_t len,
+                         const struct charset *set) {
+  static const uint8_t nonce[CHACHA20_NONCE_SIZE] = {0};
+  struct chacha20 stream;
+  chacha20_init(&stream, key, nonce, 0);
+  for (size_t i = 0; i < len; ++i) {
+    password += charset__encode(
+        set->chars[draw_below(&stream, (uint32_t)set->size)], password);
+  }
+  *password = '\0';
+  chacha20_clear(&stream);
 }
 
+// Enumerates the characters of `spec` as they are in a table of scheme 1, in
+// a newly allocated string `*res` of `*rlen` bytes.
+// Returns 0 on success; -1 if `spec` is invalid, with `errno` set.
 static int enumerate_charset(const char *spec, char **res, size_t *rlen) {
   if (spec == nullptr || res == nullptr || rlen == nullptr) {
     errno = EINVAL;
     return -1;
   }
 
-  // Resolve character classes.  If no `spec` is given, assume all ASCII
-  // characters may be used.
-  if (strcmp(spec, "") == 0 || strcmp(spec, ":graph:") == 0 ||
-      strcmp(spec, "*") == 0) {
-    spec = "!-~";
-  } else if (strcmp(spec, ":alnum:") == 0) {
-    spec = "a-zA-Z0-9";
-  } else if (strcmp(spec, ":alpha:") == 0) {
-    spec = "a-zA-Z";
-  } else if (strcmp(spec, ":digit:") == 0) {
-    spec = "0-9";
-  } else if (strcmp(spec, ":lower:") == 0) {
-    spec = "a-z";
-  } else if (strcmp(spec, ":punct:") == 0) {
-    spec = "!-/:-@[-`{-~";
-  } else if (strcmp(spec, ":upper:") == 0) {
-    spec = "A-Z";
-  } else if (strcmp(spec, ":word:") == 0) {
-    spec = "A-Za-z0-9_";
-  } else if (strcmp(spec, ":xdigit:") == 0) {
-    spec = "A-Fa-f0-9";
-  } else if (strcmp(spec, "*") == 0) {
-    spec = "!-~öäüµ€§°";
-  }
-
-  char chars[95]; // as big as `|*|` plus one for the \0
-  char *result = chars;
-  const char *end = chars + 95;
-
-  char l = '\0'; // left side of a character range
-  int op = 0;    // operator found (`-`) <- not a smiley!
-  while (*spec != '\0') {
-    const char c = *spec;
-    if (isspace(c))
-      continue;
-
-    if (l == '\0' && c == '-') {
-      result = push_char(result, end, c);
-    } else if (l == '\0' && c != '-') {
-      l = c;
-    } else if (l != '\0' && c == '-') {
-      op = 1;
-    } else if (l != '\0' && c != '-' && op == 1) {
-      for (; l <= c; l++) {
-        result = push_char(result, end, l);
-      }
-      op = 0;
-      l = '\0';
-    } else if (l != '\0' && c != '-' && op == 0) {
-      result = push_char(result, end, l);
-      l = c;
-    }
-
-    ++spec;
-  }
-
-  if (l != '\0') {
-    result = push_char(result, end, l);
-  }
-  if (op == 1) {
-    result = push_char(result, end, '-');
-  }
-  result = push_char(result, end, '\0');
-
-  if (result == nullptr) {
-    errno = EINVAL;
+  const struct charset *set = charset_get(spec, SCHEME_V1);
+  if (set == nullptr) {
     return -1;
   }
-
-  *rlen = strlen(chars);
-  *res = malloc(*rlen);
+  *res = malloc(set->size + 1);
   if (*res == nullptr) {
     perror("While enumerating the charset");
+    charset_put(set);
     return -1;
   }
-  memcpy(*res, chars, *rlen + 1);
+  for (size_t i = 0; i < set->size; ++i) {
+    (*res)[i] = (char)set->chars[i];
+  }
+  (*res)[set->size] = '\0';
+  *rlen = set->size;
+  charset_put(set);
 
   return 0;
 }
@@ -161,8 +322,28 @@ struct account {
   const char *iteration;
   const char *characters; // the permissible characters for the password
   size_t length;          // the length the generated password should have
+  const char *charset;    // `characters` enumerated; `nullptr` if not yet
+  enum scheme scheme;     // how the password is derived
+  struct kdf_cost cost;   // the KDF and its cost parameters
 };
 
+static bool kdf_cost_equal(const struct kdf_cost *a, const struct kdf_cost *b) {
+  return a->kdf == b->kdf && a->N == b->N && a->r == b->r && a->p == b->p;
+}
+
+static bool kdf_cost_is_default(const struct kdf_cost *cost) {
+  return kdf_cost_equal(cost, &(struct kdf_cost)DEFAULT_KDF_COST);
+}
+
+// Returns the number of bytes the password of `account` takes at most,
+// including the terminating null byte.  Only in scheme 2 may characters take
+// more than one byte.
+static size_t password_size(const struct account *account) {
+  return account->length *
+             (account->scheme == SCHEME_V2 ? CHARSET_MAX_CHAR_SIZE : 1) +
+         1;
+}
+
 struct account_list {
   struct account *accounts;
   size_t size;
@@ -194,66 +375,778 @@ static void push_account(struct account_list *list,
   ++list->size;
 }
 
+// The fields of an account in the database, in this order.  The optional
+// fields can only follow quoted characters.
+enum account_field {
+  ACCOUNT_DOMAIN,
+  ACCOUNT_USERNAME,
+  ACCOUNT_ITERATION,
+  ACCOUNT_LENGTH,
+  ACCOUNT_CHARACTERS,
+  NUM_REQUIRED_ACCOUNT_FIELDS,
+  ACCOUNT_SCHEME = NUM_REQUIRED_ACCOUNT_FIELDS, // optional, 1 by default
+  ACCOUNT_COST_N, // optional, the default of the KDF by default
+  ACCOUNT_COST_R, // optional, the default of the KDF by default
+  ACCOUNT_COST_P, // optional, the default of the KDF by default
+  ACCOUNT_KDF,    // optional, scrypt by default
+  NUM_ACCOUNT_FIELDS
+};
+
+// Parses the number of a scheme, from 1, into `scheme`.  The empty string is
+// scheme 1.
+// Returns 0 on success; -1 if there is no such scheme.
+static int parse_scheme(const char *str, enum scheme *scheme) {
+  if (*str == '\0') {
+    *scheme = SCHEME_V1;
+    return 0;
+  }
+  if (str[0] < '1' || str[0] > '0' + NUM_SCHEMES || str[1] != '\0') {
+    return -1;
+  }
+  *scheme = (enum scheme)(str[0] - '1');
+  return 0;
+}
+
+// Parses the decimal number `str` into `n`.
+// Returns 0 on success; -1 if `str` is no such number.
+static int parse_number(const char *str, uint64_t *n) {
+  if (*str < '0' || *str > '9') {
+    return -1;
+  }
+  char *end;
+  errno = 0;
+  const unsigned long long value = strtoull(str, &end, 10);
+  if (errno != 0 || *end != '\0') {
+    return -1;
+  }
+  *n = value;
+  return 0;
+}
+
+// Parses the KDF and its cost parameters among the `num_fields` fields of an
+// account into `cost`.  Those that are missing or empty keep the defaults of
+// the KDF.
+// Returns 0 on success; -1 if the KDF or the parameters are invalid, with the
+// index of the first invalid field in `invalid`.
+static int parse_kdf_cost(char *fields[static NUM_ACCOUNT_FIELDS],
+                          const size_t num_fields, struct kdf_cost *cost,
+                          size_t *invalid) {
+  enum kdf kdf = KDF_SCRYPT;
+  if (num_fields > ACCOUNT_KDF && parse_kdf(fields[ACCOUNT_KDF], &kdf) != 0) {
+    *invalid = ACCOUNT_KDF;
+    return -1;
+  }
+  const struct kdf_cost *defaults = &kdf_backends[kdf].default_cost;
+  uint64_t values[] = {defaults->N, defaults->r, defaults->p};
+  for (size_t i = ACCOUNT_COST_N; i < num_fields && i <= ACCOUNT_COST_P;
+       ++i) {
+    uint64_t *value = &values[i - ACCOUNT_COST_N];
+    if (*fields[i] != '\0' &&
+        (parse_number(fields[i], value) != 0 ||
+         (i != ACCOUNT_COST_N && *value > UINT32_MAX))) {
+      *invalid = i;
+      return -1;
+    }
+  }
+  *cost = (struct kdf_cost){kdf, values[0], (uint32_t)values[1],
+                            (uint32_t)values[2]};
+  if (!kdf_backends[kdf].valid_cost(cost)) {
+    *invalid = ACCOUNT_COST_N;
+    return -1;
+  }
+  return 0;
+}
+
+// Parses the accounts in the CSV data from `begin` to `end`, which must be
+// followed by a null byte.  The data is split into null-terminated fields in
+// place, which the accounts point to.  Malformed records are reported and
+// skipped.  If the characters are not quoted, they extend to the end of the
+// line, as in databases from before quoting was supported.
 static struct account_list parse_accounts(char *begin, const char *end) {
   struct account_list list = new_account_list(
       end - begin < AVERAGE_DATABASE_ENTRY_SIZE
           ? 1
           : (size_t)((end - begin) / AVERAGE_DATABASE_ENTRY_SIZE));
 
-  const char *cur = begin;
-  struct account account = {nullptr, nullptr, nullptr, nullptr, 0};
-  for (char *str = begin; str != end; ++str) {
-    switch (*str) {
-    case '\n':
-      *str = '\0';
-      account.characters = cur;
-      if (account.domain == nullptr || account.username == nullptr) {
-        fprintf(stderr, "Error: invalid entry at line %zu, skipping\n",
-                list.size + 1);
-      } else {
-        push_account(&list, account);
+  struct csv_reader reader;
+  csv_init(&reader, begin, end);
+
+  char *fields[NUM_ACCOUNT_FIELDS];
+  size_t num_fields;
+  for (int ret; (ret = csv_read_record(&reader, NUM_ACCOUNT_FIELDS,
+                                       ACCOUNT_CHARACTERS, fields,
+                                       &num_fields)) != 0;) {
+    if (ret < 0) {
+      fprintf(stderr, "Error: line %zu, column %zu: %s, skipping\n",
+              reader.error_line, reader.error_column, reader.error);
+      continue;
+    }
+    const size_t line = reader.record_line;
+    if (num_fields < NUM_REQUIRED_ACCOUNT_FIELDS) {
+      fprintf(stderr,
+              "Error: line %zu: expected %d fields but found %zu, skipping\n",
+              line, NUM_REQUIRED_ACCOUNT_FIELDS, num_fields);
+      continue;
+    }
+    if (num_fields > NUM_ACCOUNT_FIELDS) {
+      fprintf(stderr,
+              "Error: line %zu: expected at most %d fields but found %zu,"
+              " skipping\n",
+              line, NUM_ACCOUNT_FIELDS, num_fields);
+      continue;
+    }
+    enum scheme scheme = SCHEME_V1;
+    if (num_fields > ACCOUNT_SCHEME &&
+        parse_scheme(fields[ACCOUNT_SCHEME], &scheme) != 0) {
+      fprintf(stderr,
+              "Error: line %zu, column %zu: unknown scheme, skipping\n", line,
+              (size_t)(fields[ACCOUNT_SCHEME] - reader.record) + 1);
+      continue;
+    }
+    struct kdf_cost cost;
+    size_t invalid;
+    if (parse_kdf_cost(fields, num_fields, &cost, &invalid) != 0) {
+      fprintf(stderr, "Error: line %zu, column %zu: %s, skipping\n", line,
+              (size_t)(fields[invalid] - reader.record) + 1,
+              invalid == ACCOUNT_KDF ? "unknown KDF"
+                                     : "invalid cost parameters");
+      continue;
+    }
+
+    const int length = atoi(fields[ACCOUNT_LENGTH]);
+    if (length <= 0) {
+      fprintf(stderr,
+              "Error: line %zu, column %zu: the length of the derived password"
+              " may not be negative or zero\n",
+              line, (size_t)(fields[ACCOUNT_LENGTH] - reader.record) + 1);
+      free_account_list(&list);
+      return list;
+    }
+
+    push_account(&list, (struct account){
+                            .domain = fields[ACCOUNT_DOMAIN],
+                            .username = fields[ACCOUNT_USERNAME],
+                            .iteration = fields[ACCOUNT_ITERATION],
+                            .characters = fields[ACCOUNT_CHARACTERS],
+                            .length = (size_t)length,
+                            .scheme = scheme,
+                            .cost = cost,
+                        });
+  }
+
+  return list;
+}
+
+// An account as the user refers to it, `<domain>[:<username>[:<iteration>]]`.
+// The fields that are not given are `nullptr`.
+struct account_key {
+  const char *domain;
+  const char *username;
+  const char *iteration;
+};
+
+// Splits `str` into `key` in place.  Empty fields are not given, so that
+// `example.com::1` refers to the first iteration of any username.
+static struct account_key parse_account_key(char *str) {
+  char *fields[3] = {str, nullptr, nullptr};
+  for (size_t i = 1; i < 3 && fields[i - 1] != nullptr; ++i) {
+    fields[i] = strchr(fields[i - 1], ':');
+    if (fields[i] != nullptr) {
+      *fields[i]++ = '\0';
+    }
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    if (fields[i] != nullptr && *fields[i] == '\0') {
+      fields[i] = nullptr;
+    }
+  }
+  return (struct account_key){fields[0], fields[1], fields[2]};
+}
+
+static bool field_matches(const char *field, const char *key,
+                          const bool prefix) {
+  return key == nullptr ||
+         (prefix ? strncmp(field, key, strlen(key)) == 0
+                 : strcmp(field, key) == 0);
+}
+
+// Returns whether `account` matches `key`, i.e. whether the fields of `key`
+// are equal to those of `account` or, if `prefix` is set, prefixes of them.
+static bool account_matches(const struct account *account,
+                            const struct account_key *key, const bool prefix) {
+  return field_matches(account->domain, key->domain, prefix) &&
+         field_matches(account->username, key->username, prefix) &&
+         field_matches(account->iteration, key->iteration, prefix);
+}
+
+// The accounts found for a key, of which only the first few are kept.
+#define MAX_MATCHES 10
+struct account_matches {
+  size_t size; // may be more than `MAX_MATCHES`
+  struct account accounts[MAX_MATCHES];
+};
+
+// Adds `account` to `matches`.
+// Returns whether more matches are of interest.
+static bool add_match(struct account_matches *matches,
+                      const struct account *account) {
+  if (matches->size < MAX_MATCHES) {
+    matches->accounts[matches->size] = *account;
+  }
+  ++matches->size;
+  return matches->size <= MAX_MATCHES;
+}
+
+// Adds the accounts of `list` that match `key` exactly to `matches` or, if
+// none does, those whose fields start with those of `key`.  Both are looked
+// for in a single pass, as an index would not pay off for a single key.
+static void find_accounts(const struct account_list *list,
+                          const struct account_key *key,
+                          struct account_matches *matches) {
+  struct account_matches prefix_matches = {0};
+  for (size_t i = 0; i < list->size && matches->size <= MAX_MATCHES; ++i) {
+    if (account_matches(&list->accounts[i], key, false)) {
+      add_match(matches, &list->accounts[i]);
+    } else if (matches->size == 0 &&
+               account_matches(&list->accounts[i], key, true)) {
+      add_match(&prefix_matches, &list->accounts[i]);
+    }
+  }
+  if (matches->size == 0) {
+    *matches = prefix_matches;
+  }
+}
+
+// Maps the raw output of the KDF to `length` characters of `set` in
+// `password`, as `apply_charset()` does.
+static void map_chars(const struct charset *set, const uint8_t *raw,
+                      char *password, const size_t length) {
+  if (set->scheme == SCHEME_V2) {
+    expand_chars(raw, password, length, set);
+  } else {
+    for (size_t i = 0; i < length; ++i) {
+      password[i] = (char)set->chars[(uint8_t)password[i] % set->size];
+    }
+    password[length] = '\0';
+  }
+}
+
+// Maps the raw output of the KDF for `account` to the characters permissible
+// for it in `password`.  In scheme 1, the raw output is in `password` already;
+// in scheme 2, it is the key in `raw`.
+static int apply_charset(const struct account *account, const uint8_t *raw,
+                         char password[static password_size(account)]) {
+  if (account->scheme == SCHEME_V1 && account->charset != nullptr) {
+    to_chars((uint8_t *)password, account->length, account->charset,
+             strlen(account->charset));
+    return 0;
+  }
+
+  const struct charset *set = charset_get(account->characters, account->scheme);
+  if (set == nullptr) {
+    return -1;
+  }
+  map_chars(set, raw, password, account->length);
+  charset_put(set);
+
+  return 0;
+}
+
+// Returns the buffer the KDF derives the raw password of `account` into, and
+// stores its size in `len`: `password` itself in scheme 1, `key` in scheme 2.
+static uint8_t *raw_password(const struct account *account, char *password,
+                             uint8_t key[static SCHEME_V2_KEY_SIZE],
+                             size_t *len) {
+  if (account->scheme == SCHEME_V2) {
+    *len = SCHEME_V2_KEY_SIZE;
+    return key;
+  }
+  *len = account->length;
+  return (uint8_t *)password;
+}
+
+// Derives the password for `account` and stores it as a null-terminated string
+// of `account->length` characters in `password`.
+// Returns 0 on success; -1 in case of a failure.
+static int
+derive_account_password(struct scrypt_ctx *ctx, const struct session *session,
+                        const struct account *account,
+                        char password[static password_size(account)]) {
+  uint8_t key[SCHEME_V2_KEY_SIZE];
+  size_t raw_len;
+  uint8_t *raw = raw_password(account, password, key, &raw_len);
+  int ret = derive_password(ctx, session, account->domain, account->username,
+                            account->iteration, account->scheme,
+                            account->cost, raw_len, (char *)raw);
+  if (ret == 0) {
+    const uint64_t start = timing_start();
+    ret = apply_charset(account, raw, password);
+    timing_stop(TIMING_CHARSET, start);
+  }
+  explicit_bzero(key, sizeof key);
+
+  return ret;
+}
+
+// Returns the scratch memory `derive_account_password()` takes for `account`.
+static size_t account_memory_size(const struct account *account) {
+  const struct kdf_cost *cost = &account->cost;
+  return kdf_backends[cost->kdf].memory_size(cost, kdf_num_threads(cost->p));
+}
+
+// Grows `ctx` as far as needed for `derive_account_password()` to derive
+// `account` in it, rather than in scratch memory of its own.
+// Returns 0 on success; -1 in case of a failure, with `errno` set and `ctx`
+// left empty.
+static int fit_ctx(struct scrypt_ctx *ctx, const struct account *account) {
+  const size_t size = account_memory_size(account);
+  if (size <= ctx->size) {
+    return 0;
+  }
+  scrypt_ctx_free(ctx);
+  return scrypt_ctx_init_size(ctx, size);
+}
+
+// Like `derive_account_password()`, but for several accounts at once, which
+// are derived side by side in the lanes of the SIMD unit, as far as they are
+// derived by scrypt with the same cost parameters.  `passwords[i]` must hold
+// `password_size(&accounts[i])` bytes.
+static int derive_account_passwords(
+    struct scrypt_ctx *ctx, const struct session *session,
+    const size_t num_accounts, const struct account accounts[num_accounts],
+    char *const passwords[num_accounts]) {
+  struct scrypt_job jobs[SCRYPT_LANES];
+  char *salts[SCRYPT_LANES] = {nullptr};
+  uint8_t keys[SCRYPT_LANES][SCHEME_V2_KEY_SIZE];
+  uint8_t *raws[SCRYPT_LANES];
+  int ret = 0;
+
+  for (size_t first = 0, count; ret == 0 && first < num_accounts;
+       first += count) {
+    const struct kdf_cost *cost = &accounts[first].cost;
+    count = 1;
+    if (cost->kdf != KDF_SCRYPT) {
+      // only scrypt has multi-lane kernels
+      ret = derive_account_password(ctx, session, &accounts[first],
+                                    passwords[first]);
+      continue;
+    }
+    while (count < SCRYPT_LANES && first + count < num_accounts &&
+           kdf_cost_equal(&accounts[first + count].cost, cost)) {
+      ++count;
+    }
+    for (size_t i = 0; ret == 0 && i < count; ++i) {
+      const struct account *account = &accounts[first + i];
+      size_t salt_len;
+      salts[i] =
+          make_salt(account->domain, account->username, account->iteration,
+                    account->scheme, KDF_SCRYPT, &salt_len);
+      if (salts[i] == nullptr) {
+        ret = -1;
+        break;
       }
-      account = (struct account){nullptr, nullptr, nullptr, nullptr, 0};
-      cur = str + 1;
+      size_t raw_len;
+      raws[i] = raw_password(account, passwords[first + i], keys[i], &raw_len);
+      jobs[i] = (struct scrypt_job){
+          .salt = (const uint8_t *)salts[i],
+          .salt_len = salt_len,
+          .buf = raws[i],
+          .buf_len = raw_len,
+          .prf = &session->prf,
+      };
+    }
+
+    if (ret == 0) {
+      const uint64_t start = timing_start();
+      ret = scrypt_kdf_lanes(ctx, count, jobs, cost->N, cost->r, cost->p);
+      timing_stop(TIMING_KDF, start);
+      timings_count_kdf(count);
+    }
+    const uint64_t start = timing_start();
+    for (size_t i = 0; ret == 0 && i < count; ++i) {
+      ret = apply_charset(&accounts[first + i], raws[i], passwords[first + i]);
+    }
+    timing_stop(TIMING_CHARSET, start);
+
+    for (size_t i = 0; i < count; ++i) {
+      free(salts[i]);
+      salts[i] = nullptr;
+    }
+  }
+  explicit_bzero(keys, sizeof keys);
+
+  return ret;
+}
+
+struct batch {
+  const struct session *session;
+  size_t num_accounts;
+  const struct account *accounts;
+  char **passwords;
+  size_t chunk_size;   // number of accounts picked up at once
+  size_t scratch_size; // of the scratch memory of each thread
+  atomic_size_t next;  // index of the next account to be picked up
+  atomic_int failures; // number of accounts that could not be derived
+};
+
+static void *batch__worker(void *arg) {
+  struct batch *batch = arg;
+
+  // The scratch memory is reused for all accounts of this worker, as it is
+  // large enough for the costliest one.  Without it, each derivation
+  // allocates its own, which is slower but still works.
+  struct scrypt_ctx ctx;
+  struct scrypt_ctx *pctx =
+      scrypt_ctx_init_size(&ctx, batch->scratch_size) == 0 ? &ctx : nullptr;
+  for (size_t first = atomic_fetch_add(&batch->next, batch->chunk_size);
+       first < batch->num_accounts;
+       first = atomic_fetch_add(&batch->next, batch->chunk_size)) {
+    const size_t count = batch->num_accounts - first < batch->chunk_size
+                             ? batch->num_accounts - first
+                             : batch->chunk_size;
+    const struct account *accounts = &batch->accounts[first];
+    char **passwords = &batch->passwords[first];
+
+    bool allocated = true;
+    for (size_t i = 0; i < count; ++i) {
+      passwords[i] = malloc(password_size(&accounts[i]));
+      allocated = allocated && passwords[i] != nullptr;
+    }
+    if (allocated &&
+        derive_account_passwords(pctx, batch->session, count, accounts,
+                                 passwords) == 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      fprintf(stderr, "Error: could not derive the password for %s, %s\n",
+              accounts[i].domain, accounts[i].username);
+      free(passwords[i]);
+      passwords[i] = nullptr;
+    }
+    atomic_fetch_add(&batch->failures, (int)count);
+  }
+
+  if (pctx != nullptr) {
+    scrypt_ctx_free(pctx);
+  }
+  return nullptr;
+}
+
+// Returns the number of bytes of scratch memory a thread of a batch takes to
+// derive any of `accounts`, `lanes` of them at once if it is SCRYPT_LANES.
+// The scrypt accounts of a batch are derived on one thread each.
+static size_t batch__scratch_size(const size_t num_accounts,
+                                  const struct account accounts[num_accounts],
+                                  const size_t lanes) {
+  size_t size = 0;
+  for (size_t i = 0; i < num_accounts; ++i) {
+    const struct kdf_cost *cost = &accounts[i].cost;
+    const size_t account_size =
+        cost->kdf == KDF_SCRYPT && lanes == SCRYPT_LANES
+            ? scrypt_lanes_memory_size(cost->N, cost->r, cost->p)
+            : kdf_backends[cost->kdf].memory_size(cost, 1);
+    size = account_size > size ? account_size : size;
+  }
+  return size;
+}
+
+// Derives the passwords of all `accounts` on as many threads as there are
+// processors online and as the scratch memory of all of them together fits in
+// `memory` bytes, but on one at least; 0 for no limit.  Each thread derives
+// the accounts in the lanes of the SIMD unit if the memory suffices for that
+// as well.  The password of `accounts[i]` is stored in a newly allocated
+// string in `passwords[i]`, or `nullptr` if it could not be derived.
+// Returns the number of accounts that could not be derived.
+static size_t derive_accounts(const struct session *session,
+                              const size_t num_accounts,
+                              const struct account accounts[num_accounts],
+                              char *passwords[num_accounts],
+                              const size_t memory) {
+  if (num_accounts == 0) {
+    return 0;
+  }
+
+  struct batch batch = {
+      .session = session,
+      .num_accounts = num_accounts,
+      .accounts = accounts,
+      .passwords = passwords,
+  };
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.failures, 0);
+
+  const long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_threads = nprocs > 0 ? (size_t)nprocs : 1;
+  if (num_threads > num_accounts) {
+    num_threads = num_accounts;
+  }
+  const size_t single_size = batch__scratch_size(num_accounts, accounts, 1);
+  if (memory != 0 && memory / single_size < num_threads) {
+    num_threads = memory / single_size > 0 ? memory / single_size : 1;
+  }
+
+  // Fill the SIMD lanes of each thread, unless that would leave some threads
+  // without work or take more memory than there is.
+  batch.chunk_size = (num_accounts + num_threads - 1) / num_threads;
+  if (batch.chunk_size > SCRYPT_LANES) {
+    batch.chunk_size = SCRYPT_LANES;
+  }
+  const size_t lanes_size =
+      batch__scratch_size(num_accounts, accounts, SCRYPT_LANES);
+  if (batch.chunk_size >= SCRYPT_MIN_LANES_USED &&
+      (memory == 0 || memory / lanes_size >= num_threads)) {
+    batch.scratch_size = lanes_size;
+  } else {
+    // one at a time, as lanes would take scratch memory of their own
+    batch.chunk_size = 1;
+    batch.scratch_size = single_size;
+  }
+
+  pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+  size_t started = 0;
+  for (; threads != nullptr && started < num_threads; ++started) {
+    if (pthread_create(&threads[started], nullptr, batch__worker, &batch) !=
+        0) {
       break;
-    case ',':
-      if (account.domain == nullptr) {
-        *str = '\0';
-        account.domain = cur;
-        cur = str + 1;
-      } else if (account.username == nullptr) {
-        *str = '\0';
-        account.username = cur;
-        cur = str + 1;
-      } else if (account.iteration == nullptr) {
-        *str = '\0';
-        account.iteration = cur;
-        cur = str + 1;
-      } else if (account.length == 0) {
-        *str = '\0';
-        const int tmp = atoi(cur);
-        if (tmp == 0 || tmp < 0) {
-          fprintf(
-              stderr,
-              "Error: the length of the derived password may not be negative or"
-              " zero, line %zu\n",
-              list.size + 1);
-          free_account_list(&list);
-          return list;
-        }
-        account.length = (size_t)atoi(cur);
-        cur = str + 1;
-      } else {
-        // ignore commas here, as they are part of the pattern
+    }
+  }
+  if (started == 0) {
+    // no threads available, so let's do the work ourselves
+    batch__worker(&batch);
+  }
+  for (size_t i = 0; i < started; ++i) {
+    pthread_join(threads[i], nullptr);
+  }
+  free(threads);
+
+  return (size_t)atomic_load(&batch.failures);
+}
+
+// The number of accounts above and below the highlighted one that are derived
+// speculatively.
+#define SPECULATION_RADIUS 4
+
+enum speculation_state {
+  SPECULATION_EMPTY,
+  SPECULATION_RUNNING,
+  SPECULATION_DONE,
+  SPECULATION_FAILED,
+};
+
+// Derives the passwords of the accounts around the one the user currently
+// looks at in the background, so that the password of the account the user
+// finally picks is ready right away.
+struct speculation {
+  const struct session *session;
+  size_t num_accounts;
+  const struct account *accounts;
+  char **passwords; // the derived passwords, `nullptr` unless done
+  enum speculation_state *states;
+  size_t focus; // index of the account the user looks at
+  bool stop;
+  pthread_mutex_t mutex;
+  pthread_cond_t changed; // signalled whenever `focus` or a state changes
+  size_t num_threads;
+  pthread_t *threads;
+};
+
+static bool speculation__wanted(const struct speculation *spec,
+                                const size_t index) {
+  return (index < spec->focus ? spec->focus - index : index - spec->focus) <=
+         SPECULATION_RADIUS;
+}
+
+// Returns the index of the account to be derived next, i.e. the one closest
+// to the focus that is not derived yet; `SIZE_MAX` if there is none.
+static size_t speculation__next(const struct speculation *spec) {
+  for (size_t d = 0; d <= SPECULATION_RADIUS; ++d) {
+    if (spec->focus + d < spec->num_accounts &&
+        spec->states[spec->focus + d] == SPECULATION_EMPTY) {
+      return spec->focus + d;
+    }
+    if (d <= spec->focus &&
+        spec->states[spec->focus - d] == SPECULATION_EMPTY) {
+      return spec->focus - d;
+    }
+  }
+  return SIZE_MAX;
+}
+
+static void speculation__drop(struct speculation *spec, const size_t index) {
+  explicit_bzero(spec->passwords[index],
+                 password_size(&spec->accounts[index]));
+  free(spec->passwords[index]);
+  spec->passwords[index] = nullptr;
+  spec->states[index] = SPECULATION_EMPTY;
+}
+
+static void *speculation__worker(void *arg) {
+  struct speculation *spec = arg;
+
+  // grown to the costliest account derived so far, which `speculation_start()`
+  // has accounted for
+  struct scrypt_ctx ctx = {.memory = nullptr, .mapping = nullptr};
+
+  pthread_mutex_lock(&spec->mutex);
+  while (!spec->stop) {
+    const size_t index = speculation__next(spec);
+    if (index == SIZE_MAX) {
+      pthread_cond_wait(&spec->changed, &spec->mutex);
+      continue;
+    }
+    spec->states[index] = SPECULATION_RUNNING;
+    pthread_mutex_unlock(&spec->mutex);
+
+    const struct account *account = &spec->accounts[index];
+    char *password = malloc(password_size(account));
+    const int ret =
+        password == nullptr
+            ? -1
+            : derive_account_password(fit_ctx(&ctx, account) == 0 ? &ctx
+                                                                   : nullptr,
+                                      spec->session, account, password);
+
+    pthread_mutex_lock(&spec->mutex);
+    if (ret == 0 && speculation__wanted(spec, index)) {
+      spec->passwords[index] = password;
+      spec->states[index] = SPECULATION_DONE;
+    } else {
+      // The user has moved on in the meantime, so the result is thrown away.
+      // It is derived again, should the user come back.
+      if (password != nullptr) {
+        explicit_bzero(password, password_size(account));
+        free(password);
       }
-      break;
-    default:
+      spec->states[index] = ret == 0 ? SPECULATION_EMPTY : SPECULATION_FAILED;
+    }
+    pthread_cond_broadcast(&spec->changed);
+  }
+  pthread_mutex_unlock(&spec->mutex);
+
+  scrypt_ctx_free(&ctx);
+  return nullptr;
+}
+
+// Starts deriving the passwords of the `accounts` around the first one in the
+// background.  `session` and `accounts` must outlive the speculation.  The
+// derivations take at most `memory` bytes at once, which can leave processors
+// unused; 0 for no limit.
+// Returns 0 on success; -1 in case of a failure.
+static int speculation_start(struct speculation *spec,
+                             const struct session *session,
+                             const size_t num_accounts,
+                             const struct account accounts[num_accounts],
+                             const size_t memory) {
+  *spec = (struct speculation){
+      .session = session,
+      .num_accounts = num_accounts,
+      .accounts = accounts,
+      .passwords = calloc(num_accounts, sizeof(char *)),
+      .states = calloc(num_accounts, sizeof(enum speculation_state)),
+  };
+  if (spec->passwords == nullptr || spec->states == nullptr) {
+    perror("Could not allocate memory for the speculation");
+    free(spec->passwords);
+    free(spec->states);
+    return -1;
+  }
+  pthread_mutex_init(&spec->mutex, nullptr);
+  pthread_cond_init(&spec->changed, nullptr);
+
+  const long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_threads = nprocs > 0 ? (size_t)nprocs : 1;
+  if (num_threads > 2 * SPECULATION_RADIUS + 1) {
+    num_threads = 2 * SPECULATION_RADIUS + 1;
+  }
+  // Any worker may end up with the costliest account, however far the user
+  // scrolls.  A single one is always started, as the selected account takes
+  // that much memory anyway.
+  size_t max_size = 0;
+  for (size_t i = 0; i < num_accounts; ++i) {
+    const size_t size = account_memory_size(&accounts[i]);
+    max_size = size > max_size ? size : max_size;
+  }
+  if (memory != 0 && max_size != 0 && num_threads > memory / max_size) {
+    num_threads = memory / max_size > 0 ? memory / max_size : 1;
+  }
+  spec->threads = malloc(num_threads * sizeof(pthread_t));
+  for (; spec->threads != nullptr && spec->num_threads < num_threads;
+       ++spec->num_threads) {
+    if (pthread_create(&spec->threads[spec->num_threads], nullptr,
+                       speculation__worker, spec) != 0) {
       break;
     }
   }
-  if (cur < end) { // missing a newline at the end of the file
-    account.characters = cur;
-    push_account(&list, account);
+
+  return 0;
+}
+
+// Tells the speculation that the user now looks at `accounts[index]`.  The
+// passwords of accounts that have become too far away are dropped.
+static void speculation_focus(struct speculation *spec, const size_t index) {
+  pthread_mutex_lock(&spec->mutex);
+  const size_t previous = spec->focus;
+  spec->focus = index;
+  // all done accounts lie around the previous focus
+  const size_t first =
+      previous < SPECULATION_RADIUS ? 0 : previous - SPECULATION_RADIUS;
+  for (size_t i = first;
+       i < spec->num_accounts && i <= previous + SPECULATION_RADIUS; ++i) {
+    if (spec->states[i] == SPECULATION_DONE && !speculation__wanted(spec, i)) {
+      speculation__drop(spec, i);
+    }
   }
-  return list;
+  pthread_cond_broadcast(&spec->changed);
+  pthread_mutex_unlock(&spec->mutex);
+}
+
+// Waits for the password of `accounts[index]` and stores it in `password`,
+// which must hold `password_size(&accounts[index])` bytes.
+// Returns 0 on success; -1 in case of a failure.
+static int speculation_take(struct speculation *spec, const size_t index,
+                            char *password) {
+  const struct account *account = &spec->accounts[index];
+  if (spec->num_threads == 0) {
+    // no threads to derive anything in the background
+    return derive_account_password(nullptr, spec->session, account, password);
+  }
+
+  speculation_focus(spec, index);
+
+  pthread_mutex_lock(&spec->mutex);
+  while (spec->states[index] != SPECULATION_DONE &&
+         spec->states[index] != SPECULATION_FAILED) {
+    pthread_cond_wait(&spec->changed, &spec->mutex);
+  }
+  const bool done = spec->states[index] == SPECULATION_DONE;
+  if (done) {
+    memcpy(password, spec->passwords[index], password_size(account));
+  }
+  pthread_mutex_unlock(&spec->mutex);
+
+  return done ? 0 : -1;
+}
+
+// Cancels the speculation and wipes all passwords derived by it.
+static void speculation_stop(struct speculation *spec) {
+  pthread_mutex_lock(&spec->mutex);
+  spec->stop = true;
+  pthread_cond_broadcast(&spec->changed);
+  pthread_mutex_unlock(&spec->mutex);
+
+  for (size_t i = 0; i < spec->num_threads; ++i) {
+    pthread_join(spec->threads[i], nullptr);
+  }
+  for (size_t i = 0; i < spec->num_accounts; ++i) {
+    if (spec->passwords[i] != nullptr) {
+      speculation__drop(spec, i);
+    }
+  }
+
+  free(spec->threads);
+  free(spec->passwords);
+  free(spec->states);
+  pthread_cond_destroy(&spec->changed);
+  pthread_mutex_destroy(&spec->mutex);
 }
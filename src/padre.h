@@ -17,6 +17,13 @@
 #ifndef PADRE_H_INCLUDED
 #define PADRE_H_INCLUDED
 
+// for `explicit_bzero()`, `MAP_ANONYMOUS`, `struct ucred` and friends
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
 #if __STDC_VERSION__ < 202300L
 #define nullptr ((void *)0)
 #endif
@@ -25,13 +32,60 @@
 // anyone that can memorize a longer password does not need this utility.
 #define MAX_MASTER_PASSWORD_LENGTH 64
 
-#define MAX_DATABASE_FILE_SIZE (1024 * 16)
+// The size of the largest database that is loaded, unless configured otherwise.
+#define DEFAULT_DATABASE_BUDGET ((size_t)256 * 1024 * 1024)
 #define AVERAGE_DATABASE_ENTRY_SIZE 60
 
+// The memory a derivation may take in `padre calibrate`, unless configured
+// otherwise.
+#define DEFAULT_CALIBRATE_MEMORY ((size_t)64 * 1024 * 1024)
+
+// The environment variable through which `padre` finds the agent.
+#define AGENT_SOCKET_ENV "PADRE_AUTH_SOCK"
+
 // These settings correspond with the defaults of the Python scrypt bindings.
 // ... for historical reasons ...
 #define MP_N 16384
 #define MP_r 8
 #define MP_p 1
 
+// The defaults of Argon2id, the second recommendation of RFC 9106: 64 MiB of
+// memory, 3 passes over it and 4 lanes.
+#define ARGON2ID_m 65536
+#define ARGON2ID_t 3
+#define ARGON2ID_p 4
+
+// The key derivation functions passwords can be derived with.  An account
+// keeps the one it was created with, so that its password does not change.
+enum kdf {
+  KDF_SCRYPT,   // scrypt (RFC 7914)
+  KDF_ARGON2ID, // Argon2id (RFC 9106)
+  NUM_KDFS
+};
+
+// The key derivation function of an account and its cost parameters.  An
+// account may lower or raise them, but takes scrypt with the ones above unless
+// it does.  The parameters of Argon2id are kept in those of scrypt.
+struct kdf_cost {
+  enum kdf kdf;
+  uint64_t N; // the CPU/memory cost, a power of 2; Argon2id: the memory in KiB
+  uint32_t r; // the block size; Argon2id: the number of passes
+  uint32_t p; // the parallelization; Argon2id: the number of lanes
+};
+
+#define DEFAULT_KDF_COST {KDF_SCRYPT, MP_N, MP_r, MP_p}
+#define DEFAULT_ARGON2ID_COST {KDF_ARGON2ID, ARGON2ID_m, ARGON2ID_t, ARGON2ID_p}
+
+// The schemes by which passwords are derived.  An account keeps the scheme it
+// was created with, so that its password does not change.
+enum scheme {
+  // scrypt derives one byte per character of the password, which is mapped to
+  // a character modulo the size of the character set
+  SCHEME_V1,
+  // scrypt derives a key, whose ChaCha20 keystream is mapped to characters
+  // without bias by rejection sampling
+  SCHEME_V2,
+  NUM_SCHEMES
+};
+
 #endif // PADRE_H_INCLUDED
@@ -0,0 +1,516 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// Microbenchmarks of the hot paths.  The results are written to the standard
+// output as a JSON document, with the distribution of the time per operation
+// in nanoseconds, so that runs of different releases can be compared.  Only
+// the groups of benchmarks named as arguments are run, or all of them if
+// there are none.
+
+#include "padre.c"
+#include "database.c"
+#include "search.c"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The number of samples taken of each benchmark.
+#define RUNS 15
+
+// The number of operations timed together in a sample of the benchmarks of
+// operations that take less than a microsecond.
+#define BATCH 1000
+
+static double bench__now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int bench__compare(const void *a, const void *b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Returns the `p`-th percentile of the sorted `samples` by the nearest rank.
+static double bench__percentile(const double samples[static RUNS],
+                                const size_t p) {
+  return samples[(p * RUNS + 99) / 100 - 1];
+}
+
+static int bench__argc;
+static char **bench__argv;
+static size_t bench__num_reported;
+
+// Returns whether the benchmarks of `group` are to be run, and tells so on the
+// standard error if they are.
+static bool bench__wanted(const char *group) {
+  bool wanted = bench__argc <= 1;
+  for (int i = 1; i < bench__argc && !wanted; ++i) {
+    wanted = strcmp(bench__argv[i], group) == 0;
+  }
+  if (wanted) {
+    fprintf(stderr, "running %s\n", group);
+  }
+  return wanted;
+}
+
+// Reports the time per operation of the benchmark `name` in `samples`.  If the
+// operation processes `items` items, their throughput is reported as well.
+static void bench__report(const char *name, double samples[static RUNS],
+                          const size_t items) {
+  qsort(samples, RUNS, sizeof samples[0], bench__compare);
+  printf("%s\n    {\"name\": \"%s\", \"unit\": \"ns\", \"runs\": %d, "
+         "\"min\": %.1f, \"median\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+         "\"max\": %.1f",
+         bench__num_reported > 0 ? "," : "", name, RUNS, samples[0],
+         bench__percentile(samples, 50), bench__percentile(samples, 90),
+         bench__percentile(samples, 99), samples[RUNS - 1]);
+  if (items > 0) {
+    printf(", \"items\": %zu, \"items_per_s\": %.1f", items,
+           (double)items * 1e9 / bench__percentile(samples, 50));
+  }
+  printf("}");
+  ++bench__num_reported;
+}
+
+// Compares the time per derivation with the scratch memory backed by the
+// different kinds of pages.
+static void bench_scrypt_pages(void) {
+  if (!bench__wanted("scrypt_kdf")) {
+    return;
+  }
+
+  for (enum scrypt_pages pages = SCRYPT_PAGES_NORMAL;
+       pages <= SCRYPT_PAGES_HUGETLB; ++pages) {
+    struct scrypt_ctx ctx;
+    if (scrypt_ctx_init_pages(&ctx, SCRYPT_LANES, MP_N, MP_r, MP_p, pages) !=
+            0 ||
+        ctx.pages != pages) {
+      fprintf(stderr, "  %s pages not available\n", scrypt_pages_names[pages]);
+      scrypt_ctx_free(&ctx);
+      continue;
+    }
+
+    uint8_t buf[64];
+    double single[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      const double start = bench__now_ns();
+      scrypt_kdf(&ctx, (const uint8_t *)"secret", 6,
+                 (const uint8_t *)"example.comuser0", 16, MP_N, MP_r, MP_p,
+                 buf, sizeof buf);
+      single[i] = bench__now_ns() - start;
+    }
+
+    struct scrypt_job jobs[SCRYPT_LANES];
+    uint8_t bufs[SCRYPT_LANES][64];
+    for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+      jobs[l] = (struct scrypt_job){
+          .passwd = (const uint8_t *)"secret",
+          .passwd_len = 6,
+          .salt = (const uint8_t *)"example.comuser0",
+          .salt_len = 16,
+          .buf = bufs[l],
+          .buf_len = sizeof bufs[l],
+      };
+    }
+    double lanes[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      const double start = bench__now_ns();
+      scrypt_kdf_lanes(&ctx, SCRYPT_LANES, jobs, MP_N, MP_r, MP_p);
+      lanes[i] = (bench__now_ns() - start) / SCRYPT_LANES;
+    }
+
+    char name[64];
+    snprintf(name, sizeof name, "scrypt_kdf/pages=%s",
+             scrypt_pages_names[pages]);
+    bench__report(name, single, 0);
+    snprintf(name, sizeof name, "scrypt_kdf_lanes/pages=%s",
+             scrypt_pages_names[pages]);
+    bench__report(name, lanes, 0);
+    scrypt_ctx_free(&ctx);
+  }
+}
+
+// Measures the latency of deriving a raw password of either scheme.
+static void bench_derive_password(void) {
+  if (!bench__wanted("derive_password")) {
+    return;
+  }
+
+  struct scrypt_ctx ctx;
+  if (scrypt_ctx_init(&ctx, 1, MP_N, MP_r, MP_p) != 0) {
+    perror("While allocating the scratch memory");
+    return;
+  }
+  struct session session;
+  session_init(&session, 6, "secret");
+
+  for (enum scheme scheme = SCHEME_V1; scheme < NUM_SCHEMES; ++scheme) {
+    char buf[32];
+    double samples[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      const double start = bench__now_ns();
+      derive_password(&ctx, &session, "example.com", "user", "0", scheme,
+                      (struct kdf_cost)DEFAULT_KDF_COST, sizeof buf, buf);
+      samples[i] = bench__now_ns() - start;
+    }
+    char name[64];
+    snprintf(name, sizeof name, "derive_password/v%d", (int)scheme + 1);
+    bench__report(name, samples, 0);
+  }
+
+  session_clear(&session);
+  scrypt_ctx_free(&ctx);
+}
+
+// Compares the latency of a derivation with scrypt at its default cost to that
+// of Argon2id at the same memory, with one pass and lane up to the default
+// passes and lanes.
+static void bench_kdf(void) {
+  if (!bench__wanted("kdf")) {
+    return;
+  }
+
+  static const struct kdf_cost costs[] = {
+      DEFAULT_KDF_COST,
+      {KDF_ARGON2ID, 128 * MP_N * MP_r / 1024, 1, 1},
+      {KDF_ARGON2ID, 128 * MP_N * MP_r / 1024, ARGON2ID_t, 1},
+      {KDF_ARGON2ID, 128 * MP_N * MP_r / 1024, ARGON2ID_t, ARGON2ID_p},
+  };
+  struct session session;
+  session_init(&session, 6, "secret");
+
+  for (size_t c = 0; c < sizeof costs / sizeof costs[0]; ++c) {
+    const struct kdf_cost *cost = &costs[c];
+    struct scrypt_ctx ctx;
+    const int ret =
+        cost->kdf == KDF_SCRYPT
+            ? scrypt_ctx_init(&ctx, 1, cost->N, cost->r, cost->p)
+            : scrypt_ctx_init_size(&ctx, argon2_memory_size(cost->N, cost->p));
+    if (ret != 0) {
+      perror("While allocating the scratch memory");
+      continue;
+    }
+
+    char buf[32];
+    double samples[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      const double start = bench__now_ns();
+      derive_password(&ctx, &session, "example.com", "user", "0", SCHEME_V2,
+                      *cost, sizeof buf, buf);
+      samples[i] = bench__now_ns() - start;
+    }
+    char name[96];
+    snprintf(name, sizeof name, "kdf/%s/%" PRIu64 ",%" PRIu32 ",%" PRIu32,
+             kdf_backends[cost->kdf].name, cost->N, cost->r, cost->p);
+    bench__report(name, samples, 0);
+    scrypt_ctx_free(&ctx);
+  }
+
+  session_clear(&session);
+}
+
+// Generates a database of `rows` accounts, a quarter of which are of scheme 2,
+// and stores its size in `size`.  The data is followed by a null byte.
+static char *bench__generate_database(const size_t rows, size_t *size) {
+  enum { MAX_ROW_SIZE = 96 };
+  char *data = malloc(rows * MAX_ROW_SIZE + 1);
+  if (data == nullptr) {
+    return nullptr;
+  }
+  size_t len = 0;
+  for (size_t i = 0; i < rows; ++i) {
+    len += (size_t)snprintf(
+        data + len, MAX_ROW_SIZE + 1,
+        "www.example-domain%zu.com,user%zu@example.org,%zu,16,\":alnum:\"%s\n",
+        i, i % 1000, i % 3, i % 4 == 3 ? ",2" : "");
+  }
+  *size = len;
+  return data;
+}
+
+// The sizes of the generated databases, in rows.
+static const size_t bench__database_rows[] = {1000, 10000, 100000, 1000000};
+
+// Measures the throughput of parsing databases of different sizes.
+static void bench_parse_accounts(void) {
+  if (!bench__wanted("parse_accounts")) {
+    return;
+  }
+
+  for (size_t s = 0;
+       s < sizeof bench__database_rows / sizeof bench__database_rows[0];
+       ++s) {
+    const size_t rows = bench__database_rows[s];
+    size_t size;
+    char *const original = bench__generate_database(rows, &size);
+    char *const data = malloc(size + 1);
+    if (original == nullptr || data == nullptr) {
+      perror("While generating the database");
+      free(original);
+      free(data);
+      return;
+    }
+
+    double samples[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      // the parser splits the data in place
+      memcpy(data, original, size + 1);
+      const double start = bench__now_ns();
+      struct account_list list = parse_accounts(data, data + size);
+      samples[i] = bench__now_ns() - start;
+      if (list.size != rows) {
+        fprintf(stderr, "  parsed %zu of %zu rows\n", list.size, rows);
+      }
+      free_account_list(&list);
+    }
+    char name[64];
+    snprintf(name, sizeof name, "parse_accounts/rows=%zu", rows);
+    bench__report(name, samples, rows);
+
+    free(data);
+    free(original);
+  }
+}
+
+// Measures the throughput of loading databases of different sizes from a
+// regular file, which is mapped, and from a stream, which is read.
+static void bench_database_load(void) {
+  if (!bench__wanted("database_load")) {
+    return;
+  }
+
+  for (size_t s = 0;
+       s < sizeof bench__database_rows / sizeof bench__database_rows[0];
+       ++s) {
+    const size_t rows = bench__database_rows[s];
+    size_t size;
+    char *const data = bench__generate_database(rows, &size);
+    char path[] = "/tmp/padre_bench_XXXXXX";
+    const int fd = data != nullptr ? mkstemp(path) : -1;
+    if (fd < 0 || write(fd, data, size) != (ssize_t)size) {
+      perror("While writing the database");
+      if (fd >= 0) {
+        close(fd);
+        unlink(path);
+      }
+      free(data);
+      return;
+    }
+    free(data);
+
+    double file[RUNS];
+    double stream[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      struct database db;
+      double start = bench__now_ns();
+      const int file_ret = database_load(&db, path, SIZE_MAX);
+      file[i] = bench__now_ns() - start;
+      if (file_ret == 0) {
+        database_free(&db);
+      }
+
+      lseek(fd, 0, SEEK_SET);
+      start = bench__now_ns();
+      const int stream_ret = database__read_stream(&db, fd, SIZE_MAX);
+      stream[i] = bench__now_ns() - start;
+      if (stream_ret == 0) {
+        database_free(&db);
+      }
+    }
+    char name[64];
+    snprintf(name, sizeof name, "database_load/file/rows=%zu", rows);
+    bench__report(name, file, rows);
+    snprintf(name, sizeof name, "database_load/stream/rows=%zu", rows);
+    bench__report(name, stream, rows);
+
+    close(fd);
+    unlink(path);
+  }
+}
+
+// Character specifications as they are found in databases, from short to
+// long.
+static const char *const bench__specs[] = {
+    ":digit:",
+    ":alnum:",
+    "*",
+    "a-zA-Z0-9!#$%&()*+,-./:;<=>?@[]^_{|}~",
+};
+
+// Measures the time to enumerate a character specification, which is looked
+// up in the cache, and to compile it for either scheme, which is not.
+static void bench_enumerate_charset(void) {
+  if (!bench__wanted("enumerate_charset")) {
+    return;
+  }
+
+  for (size_t s = 0; s < sizeof bench__specs / sizeof bench__specs[0]; ++s) {
+    const char *spec = bench__specs[s];
+    double samples[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      const double start = bench__now_ns();
+      for (size_t b = 0; b < BATCH; ++b) {
+        char *chars;
+        size_t len;
+        if (enumerate_charset(spec, &chars, &len) == 0) {
+          free(chars);
+        }
+      }
+      samples[i] = (bench__now_ns() - start) / BATCH;
+    }
+    char name[96];
+    snprintf(name, sizeof name, "enumerate_charset/%s", spec);
+    bench__report(name, samples, 0);
+
+    for (enum scheme scheme = SCHEME_V1; scheme < NUM_SCHEMES; ++scheme) {
+      for (size_t i = 0; i < RUNS; ++i) {
+        const double start = bench__now_ns();
+        for (size_t b = 0; b < BATCH; ++b) {
+          free(charset_compile(spec, scheme));
+        }
+        samples[i] = (bench__now_ns() - start) / BATCH;
+      }
+      snprintf(name, sizeof name, "charset_compile/v%d/%s", (int)scheme + 1,
+               spec);
+      bench__report(name, samples, 0);
+    }
+  }
+}
+
+// Measures the time to map the raw output of the KDF to characters, in either
+// scheme, for passwords of different lengths.
+static void bench_to_chars(void) {
+  if (!bench__wanted("to_chars")) {
+    return;
+  }
+
+  char *chars;
+  size_t clen;
+  const struct charset *set = charset_get("*", SCHEME_V2);
+  if (set == nullptr || enumerate_charset("*", &chars, &clen) != 0) {
+    perror("While enumerating the charset");
+    charset_put(set);
+    return;
+  }
+
+  uint8_t raw[64];
+  for (size_t i = 0; i < sizeof raw; ++i) {
+    raw[i] = (uint8_t)(i * 167 + 13);
+  }
+  static const size_t lengths[] = {16, 32, 64};
+  for (size_t l = 0; l < sizeof lengths / sizeof lengths[0]; ++l) {
+    const size_t len = lengths[l];
+    double samples[RUNS];
+    for (size_t i = 0; i < RUNS; ++i) {
+      uint8_t bytes[sizeof raw + 1];
+      const double start = bench__now_ns();
+      for (size_t b = 0; b < BATCH; ++b) {
+        memcpy(bytes, raw, len);
+        to_chars(bytes, len, chars, clen);
+      }
+      samples[i] = (bench__now_ns() - start) / BATCH;
+    }
+    char name[64];
+    snprintf(name, sizeof name, "to_chars/length=%zu", len);
+    bench__report(name, samples, 0);
+
+    for (size_t i = 0; i < RUNS; ++i) {
+      char password[sizeof raw * CHARSET_MAX_CHAR_SIZE + 1];
+      const double start = bench__now_ns();
+      for (size_t b = 0; b < BATCH; ++b) {
+        expand_chars(raw, password, len, set);
+      }
+      samples[i] = (bench__now_ns() - start) / BATCH;
+    }
+    snprintf(name, sizeof name, "expand_chars/length=%zu", len);
+    bench__report(name, samples, 0);
+  }
+
+  free(chars);
+  charset_put(set);
+}
+
+static void bench__search_fields(void *arg, const size_t index,
+                                 const char *fields[static SEARCH_FIELDS]) {
+  const char *(*items)[SEARCH_FIELDS] = arg;
+  fields[0] = items[index][0];
+  fields[1] = items[index][1];
+}
+
+// Measures the time per keystroke when searching the menu, for a query that
+// narrows the items down one character at a time.
+static void bench_search(void) {
+  if (!bench__wanted("search_push")) {
+    return;
+  }
+
+  enum { NUM_ITEMS = 100000 };
+  static char names[NUM_ITEMS][32];
+  static char users[NUM_ITEMS][32];
+  static const char *items[NUM_ITEMS][SEARCH_FIELDS];
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    snprintf(names[i], sizeof names[i], "www.example-domain%zu.com", i);
+    snprintf(users[i], sizeof users[i], "user%zu@example.org", i);
+    items[i][0] = names[i];
+    items[i][1] = users[i];
+  }
+
+  struct search search;
+  search_init(&search, NUM_ITEMS, bench__search_fields, items);
+  const char query[] = "exdom4242";
+  for (size_t i = 0; i < sizeof query - 1; ++i) {
+    double samples[RUNS];
+    for (size_t r = 0; r < RUNS; ++r) {
+      const double start = bench__now_ns();
+      search_push(&search, query[i]);
+      samples[r] = bench__now_ns() - start;
+      if (r + 1 < RUNS) {
+        search_pop(&search);
+      }
+    }
+    char name[64];
+    snprintf(name, sizeof name, "search_push/items=%d/%.*s", NUM_ITEMS,
+             (int)i + 1, query);
+    bench__report(name, samples, NUM_ITEMS);
+  }
+  search_free(&search);
+}
+
+int main(int argc, char *argv[]) {
+  bench__argc = argc;
+  bench__argv = argv;
+
+  printf("{\"benchmarks\": [");
+  bench_scrypt_pages();
+  bench_derive_password();
+  bench_kdf();
+  bench_parse_accounts();
+  bench_database_load();
+  bench_enumerate_charset();
+  bench_to_chars();
+  bench_search();
+  printf("\n]}\n");
+  return EXIT_SUCCESS;
+}
@@ -14,13 +14,20 @@
 //   limitations under the License.
 //
 
-#include "padre.c"
+#include "database.c"
+#include "libpadre.c" // includes padre.c
+#include "agent.c"    // depends on padre.c
+#include "padb.c"
+#include "search.c"
 
 #include <unity.h>
 
 void setUp(void) {}
 void tearDown(void) {}
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
@@ -44,7 +51,7 @@ void tearDown(void) {}
 
 static void test_to_pwdchars(char *str, const size_t len, char *chars,
                              const char *expected) {
-  to_pwdchars(str, len, chars, strlen(chars));
+  to_chars((uint8_t *)str, len, chars, strlen(chars));
   TEST_ASSERT_EQUAL_STRING(expected, str);
 }
 
@@ -65,6 +72,46 @@ static void tests_for_to_pwdchars(void) {
   free(chars);
 }
 
+static void tests_for_expand_chars(void) {
+  // RFC 8439, 2.4.2
+  uint8_t key[CHACHA20_KEY_SIZE];
+  for (size_t i = 0; i < sizeof key; ++i) {
+    key[i] = (uint8_t)i;
+  }
+  const uint8_t nonce[CHACHA20_NONCE_SIZE] = {0, 0, 0, 0, 0, 0, 0, 0x4a};
+  const uint8_t expected[] = {0x22, 0x4f, 0x51, 0xf3, 0x40, 0x1b, 0xd9, 0xe1,
+                              0x2f, 0xde, 0x27, 0x6f, 0xb8, 0x63, 0x1d, 0xed,
+                              0x8c, 0x13, 0x1f, 0x82, 0x3d, 0x2c, 0x06, 0xe2,
+                              0x7e, 0x4f, 0xca, 0xec, 0x9e, 0xf3, 0xcf, 0x78};
+  struct chacha20 stream;
+  chacha20_init(&stream, key, nonce, 1);
+  uint8_t keystream[sizeof expected];
+  chacha20_keystream(&stream, keystream, 5); // in pieces
+  chacha20_keystream(&stream, keystream + 5, sizeof keystream - 5);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, keystream, sizeof expected);
+
+  // longer passwords continue shorter ones
+  const struct charset *alnum = charset_get(ALNUM, SCHEME_V2);
+  char shorter[17];
+  char longer[1001];
+  expand_chars(key, shorter, 16, alnum);
+  expand_chars(key, longer, 1000, alnum);
+  TEST_ASSERT_EQUAL(16, strlen(shorter));
+  TEST_ASSERT_EQUAL_STRING_LEN(shorter, longer, 16);
+
+  // every character is about equally likely, where `to_chars()` would draw
+  // the first 256 % 3 characters more often
+  char password[30001];
+  size_t counts[3] = {0};
+  expand_chars(key, password, 30000, charset_get("abc", SCHEME_V2));
+  for (size_t i = 0; i < 30000; ++i) {
+    ++counts[password[i] - 'a'];
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    TEST_ASSERT_UINT_WITHIN(300, 10000, counts[i]);
+  }
+}
+
 static void test_enumerate_charset(char *class, const char *expected) {
   printf("\ttesting character spec `%s` ...\n", class);
 
@@ -109,14 +156,1060 @@ static void tests_for_enumerate_charset(void) {
   // test ranges
   test_enumerate_charset("a-z", "abcdefghijklmnopqrstuvwxyz");
 
-  // test for repetition - TODO find a way to fold redundant chars
-  //test_enumerate_charset("a-za-za-za-za-za-za-za-za-za-za-za-za-za-za-za-za-z",
-  //                       "abcdefghijklmnopqrstuvwxyz");
+  // repetitions are kept in scheme 1, see `tests_for_charset()`
+  test_enumerate_charset("a-ca-c", "abcabc");
+
+  // white space is ignored
+  test_enumerate_charset(" a-c\t", "abc");
+}
+
+static void test_charset(const char *spec, const size_t size,
+                         const uint32_t expected[static size]) {
+  printf("\ttesting compiled spec `%s` ...\n", spec);
+  const struct charset *set = charset_get(spec, SCHEME_V2);
+  TEST_ASSERT_NOT_NULL(set);
+  TEST_ASSERT_EQUAL(size, set->size);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(expected, set->chars, size);
+  charset_put(set);
+}
+
+static void tests_for_charset(void) {
+  // each character once, where it first appears
+  test_charset("a-za-za-za-za-za-za-za-za-za-za-za-za-za-za-za-za-z", 26,
+               (const uint32_t[]){'a', 'b', 'c', 'd', 'e', 'f', 'g',
+                                  'h', 'i', 'j', 'k', 'l', 'm', 'n',
+                                  'o', 'p', 'q', 'r', 's', 't', 'u',
+                                  'v', 'w', 'x', 'y', 'z'});
+  test_charset("cba-c", 3, (const uint32_t[]){'c', 'b', 'a'});
+
+  // UTF-8, also in ranges
+  test_charset("\u00f6\u00e4\u00fc\u20ac", 4,
+               (const uint32_t[]){0xf6, 0xe4, 0xfc, 0x20ac});
+  test_charset("\u03b1-\u03b3\U0001f600", 4,
+               (const uint32_t[]){0x3b1, 0x3b2, 0x3b3, 0x1f600});
+  errno = 0;
+  TEST_ASSERT_NULL(charset_get("a\xc3", SCHEME_V2));
+  TEST_ASSERT_EQUAL(EILSEQ, errno);
+  errno = 0;
+  TEST_ASSERT_NULL(charset_get(" ", SCHEME_V2));
+  TEST_ASSERT_EQUAL(EINVAL, errno);
+
+  // compiled once per spec and scheme
+  const struct charset *set = charset_get(":alnum:", SCHEME_V2);
+  TEST_ASSERT_EQUAL_PTR(set, charset_get(":alnum:", SCHEME_V2));
+  TEST_ASSERT_NOT_EQUAL(set, charset_get(":alnum:", SCHEME_V1));
+
+  // passwords of scheme 2 are UTF-8
+  uint8_t key[SCHEME_V2_KEY_SIZE] = {0};
+  const struct account account = {
+      "a", "b", "0", "\u00e4\u20ac", 8, nullptr, SCHEME_V2, DEFAULT_KDF_COST};
+  char password[8 * CHARSET_MAX_CHAR_SIZE + 1];
+  TEST_ASSERT_EQUAL(sizeof password, password_size(&account));
+  TEST_ASSERT_EQUAL(0, apply_charset(&account, key, password));
+  size_t num_chars = 0;
+  for (const char *c = password; *c != '\0'; ++c) {
+    num_chars += ((uint8_t)*c & 0xc0) != 0x80;
+  }
+  TEST_ASSERT_EQUAL(8, num_chars);
+}
+
+struct scrypt_test_vector {
+  const char *passwd;
+  const char *salt;
+  uint64_t N;
+  uint32_t r;
+  uint32_t p;
+  uint8_t expected[64];
+};
+
+// from RFC 7914, section 12
+static const struct scrypt_test_vector scrypt_test_vectors[] = {
+    {"",
+     "",
+     16,
+     1,
+     1,
+     {0x77, 0xd6, 0x57, 0x62, 0x38, 0x65, 0x7b, 0x20, 0x3b, 0x19, 0xca,
+      0x42, 0xc1, 0x8a, 0x04, 0x97, 0xf1, 0x6b, 0x48, 0x44, 0xe3, 0x07,
+      0x4a, 0xe8, 0xdf, 0xdf, 0xfa, 0x3f, 0xed, 0xe2, 0x14, 0x42, 0xfc,
+      0xd0, 0x06, 0x9d, 0xed, 0x09, 0x48, 0xf8, 0x32, 0x6a, 0x75, 0x3a,
+      0x0f, 0xc8, 0x1f, 0x17, 0xe8, 0xd3, 0xe0, 0xfb, 0x2e, 0x0d, 0x36,
+      0x28, 0xcf, 0x35, 0xe2, 0x0c, 0x38, 0xd1, 0x89, 0x06}},
+    {"password",
+     "NaCl",
+     1024,
+     8,
+     16,
+     {0xfd, 0xba, 0xbe, 0x1c, 0x9d, 0x34, 0x72, 0x00, 0x78, 0x56, 0xe7,
+      0x19, 0x0d, 0x01, 0xe9, 0xfe, 0x7c, 0x6a, 0xd7, 0xcb, 0xc8, 0x23,
+      0x78, 0x30, 0xe7, 0x73, 0x76, 0x63, 0x4b, 0x37, 0x31, 0x62, 0x2e,
+      0xaf, 0x30, 0xd9, 0x2e, 0x22, 0xa3, 0x88, 0x6f, 0xf1, 0x09, 0x27,
+      0x9d, 0x98, 0x30, 0xda, 0xc7, 0x27, 0xaf, 0xb9, 0x4a, 0x83, 0xee,
+      0x6d, 0x83, 0x60, 0xcb, 0xdf, 0xa2, 0xcc, 0x06, 0x40}},
+    {"pleaseletmein",
+     "SodiumChloride",
+     16384,
+     8,
+     1,
+     {0x70, 0x23, 0xbd, 0xcb, 0x3a, 0xfd, 0x73, 0x48, 0x46, 0x1c, 0x06,
+      0xcd, 0x81, 0xfd, 0x38, 0xeb, 0xfd, 0xa8, 0xfb, 0xba, 0x90, 0x4f,
+      0x8e, 0x3e, 0xa9, 0xb5, 0x43, 0xf6, 0x54, 0x5d, 0xa1, 0xf2, 0xd5,
+      0x43, 0x29, 0x55, 0x61, 0x3f, 0x0f, 0xcf, 0x62, 0xd4, 0x97, 0x05,
+      0x24, 0x2a, 0x9a, 0xf9, 0xe6, 0x1e, 0x85, 0xdc, 0x0d, 0x65, 0x1e,
+      0x40, 0xdf, 0xcf, 0x01, 0x7b, 0x45, 0x57, 0x58, 0x87}},
+};
+
+static void tests_for_scrypt_kdf(void) {
+  for (size_t k = 0; k < NUM_SCRYPT_KERNELS; ++k) {
+    const struct scrypt_kernel *kernel = &scrypt_kernels[k];
+    if (!scrypt_kernel_supported(kernel)) {
+      printf("\tskipping unsupported kernel `%s`\n", kernel->name);
+      continue;
+    }
+    printf("\ttesting kernel `%s` ...\n", kernel->name);
+
+    for (size_t i = 0; i < sizeof scrypt_test_vectors /
+                               sizeof scrypt_test_vectors[0];
+         ++i) {
+      const struct scrypt_test_vector *v = &scrypt_test_vectors[i];
+      uint8_t buf[64];
+      const int ret = scrypt_kdf_with(
+          kernel, nullptr, (const uint8_t *)v->passwd, strlen(v->passwd),
+          (const uint8_t *)v->salt, strlen(v->salt), v->N, v->r, v->p, buf,
+          sizeof buf);
+      TEST_ASSERT_EQUAL(0, ret);
+      TEST_ASSERT_EQUAL_HEX8_ARRAY(v->expected, buf, sizeof buf);
+    }
+  }
+
+  // the same with the password given as a keyed HMAC context
+  for (size_t i = 0; i < 2; ++i) {
+    const struct scrypt_test_vector *v = &scrypt_test_vectors[i];
+    struct hmac_sha256 prf;
+    hmac_sha256_init(&prf, v->passwd, strlen(v->passwd));
+    uint8_t buf[64];
+    const int ret =
+        scrypt_kdf_keyed(nullptr, &prf, (const uint8_t *)v->salt,
+                         strlen(v->salt), v->N, v->r, v->p, buf, sizeof buf);
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(v->expected, buf, sizeof buf);
+  }
+
+  // the instances of ROMix on several threads, as many as p or fewer, also
+  // such that some threads compute more instances than others
+  const struct scrypt_test_vector *v = &scrypt_test_vectors[1];
+  for (size_t threads = 2; threads <= v->p + 1; threads += 3) {
+    kdf_max_threads = threads;
+    struct scrypt_ctx ctx;
+    TEST_ASSERT_EQUAL(0, scrypt_ctx_init(&ctx, 1, v->N, v->r, v->p));
+    uint8_t buf[64];
+    const int ret =
+        scrypt_kdf(&ctx, (const uint8_t *)v->passwd, strlen(v->passwd),
+                   (const uint8_t *)v->salt, strlen(v->salt), v->N, v->r,
+                   v->p, buf, sizeof buf);
+    scrypt_ctx_free(&ctx);
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(v->expected, buf, sizeof buf);
+  }
+  kdf_max_threads = 0;
+
+  uint8_t buf[64];
+  errno = 0;
+  TEST_ASSERT_LESS_THAN(0, scrypt_kdf(nullptr, (const uint8_t *)"", 0,
+                                      (const uint8_t *)"", 0, 1000, 8, 1, buf,
+                                      sizeof buf));
+  TEST_ASSERT_EQUAL(EINVAL, errno);
+}
+
+static void tests_for_scrypt_kdf_lanes(void) {
+  for (size_t k = 0; k < NUM_SCRYPT_KERNELS; ++k) {
+    const struct scrypt_kernel *kernel = &scrypt_kernels[k];
+    if (!scrypt_kernel_supported(kernel) || kernel->romix_lanes == nullptr) {
+      continue;
+    }
+    printf("\ttesting kernel `%s` ...\n", kernel->name);
+
+    // more jobs than lanes, so that some lanes remain unused
+    for (size_t i = 1; i < sizeof scrypt_test_vectors /
+                               sizeof scrypt_test_vectors[0];
+         ++i) {
+      const struct scrypt_test_vector *v = &scrypt_test_vectors[i];
+      struct scrypt_job jobs[SCRYPT_LANES + 3];
+      uint8_t bufs[SCRYPT_LANES + 3][64];
+      for (size_t j = 0; j < SCRYPT_LANES + 3; ++j) {
+        jobs[j] = (struct scrypt_job){
+            (const uint8_t *)v->passwd, strlen(v->passwd),
+            (const uint8_t *)v->salt,   strlen(v->salt),
+            bufs[j],                    sizeof bufs[j],
+            nullptr,
+        };
+      }
+      const int ret = scrypt_kdf_lanes_with(
+          kernel, nullptr, SCRYPT_LANES + 3, jobs, v->N, v->r, v->p);
+      TEST_ASSERT_EQUAL(0, ret);
+      for (size_t j = 0; j < SCRYPT_LANES + 3; ++j) {
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(v->expected, bufs[j], sizeof bufs[j]);
+      }
+    }
+  }
+}
+
+static bool all_zero(const uint8_t *p, size_t len) {
+  for (; len > 0; --len, ++p) {
+    if (*p != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void tests_for_scrypt_ctx(void) {
+  const struct scrypt_test_vector *v = &scrypt_test_vectors[2];
+
+  struct scrypt_ctx ctx;
+  TEST_ASSERT_EQUAL(0, scrypt_ctx_init(&ctx, 1, v->N, v->r, v->p));
+  TEST_ASSERT_NOT_NULL(ctx.memory);
+
+  // the same context can be used over and over, and is wiped after each use
+  for (int i = 0; i < 3; ++i) {
+    uint8_t buf[64];
+    const int ret =
+        scrypt_kdf(&ctx, (const uint8_t *)v->passwd, strlen(v->passwd),
+                   (const uint8_t *)v->salt, strlen(v->salt), v->N, v->r,
+                   v->p, buf, sizeof buf);
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(v->expected, buf, sizeof buf);
+    TEST_ASSERT_TRUE(all_zero(ctx.memory, ctx.size));
+  }
+
+  // a context that is too small is not used
+  uint8_t buf[64];
+  TEST_ASSERT_EQUAL(0, scrypt_kdf(&ctx, (const uint8_t *)"", 0,
+                                  (const uint8_t *)"", 0, v->N * 2, v->r,
+                                  v->p, buf, sizeof buf));
+
+  scrypt_ctx_free(&ctx);
+  TEST_ASSERT_NULL(ctx.memory);
+}
+
+// The test vector of Argon2id from RFC 9106.
+static void tests_for_argon2id(void) {
+  uint8_t passwd[32];
+  uint8_t salt[16];
+  uint8_t secret[8];
+  uint8_t ad[12];
+  memset(passwd, 0x01, sizeof passwd);
+  memset(salt, 0x02, sizeof salt);
+  memset(secret, 0x03, sizeof secret);
+  memset(ad, 0x04, sizeof ad);
+  const uint8_t expected[32] = {
+      0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c, 0x08, 0xc0, 0x37,
+      0xa3, 0x4a, 0x8b, 0x53, 0xc9, 0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75,
+      0xb6, 0x5e, 0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59};
+
+  // the lanes on one thread and on threads of their own
+  for (size_t threads = 1; threads <= 4; threads += 3) {
+    uint8_t buf[32];
+    const int ret = argon2id_kdf_with(
+        nullptr, passwd, sizeof passwd, salt, sizeof salt, secret,
+        sizeof secret, ad, sizeof ad, 32, 3, 4, buf, sizeof buf, threads);
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buf, sizeof buf);
+  }
+
+  // the salt must be at least 8 bytes long
+  uint8_t buf[32];
+  errno = 0;
+  TEST_ASSERT_LESS_THAN(0, argon2id_kdf(nullptr, passwd, sizeof passwd, salt,
+                                        7, 32, 3, 4, buf, sizeof buf));
+  TEST_ASSERT_EQUAL(EINVAL, errno);
+}
+
+// Derived passwords must never change, so they are pinned down here.
+static void tests_for_derive_account_password(void) {
+  const struct account accounts[] = {
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V2, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V2, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 16, nullptr, SCHEME_V1, {KDF_SCRYPT, 1024, 8, 1}},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V2,
+       {KDF_SCRYPT, 1024, 4, 2}},
+      {"a", "b", "0", "*", 16, nullptr, SCHEME_V1, {KDF_ARGON2ID, 256, 2, 4}},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V2,
+       {KDF_ARGON2ID, 64, 1, 1}},
+  };
+  enum { NUM_ACCOUNTS = sizeof accounts / sizeof accounts[0] };
+  const char *expected[NUM_ACCOUNTS] = {
+      "5.SwMqX6eSLa>~IST@Z0DVXl[*-OY2C-",
+      "WazYZmQYXygCZoAQ",
+      "?TFrYdq,E}e'_p~3r07W(W\\WzRZoj:,\"",
+      "vw4ZtnnkPZ4cxo79",
+      "_X!^JF8PTSx[W`X$",
+      "a0m2PVOE0E4VOsh7",
+      "LlIz^V]l~G<d7]?Q",
+      "WEvuBclJcBTT6iEC",
+  };
+
+  struct session session;
+  session_init(&session, 6, "secret");
+
+  for (size_t i = 0; i < NUM_ACCOUNTS; ++i) {
+    char password[33];
+    const int ret =
+        derive_account_password(nullptr, &session, &accounts[i], password);
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL_STRING(expected[i], password);
+  }
+
+  char *passwords[NUM_ACCOUNTS];
+  const size_t failures =
+      derive_accounts(&session, NUM_ACCOUNTS, accounts, passwords, 0);
+  TEST_ASSERT_EQUAL(0, failures);
+  for (size_t i = 0; i < NUM_ACCOUNTS; ++i) {
+    TEST_ASSERT_EQUAL_STRING(expected[i], passwords[i]);
+    free(passwords[i]);
+  }
+
+  // same accounts again, but side by side in the lanes of the SIMD unit, as
+  // far as they share scrypt and its cost parameters
+  const size_t many_expected[] = {0, 2, 4, 4, 5, 6, 1, 3, 7, 0};
+  enum { NUM_MANY = sizeof many_expected / sizeof many_expected[0] };
+  struct account many[NUM_MANY];
+  char *lanes[NUM_MANY];
+  for (size_t i = 0; i < NUM_MANY; ++i) {
+    many[i] = accounts[many_expected[i]];
+    lanes[i] = malloc(many[i].length + 1);
+  }
+  TEST_ASSERT_EQUAL(
+      0, derive_account_passwords(nullptr, &session, NUM_MANY, many, lanes));
+  for (size_t i = 0; i < NUM_MANY; ++i) {
+    TEST_ASSERT_EQUAL_STRING(expected[many_expected[i]], lanes[i]);
+    free(lanes[i]);
+  }
+
+  // a batch within a memory limit, on a single thread, which has memory for
+  // the lanes of the SIMD unit or not
+  const size_t limits[] = {1,
+                           batch__scratch_size(NUM_MANY, many, SCRYPT_LANES)};
+  for (size_t l = 0; l < sizeof limits / sizeof limits[0]; ++l) {
+    TEST_ASSERT_EQUAL(
+        0, derive_accounts(&session, NUM_MANY, many, lanes, limits[l]));
+    for (size_t i = 0; i < NUM_MANY; ++i) {
+      TEST_ASSERT_EQUAL_STRING(expected[many_expected[i]], lanes[i]);
+      free(lanes[i]);
+    }
+  }
+
+  session_clear(&session);
+}
+
+static const struct libpadre_test_account {
+  const char *domain;
+  const char *username;
+  const char *iteration;
+  const char *spec;
+  size_t length;
+  enum padre_scheme scheme;
+  struct padre_cost cost;
+  const char *expected;
+} libpadre_test_accounts[] = {
+    {"a", "b", "0", "*", 32, PADRE_SCHEME_V1, PADRE_DEFAULT_COST,
+     "5.SwMqX6eSLa>~IST@Z0DVXl[*-OY2C-"},
+    {"c", "d", "1", ":alnum:", 16, PADRE_SCHEME_V2, PADRE_DEFAULT_COST,
+     "vw4ZtnnkPZ4cxo79"},
+    {"c", "d", "1", ":alnum:", 16, PADRE_SCHEME_V2,
+     {PADRE_KDF_SCRYPT, 1024, 4, 2}, "a0m2PVOE0E4VOsh7"},
+    {"a", "b", "0", "*", 16, PADRE_SCHEME_V1, {PADRE_KDF_ARGON2ID, 256, 2, 4},
+     "LlIz^V]l~G<d7]?Q"},
+};
+
+#define NUM_LIBPADRE_TEST_ACCOUNTS                                             \
+  (sizeof libpadre_test_accounts / sizeof libpadre_test_accounts[0])
+
+static struct padre_account
+libpadre_test_account(const struct libpadre_test_account *a,
+                      const struct padre_charset *charset) {
+  return (struct padre_account){
+      a->domain,    strlen(a->domain),    a->username, strlen(a->username),
+      a->iteration, strlen(a->iteration), charset,     a->length,
+      a->cost,
+  };
+}
+
+// The library derives the same passwords, without allocating anything.
+static void tests_for_libpadre(void) {
+  const struct libpadre_test_account *accounts = libpadre_test_accounts;
+
+  struct padre_session *session;
+  TEST_ASSERT_EQUAL(PADRE_OK, padre_session_new(&session, "secret", 6));
+  size_t size;
+  const struct padre_cost cost = PADRE_DEFAULT_COST;
+  TEST_ASSERT_EQUAL(PADRE_OK, padre_cost_memory(&cost, &size));
+  struct padre_ctx *ctx;
+  TEST_ASSERT_EQUAL(PADRE_OK, padre_ctx_new(&ctx, size));
+
+  for (size_t i = 0; i < NUM_LIBPADRE_TEST_ACCOUNTS; ++i) {
+    struct padre_charset *charset;
+    TEST_ASSERT_EQUAL(PADRE_OK, padre_charset_new(&charset, accounts[i].spec,
+                                                  accounts[i].scheme));
+    const struct padre_account account =
+        libpadre_test_account(&accounts[i], charset);
+    char password[4 * 32 + 1];
+    TEST_ASSERT_EQUAL(PADRE_OK, padre_derive(ctx, session, &account, password,
+                                             sizeof password));
+    TEST_ASSERT_EQUAL_STRING(accounts[i].expected, password);
+    TEST_ASSERT_TRUE(all_zero(ctx->scratch.memory, ctx->scratch.size));
+
+    // the password must fit
+    TEST_ASSERT_EQUAL(PADRE_ERR_RANGE,
+                      padre_derive(ctx, session, &account, password,
+                                   padre_password_size(&account) - 1));
+    padre_charset_free(charset);
+  }
+
+  // nothing is allocated for a derivation that does not fit into the context
+  struct padre_charset *charset;
+  TEST_ASSERT_EQUAL(PADRE_OK,
+                    padre_charset_new(&charset, "*", PADRE_SCHEME_V1));
+  struct padre_account account = {
+      "a", 1, "b", 1, "0", 1, charset, 16, {PADRE_KDF_SCRYPT, 32768, 8, 1}};
+  char password[17];
+  TEST_ASSERT_EQUAL(PADRE_ERR_CONTEXT,
+                    padre_derive(ctx, session, &account, password,
+                                 sizeof password));
+  account.cost.N = 1000;
+  TEST_ASSERT_EQUAL(PADRE_ERR_COST, padre_derive(ctx, session, &account,
+                                                 password, sizeof password));
+  padre_charset_free(charset);
+
+  TEST_ASSERT_EQUAL(PADRE_ERR_CHARSET,
+                    padre_charset_new(&charset, "\xff", PADRE_SCHEME_V2));
+  TEST_ASSERT_NULL(charset);
+  TEST_ASSERT_EQUAL_STRING("invalid characters",
+                           padre_strerror(PADRE_ERR_CHARSET));
+
+  padre_ctx_free(ctx);
+  padre_session_free(session);
+}
+
+struct libpadre_test_progress {
+  size_t calls;
+  bool counted; // whether `done` counted the calls so far
+  size_t total;
+  size_t cancel_at; // the number of items done at which to cancel; or 0
+};
+
+// Called from the threads of the batch, where nothing may be asserted.
+static int libpadre_test_progress(void *arg, const size_t done,
+                                  const size_t total) {
+  struct libpadre_test_progress *progress = arg;
+  ++progress->calls;
+  progress->counted = progress->counted && done == progress->calls;
+  progress->total = total;
+  return done == progress->cancel_at;
+}
+
+static void tests_for_libpadre_batch(void) {
+  enum { NUM_ITEMS = 2 * NUM_LIBPADRE_TEST_ACCOUNTS + 1 };
+  struct padre_session *session;
+  TEST_ASSERT_EQUAL(PADRE_OK, padre_session_new(&session, "secret", 6));
+  struct padre_charset *charsets[NUM_LIBPADRE_TEST_ACCOUNTS];
+  struct padre_batch_item items[NUM_ITEMS];
+  char passwords[NUM_ITEMS][4 * 32 + 1];
+  for (size_t i = 0; i < NUM_ITEMS; ++i) {
+    const size_t a = i % NUM_LIBPADRE_TEST_ACCOUNTS;
+    if (i < NUM_LIBPADRE_TEST_ACCOUNTS) {
+      TEST_ASSERT_EQUAL(PADRE_OK,
+                        padre_charset_new(&charsets[a],
+                                          libpadre_test_accounts[a].spec,
+                                          libpadre_test_accounts[a].scheme));
+    }
+    items[i] = (struct padre_batch_item){
+        libpadre_test_account(&libpadre_test_accounts[a], charsets[a]),
+        passwords[i], sizeof passwords[i], -1};
+  }
+  // the last one fails, the others are derived nonetheless
+  items[NUM_ITEMS - 1].account.cost.N = 1000;
+
+  size_t size;
+  const struct padre_cost cost = PADRE_DEFAULT_COST;
+  TEST_ASSERT_EQUAL(PADRE_OK, padre_cost_memory(&cost, &size));
+  struct libpadre_test_progress progress = {0, true, 0, 0};
+  struct padre_batch_options options = {3, 2 * size, libpadre_test_progress,
+                                        &progress};
+  TEST_ASSERT_EQUAL(PADRE_ERR_BATCH,
+                    padre_derive_batch(session, NUM_ITEMS, items, &options));
+  for (size_t i = 0; i < NUM_ITEMS - 1; ++i) {
+    TEST_ASSERT_EQUAL(PADRE_OK, items[i].error);
+    TEST_ASSERT_EQUAL_STRING(
+        libpadre_test_accounts[i % NUM_LIBPADRE_TEST_ACCOUNTS].expected,
+        passwords[i]);
+  }
+  TEST_ASSERT_EQUAL(PADRE_ERR_COST, items[NUM_ITEMS - 1].error);
+  TEST_ASSERT_EQUAL(NUM_ITEMS, progress.calls);
+  TEST_ASSERT_TRUE(progress.counted);
+  TEST_ASSERT_EQUAL(NUM_ITEMS, progress.total);
+
+  // on a single thread, the items after the cancellation are left alone
+  progress = (struct libpadre_test_progress){0, true, 0, 2};
+  options.threads = 1;
+  TEST_ASSERT_EQUAL(PADRE_ERR_CANCELED,
+                    padre_derive_batch(session, NUM_ITEMS, items, &options));
+  TEST_ASSERT_EQUAL(2, progress.calls);
+  TEST_ASSERT_EQUAL(PADRE_OK, items[1].error);
+  TEST_ASSERT_EQUAL(PADRE_ERR_CANCELED, items[2].error);
+
+  // not even one context fits into the memory
+  options.memory = size - 1;
+  const int ret = padre_derive_batch(session, NUM_ITEMS - 1, items, &options);
+  TEST_ASSERT_EQUAL(PADRE_ERR_CONTEXT, ret);
+  TEST_ASSERT_EQUAL(PADRE_ERR_CONTEXT, items[0].error);
+
+  for (size_t a = 0; a < NUM_LIBPADRE_TEST_ACCOUNTS; ++a) {
+    padre_charset_free(charsets[a]);
+  }
+  padre_session_free(session);
+}
+
+static void tests_for_speculation(void) {
+  const struct account accounts[] = {
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+  };
+  const size_t num_accounts = sizeof accounts / sizeof accounts[0];
+
+  struct session session;
+  session_init(&session, 6, "secret");
+
+  struct speculation spec;
+  TEST_ASSERT_EQUAL(0, speculation_start(&spec, &session, num_accounts,
+                                         accounts, 0));
+
+  // jumping around, so that results are dropped and derived again
+  speculation_focus(&spec, num_accounts - 1);
+  speculation_focus(&spec, 0);
+
+  char password[33];
+  TEST_ASSERT_EQUAL(0, speculation_take(&spec, 1, password));
+  TEST_ASSERT_EQUAL_STRING("WazYZmQYXygCZoAQ", password);
+  TEST_ASSERT_EQUAL(0, speculation_take(&spec, num_accounts - 2, password));
+  TEST_ASSERT_EQUAL_STRING("5.SwMqX6eSLa>~IST@Z0DVXl[*-OY2C-", password);
+
+  // nothing far away from the focus is kept
+  pthread_mutex_lock(&spec.mutex);
+  for (size_t i = 0; i < num_accounts - 2 - SPECULATION_RADIUS; ++i) {
+    TEST_ASSERT_NULL(spec.passwords[i]);
+  }
+  pthread_mutex_unlock(&spec.mutex);
+
+  speculation_stop(&spec);
+  session_clear(&session);
+}
+
+// Writes `size` bytes of fake database to a temporary file, whose path is
+// stored in `path`.
+static void write_database(char path[static 32], const size_t size) {
+  strcpy(path, "/tmp/padre_test_XXXXXX");
+  const int fd = mkstemp(path);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, fd);
+  for (size_t i = 0; i < size; ++i) {
+    const char c = i % 16 == 15 ? '\n' : (char)('a' + i % 16);
+    TEST_ASSERT_EQUAL(1, write(fd, &c, 1));
+  }
+  close(fd);
+}
+
+static void tests_for_database_load(void) {
+  const size_t page_size = database__page_size();
+  char path[32];
+
+  // a file that fills its pages exactly and does not end with a newline
+  write_database(path, page_size);
+  struct database db;
+  TEST_ASSERT_EQUAL(0, database_load(&db, path, DEFAULT_DATABASE_BUDGET));
+  TEST_ASSERT_EQUAL(page_size, db.size);
+  TEST_ASSERT_EQUAL('\0', db.data[db.size]);
+  TEST_ASSERT_EQUAL_STRING_LEN("abcdefghijklmno\n", db.data, 16);
+  // the mapping is private, so that it may be parsed in place
+  db.data[0] = ',';
+  database_free(&db);
+
+  errno = 0;
+  TEST_ASSERT_EQUAL(-1, database_load(&db, path, page_size - 1));
+  TEST_ASSERT_EQUAL(EFBIG, errno);
+  unlink(path);
+
+  // streams are read in chunks, which requires the mapping to grow
+  write_database(path, 5 * DATABASE_STREAM_CHUNK_SIZE / 2);
+  int fd = open(path, O_RDONLY);
+  TEST_ASSERT_EQUAL(0, database__read_stream(&db, fd, DEFAULT_DATABASE_BUDGET));
+  close(fd);
+  TEST_ASSERT_EQUAL(5 * DATABASE_STREAM_CHUNK_SIZE / 2, db.size);
+  TEST_ASSERT_EQUAL('\0', db.data[db.size]);
+  for (size_t i = 0; i < db.size; ++i) {
+    TEST_ASSERT_EQUAL(i % 16 == 15 ? '\n' : (char)('a' + i % 16), db.data[i]);
+  }
+  database_free(&db);
+
+  fd = open(path, O_RDONLY);
+  errno = 0;
+  TEST_ASSERT_EQUAL(-1, database__read_stream(&db, fd, 1000));
+  TEST_ASSERT_EQUAL(EFBIG, errno);
+  close(fd);
+  unlink(path);
+
+  errno = 0;
+  TEST_ASSERT_EQUAL(-1, database_load(&db, "/no/such/file", 1000));
+  TEST_ASSERT_EQUAL(ENOENT, errno);
+}
+
+// Parses a copy of `csv`, which stays allocated in `*data` for the accounts.
+static struct account_list test_parse_accounts(const char *csv, char **data) {
+  const size_t len = strlen(csv);
+  *data = malloc(len + 1);
+  memcpy(*data, csv, len + 1);
+  return parse_accounts(*data, *data + len);
+}
+
+static void test_account(const struct account *account, const char *domain,
+                         const char *username, const char *iteration,
+                         const size_t length, const char *characters) {
+  TEST_ASSERT_EQUAL_STRING(domain, account->domain);
+  TEST_ASSERT_EQUAL_STRING(username, account->username);
+  TEST_ASSERT_EQUAL_STRING(iteration, account->iteration);
+  TEST_ASSERT_EQUAL(length, account->length);
+  TEST_ASSERT_EQUAL_STRING(characters, account->characters);
+}
+
+static void tests_for_parse_accounts(void) {
+  char *data;
+
+  // the legacy format, where the characters extend to the end of the line
+  struct account_list list = test_parse_accounts(
+      "a,b,0,32,*\nc,d,1,16,:alnum:\ne,f,2,8,a-z,\"\n", &data);
+  TEST_ASSERT_EQUAL(3, list.size);
+  test_account(&list.accounts[0], "a", "b", "0", 32, "*");
+  test_account(&list.accounts[1], "c", "d", "1", 16, ":alnum:");
+  test_account(&list.accounts[2], "e", "f", "2", 8, "a-z,\"");
+  free_account_list(&list);
+  free(data);
+
+  // quoted fields, which may contain commas, quotes and newlines; quoted
+  // characters may be followed by the scheme
+  list = test_parse_accounts("\"x,y\",\"say \"\"hi\"\"\",0,8,\"a-z\",2\r\n"
+                             "\"multi\nline\",b,\"\",4,\",\"\r\n",
+                             &data);
+  TEST_ASSERT_EQUAL(2, list.size);
+  test_account(&list.accounts[0], "x,y", "say \"hi\"", "0", 8, "a-z");
+  test_account(&list.accounts[1], "multi\nline", "b", "", 4, ",");
+  TEST_ASSERT_EQUAL(SCHEME_V2, list.accounts[0].scheme);
+  TEST_ASSERT_EQUAL(SCHEME_V1, list.accounts[1].scheme);
+  free_account_list(&list);
+  free(data);
+
+  // the scheme may be followed by the cost parameters and the KDF, which keep
+  // the defaults of the KDF if they are empty or missing
+  list = test_parse_accounts("a,b,0,8,\"*\",,1024,4,2\n"
+                             "c,d,0,8,\"*\",2,,16\n"
+                             "e,f,0,8,\"*\",1,1024\n"
+                             "g,h,0,8,\"*\"\n"
+                             "i,j,0,8,\"*\",,,,,argon2id\n"
+                             "k,l,0,8,\"*\",2,1024,,1,argon2id\n"
+                             "m,n,0,8,\"*\",,,,,scrypt\n",
+                             &data);
+  TEST_ASSERT_EQUAL(7, list.size);
+  const struct kdf_cost costs[] = {
+      {KDF_SCRYPT, 1024, 4, 2},
+      {KDF_SCRYPT, MP_N, 16, MP_p},
+      {KDF_SCRYPT, 1024, MP_r, MP_p},
+      DEFAULT_KDF_COST,
+      DEFAULT_ARGON2ID_COST,
+      {KDF_ARGON2ID, 1024, ARGON2ID_t, 1},
+      DEFAULT_KDF_COST};
+  for (size_t i = 0; i < list.size; ++i) {
+    TEST_ASSERT_TRUE(kdf_cost_equal(&costs[i], &list.accounts[i].cost));
+  }
+  TEST_ASSERT_EQUAL(SCHEME_V2, list.accounts[1].scheme);
+  free_account_list(&list);
+  free(data);
+
+  // empty lines are skipped, malformed records too
+  list = test_parse_accounts("\n\r\na,b\n\"x\"y,b,0,8,*\nc,d,0,8,*\n\n"
+                             "e,f,0,8,\"*\",3\n"
+                             "g,h,0,8,\"*\",1,1000\ni,j,0,8,\"*\",1,,0\n"
+                             "k,l,0,8,\"*\",1,-2\nm,n,0,8,\"*\",1,2,1,1,,1\n"
+                             "o,p,0,8,\"*\",1,,,,bcrypt\n"
+                             "q,r,0,8,\"*\",1,8,1,2,argon2id\n"
+                             "\"open,d,0,8,*\n",
+                             &data);
+  TEST_ASSERT_EQUAL(1, list.size);
+  test_account(&list.accounts[0], "c", "d", "0", 8, "*");
+  free_account_list(&list);
+  free(data);
+
+  // records span the blocks the scanner works on
+  char csv[1024] = "";
+  for (size_t i = 0; i < 10; ++i) {
+    snprintf(csv + strlen(csv), sizeof csv - strlen(csv),
+             "\"%.*s,\",user%zu,0,%zu,*\n", (int)(7 * i + 40),
+             "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghij"
+             "klmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqr",
+             i, i + 1);
+  }
+  list = test_parse_accounts(csv, &data);
+  TEST_ASSERT_EQUAL(10, list.size);
+  for (size_t i = 0; i < list.size; ++i) {
+    TEST_ASSERT_EQUAL(7 * i + 41, strlen(list.accounts[i].domain));
+    TEST_ASSERT_EQUAL(',', list.accounts[i].domain[7 * i + 40]);
+    TEST_ASSERT_EQUAL(i + 1, list.accounts[i].length);
+  }
+  free_account_list(&list);
+  free(data);
+
+  // a length of zero spoils the whole database
+  list = test_parse_accounts("a,b,0,8,*\nc,d,0,0,*\n", &data);
+  TEST_ASSERT_EQUAL(0, list.size);
+  free(data);
+}
+
+static void tests_for_agent_request(void) {
+  const struct account accounts[] = {
+      {"a,\"b\"\nc", "u", "1", "\"abc\"", 16, nullptr, SCHEME_V1,
+       DEFAULT_KDF_COST},
+      {"x,y", "v\nw", "", ",", 8, nullptr, SCHEME_V2,
+       {KDF_ARGON2ID, 64, 1, 1}},
+  };
+  int fds[2];
+  TEST_ASSERT_EQUAL(0, pipe(fds));
+  for (size_t i = 0; i < sizeof accounts / sizeof accounts[0]; ++i) {
+    TEST_ASSERT_EQUAL(0, agent__request(fds[1], &accounts[i]));
+  }
+  close(fds[1]);
+  char request[2 * AGENT_MAX_LINE];
+  const ssize_t len = read(fds[0], request, sizeof request - 1);
+  close(fds[0]);
+  TEST_ASSERT_GREATER_THAN(0, len);
+  request[len] = '\0';
+
+  // the line breaks in quoted fields don't end the request
+  const char *end = agent__request_end(request, (size_t)len);
+  TEST_ASSERT_NOT_NULL(end);
+  TEST_ASSERT_EQUAL_PTR(strstr(request, "\"x,y\""), end + 1);
+
+  // the agent reads the same accounts
+  struct account_list list = parse_accounts(request, request + len);
+  TEST_ASSERT_EQUAL(2, list.size);
+  for (size_t i = 0; i < list.size; ++i) {
+    test_account(&list.accounts[i], accounts[i].domain, accounts[i].username,
+                 accounts[i].iteration, accounts[i].length,
+                 accounts[i].characters);
+    TEST_ASSERT_EQUAL(accounts[i].scheme, list.accounts[i].scheme);
+    TEST_ASSERT_TRUE(kdf_cost_equal(&accounts[i].cost, &list.accounts[i].cost));
+  }
+  free_account_list(&list);
+}
+
+static void tests_for_csv_reader(void) {
+  char data[] = "a,b\n\"c\"d,e\n\"f";
+  struct csv_reader reader;
+  csv_init(&reader, data, data + strlen(data));
+
+  char *fields[2];
+  size_t num_fields;
+  TEST_ASSERT_EQUAL(1, csv_read_record(&reader, 2, 2, fields, &num_fields));
+  TEST_ASSERT_EQUAL(2, num_fields);
+  TEST_ASSERT_EQUAL(-1, csv_read_record(&reader, 2, 2, fields, &num_fields));
+  TEST_ASSERT_EQUAL(2, reader.error_line);
+  TEST_ASSERT_EQUAL(4, reader.error_column);
+  TEST_ASSERT_EQUAL(-1, csv_read_record(&reader, 2, 2, fields, &num_fields));
+  TEST_ASSERT_EQUAL(3, reader.error_line);
+  TEST_ASSERT_EQUAL(1, reader.error_column);
+  TEST_ASSERT_EQUAL(0, csv_read_record(&reader, 2, 2, fields, &num_fields));
+
+  // all kernels must find the same characters
+  char block[CSV_BLOCK_SIZE];
+  srand(1);
+  for (size_t i = 0; i < 1000; ++i) {
+    for (size_t j = 0; j < sizeof block; ++j) {
+      block[j] = ",\n\"a\x80"[rand() % 5];
+    }
+    const uint64_t expected = csv__mask_generic(block);
+    for (size_t k = 0; k < NUM_CSV_KERNELS; ++k) {
+      if (csv_kernel_supported(&csv_kernels[k])) {
+        TEST_ASSERT_EQUAL_UINT64(expected, csv_kernels[k].mask(block));
+      }
+    }
+  }
+}
+
+static void tests_for_padb(void) {
+  const struct account accounts[] = {
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "1", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"b", "a", "0", "a-", 8, nullptr, SCHEME_V2, {KDF_SCRYPT, 1024, 4, 2}},
+      {"a", "a", "0", ":alnum:", 4, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"e", "f", "0", "a-", 8, nullptr, SCHEME_V1, {KDF_ARGON2ID, 100, 2, 3}},
+  };
+  const size_t num_accounts = sizeof accounts / sizeof accounts[0];
+  struct account_list list = new_account_list(num_accounts);
+  for (size_t i = 0; i < num_accounts; ++i) {
+    push_account(&list, accounts[i]);
+  }
+
+  char *data;
+  size_t size;
+  FILE *out = open_memstream(&data, &size);
+  TEST_ASSERT_EQUAL(0, padb_compile(&list, out));
+  fclose(out);
+  free_account_list(&list);
+
+  TEST_ASSERT_TRUE(padb_is_compiled(data, size));
+  struct padb db;
+  TEST_ASSERT_EQUAL(0, padb_open(&db, data, size));
+  TEST_ASSERT_EQUAL(num_accounts, db.num_accounts);
+
+  // sorted by domain, username and iteration
+  const size_t order[] = {4, 2, 1, 3, 0, 5};
+  for (size_t i = 0; i < num_accounts; ++i) {
+    const struct account *expected = &accounts[order[i]];
+    struct account account;
+    TEST_ASSERT_EQUAL(0, padb_account(&db, i, &account));
+    TEST_ASSERT_EQUAL_STRING(expected->domain, account.domain);
+    TEST_ASSERT_EQUAL_STRING(expected->username, account.username);
+    TEST_ASSERT_EQUAL_STRING(expected->iteration, account.iteration);
+    TEST_ASSERT_EQUAL_STRING(expected->characters, account.characters);
+    TEST_ASSERT_EQUAL(expected->length, account.length);
+    TEST_ASSERT_EQUAL(expected->scheme, account.scheme);
+    TEST_ASSERT_TRUE(kdf_cost_equal(&expected->cost, &account.cost));
+
+    char *chars;
+    size_t len;
+    TEST_ASSERT_EQUAL(0, enumerate_charset(account.characters, &chars, &len));
+    TEST_ASSERT_EQUAL_STRING(chars, account.charset);
+    free(chars);
+  }
+
+  // equal strings are stored once
+  struct account first;
+  struct account second;
+  padb_account(&db, 1, &first);
+  padb_account(&db, 2, &second);
+  TEST_ASSERT_EQUAL_PTR(first.domain, second.domain);
+  TEST_ASSERT_EQUAL_PTR(first.charset, second.charset);
+
+  TEST_ASSERT_EQUAL(0, padb_find(&db, "a", nullptr));
+  TEST_ASSERT_EQUAL(1, padb_find(&db, "a", "b"));
+  TEST_ASSERT_EQUAL(3, padb_find(&db, "b", "a"));
+  TEST_ASSERT_EQUAL(num_accounts, padb_find(&db, "b", "b"));
+  TEST_ASSERT_EQUAL(num_accounts, padb_find(&db, "d", nullptr));
+  TEST_ASSERT_EQUAL(3, padb_lower_bound(&db, "aa", nullptr));
+
+  // the compiled charset yields the same password
+  struct session session;
+  session_init(&session, 6, "secret");
+  char password[33];
+  TEST_ASSERT_EQUAL(
+      0, derive_account_password(nullptr, &session, &first, password));
+  TEST_ASSERT_EQUAL_STRING("5.SwMqX6eSLa>~IST@Z0DVXl[*-OY2C-", password);
+  session_clear(&session);
+
+  // a truncated database is rejected
+  errno = 0;
+  TEST_ASSERT_EQUAL(-1, padb_open(&db, data, size - 1));
+  TEST_ASSERT_EQUAL(EINVAL, errno);
+  free(data);
+}
+
+static void tests_for_find_accounts(void) {
+  char key_str[] = "a::1";
+  struct account_key key = parse_account_key(key_str);
+  TEST_ASSERT_EQUAL_STRING("a", key.domain);
+  TEST_ASSERT_NULL(key.username);
+  TEST_ASSERT_EQUAL_STRING("1", key.iteration);
+
+  char *data;
+  struct account_list list = test_parse_accounts(
+      "example.com,alice,0,8,*\nexample.com,bob,0,8,*\n"
+      "example.com,bob,1,8,*\nexample.org,carol,0,8,*\nother,dave,0,8,*\n",
+      &data);
+
+  char *compiled;
+  size_t size;
+  FILE *out = open_memstream(&compiled, &size);
+  TEST_ASSERT_EQUAL(0, padb_compile(&list, out));
+  fclose(out);
+  struct padb db;
+  TEST_ASSERT_EQUAL(0, padb_open(&db, compiled, size));
+
+  const struct {
+    const char *domain;
+    const char *username;
+    const char *iteration;
+    size_t exact;  // the number of exact matches
+    size_t prefix; // the number of matches by prefix
+  } cases[] = {
+      {"example.com", "alice", nullptr, 1, 1},
+      {"example.com", "bob", nullptr, 2, 2},
+      {"example.com", "bob", "1", 1, 1},
+      {"example.com", nullptr, "0", 2, 2},
+      {"example.", nullptr, nullptr, 0, 4},
+      {"example", "c", nullptr, 0, 1},
+      {"other", "dave", "2", 0, 0},
+      {"nothing", nullptr, nullptr, 0, 0},
+  };
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; ++i) {
+    key = (struct account_key){cases[i].domain, cases[i].username,
+                               cases[i].iteration};
+    struct account_matches matches = {0};
+    find_accounts(&list, &key, &matches);
+    TEST_ASSERT_EQUAL(cases[i].exact > 0 ? cases[i].exact : cases[i].prefix,
+                      matches.size);
+    for (size_t j = 0; j < matches.size; ++j) {
+      TEST_ASSERT_TRUE(
+          account_matches(&matches.accounts[j], &key, cases[i].exact == 0));
+    }
+
+    matches.size = 0;
+    padb_find_accounts(&db, &key, false, &matches);
+    TEST_ASSERT_EQUAL(cases[i].exact, matches.size);
+    matches.size = 0;
+    padb_find_accounts(&db, &key, true, &matches);
+    TEST_ASSERT_EQUAL(cases[i].prefix, matches.size);
+    for (size_t j = 0; j < matches.size; ++j) {
+      TEST_ASSERT_TRUE(account_matches(&matches.accounts[j], &key, true));
+    }
+  }
+
+  free(compiled);
+  free_account_list(&list);
+  free(data);
+}
+
+static void test_search_fields(void *arg, const size_t index,
+                               const char *fields[static SEARCH_FIELDS]) {
+  const char *(*items)[SEARCH_FIELDS] = arg;
+  fields[0] = items[index][0];
+  fields[1] = items[index][1];
+}
+
+static void tests_for_search(void) {
+  const char *items[][SEARCH_FIELDS] = {
+      {"dom1", "user1"},
+      {"dom11", "user11"},
+      {"example.com", "Alice"},
+      {"Example.org", "bob"},
+      {"mail.example.com", nullptr},
+  };
+  struct search search;
+  search_init(&search, 5, test_search_fields, items);
+  TEST_ASSERT_EQUAL(5, search_size(&search));
+  TEST_ASSERT_NULL(search.signatures); // not until something is typed
+
+  // prefixes first, then substrings, then fuzzy matches
+  TEST_ASSERT_EQUAL(0, search_push(&search, 'd'));
+  TEST_ASSERT_EQUAL(2, search_size(&search));
+  TEST_ASSERT_EQUAL(0, search_push(&search, 'o'));
+  TEST_ASSERT_EQUAL(0, search_push(&search, 'm'));
+  TEST_ASSERT_EQUAL(0, search_push(&search, '1'));
+  TEST_ASSERT_EQUAL(0, search_push(&search, '1'));
+  TEST_ASSERT_EQUAL(2, search_size(&search));
+  TEST_ASSERT_EQUAL(1, search_item(&search, 0));
+  TEST_ASSERT_EQUAL(0, search_item(&search, 1)); // with the 1 of the user
+
+  const char *fields[SEARCH_FIELDS] = {items[0][0], items[0][1]};
+  struct search_position positions[SEARCH_MAX_QUERY];
+  TEST_ASSERT_TRUE(search_positions(&search, fields, positions));
+  TEST_ASSERT_EQUAL(0, positions[3].field);
+  TEST_ASSERT_EQUAL(3, positions[3].offset);
+  TEST_ASSERT_EQUAL(1, positions[4].field);
+  TEST_ASSERT_EQUAL(4, positions[4].offset);
+
+  // deleting characters restores the earlier results
+  for (size_t i = 0; i < 5; ++i) {
+    search_pop(&search);
+  }
+  TEST_ASSERT_EQUAL(5, search_size(&search));
+  TEST_ASSERT_EQUAL(2, search_item(&search, 2));
+
+  // case is ignored
+  TEST_ASSERT_EQUAL(0, search_push(&search, 'E'));
+  TEST_ASSERT_EQUAL(0, search_push(&search, 'x'));
+  TEST_ASSERT_EQUAL(3, search_size(&search));
+  TEST_ASSERT_EQUAL(2, search_item(&search, 0));
+  TEST_ASSERT_EQUAL(3, search_item(&search, 1));
+  TEST_ASSERT_EQUAL(4, search_item(&search, 2));
+  TEST_ASSERT_EQUAL(0, search_push(&search, 'z'));
+  TEST_ASSERT_EQUAL(0, search_size(&search));
+
+  search_free(&search);
+}
+
+static void tests_for_timings(void) {
+  const struct account accounts[] = {
+      {"a", "b", "0", "*", 32, nullptr, SCHEME_V1, DEFAULT_KDF_COST},
+      {"c", "d", "1", ":alnum:", 16, nullptr, SCHEME_V2, DEFAULT_KDF_COST},
+  };
+  struct session session;
+  session_init(&session, 6, "secret");
+  char password[33];
+  char *lanes[2] = {malloc(33), malloc(17 * CHARSET_MAX_CHAR_SIZE)};
+
+  // nothing is counted unless the timings are enabled
+  TEST_ASSERT_EQUAL(
+      0, derive_account_password(nullptr, &session, &accounts[0], password));
+  TEST_ASSERT_EQUAL(0, timings.kdf_calls);
+  TEST_ASSERT_EQUAL(0, timings.count[TIMING_KDF]);
+
+  // enabled without reporting at exit
+  timings.enabled = true;
+  TEST_ASSERT_EQUAL(
+      0, derive_account_password(nullptr, &session, &accounts[0], password));
+  TEST_ASSERT_EQUAL(
+      0, derive_account_passwords(nullptr, &session, 2, accounts, lanes));
+  timings.enabled = false;
+  TEST_ASSERT_EQUAL(3, timings.kdf_calls);
+  TEST_ASSERT_EQUAL(2, timings.count[TIMING_KDF]);
+  TEST_ASSERT_EQUAL(2, timings.count[TIMING_CHARSET]);
+  TEST_ASSERT_TRUE(timings.ns[TIMING_KDF] > 0);
+
+  free(lanes[0]);
+  free(lanes[1]);
+  session_clear(&session);
 }
 
 int main(void) {
   UNITY_BEGIN();
+  RUN_TEST(tests_for_scrypt_kdf);
+  RUN_TEST(tests_for_scrypt_kdf_lanes);
+  RUN_TEST(tests_for_scrypt_ctx);
+  RUN_TEST(tests_for_argon2id);
+  RUN_TEST(tests_for_derive_account_password);
+  RUN_TEST(tests_for_libpadre);
+  RUN_TEST(tests_for_libpadre_batch);
+  RUN_TEST(tests_for_speculation);
+  RUN_TEST(tests_for_database_load);
+  RUN_TEST(tests_for_parse_accounts);
+  RUN_TEST(tests_for_agent_request);
+  RUN_TEST(tests_for_csv_reader);
+  RUN_TEST(tests_for_padb);
+  RUN_TEST(tests_for_find_accounts);
+  RUN_TEST(tests_for_search);
   RUN_TEST(tests_for_enumerate_charset);
+  RUN_TEST(tests_for_charset);
   RUN_TEST(tests_for_to_pwdchars);
+  RUN_TEST(tests_for_expand_chars);
+  RUN_TEST(tests_for_timings);
   return UNITY_END();
 }
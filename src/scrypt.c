@@ -0,0 +1,1011 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// An implementation of the scrypt key derivation function as specified in
+// RFC 7914.  The memory-hard part (ROMix) is provided by several kernels, one
+// for each supported instruction set, of which the best one the processor
+// supports is picked at runtime.  The p instances of ROMix of a derivation are
+// independent of each other and are computed on as many threads as there are
+// processors for them.
+
+#include "padre.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define SCRYPT_X86 1
+#include <immintrin.h>
+#else
+#define SCRYPT_X86 0
+#endif
+
+static inline uint32_t le32dec(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline void le32enc(uint8_t *p, const uint32_t x) {
+  p[0] = (uint8_t)x;
+  p[1] = (uint8_t)(x >> 8);
+  p[2] = (uint8_t)(x >> 16);
+  p[3] = (uint8_t)(x >> 24);
+}
+
+static inline uint32_t be32dec(const uint8_t *p) {
+  return (uint32_t)p[3] | (uint32_t)p[2] << 8 | (uint32_t)p[1] << 16 |
+         (uint32_t)p[0] << 24;
+}
+
+static inline void be32enc(uint8_t *p, const uint32_t x) {
+  p[3] = (uint8_t)x;
+  p[2] = (uint8_t)(x >> 8);
+  p[1] = (uint8_t)(x >> 16);
+  p[0] = (uint8_t)(x >> 24);
+}
+
+static inline uint32_t rotl32(const uint32_t x, const int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t rotr32(const uint32_t x, const int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+// ---------------------------------------------------------------------------
+// SHA-256 (FIPS 180-4)
+
+struct sha256 {
+  uint32_t state[8];
+  uint64_t count; // number of bytes processed so far
+  uint8_t buf[64];
+};
+
+static const uint32_t sha256__k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static void sha256__compress(uint32_t state[static 8],
+                             const uint8_t block[static 64]) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = be32dec(&block[i * 4]);
+  }
+  for (int i = 16; i < 64; ++i) {
+    const uint32_t s0 =
+        rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 =
+        rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; ++i) {
+    const uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+    const uint32_t ch = (e & f) ^ (~e & g);
+    const uint32_t t1 = h + s1 + ch + sha256__k[i] + w[i];
+    const uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+    const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+
+  memset(w, 0, sizeof w);
+}
+
+static void sha256_init(struct sha256 *ctx) {
+  static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                 0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                 0x1f83d9ab, 0x5be0cd19};
+  memcpy(ctx->state, iv, sizeof iv);
+  ctx->count = 0;
+}
+
+static void sha256_update(struct sha256 *ctx, const void *data, size_t len) {
+  const uint8_t *in = data;
+  size_t used = (size_t)(ctx->count % 64);
+  ctx->count += len;
+
+  if (used > 0) {
+    const size_t n = len < 64 - used ? len : 64 - used;
+    memcpy(&ctx->buf[used], in, n);
+    in += n;
+    len -= n;
+    used += n;
+    if (used < 64) {
+      return;
+    }
+    sha256__compress(ctx->state, ctx->buf);
+  }
+  for (; len >= 64; in += 64, len -= 64) {
+    sha256__compress(ctx->state, in);
+  }
+  memcpy(ctx->buf, in, len);
+}
+
+static void sha256_final(struct sha256 *ctx, uint8_t digest[static 32]) {
+  const uint64_t bits = ctx->count * 8;
+  const size_t used = (size_t)(ctx->count % 64);
+
+  static const uint8_t padding[64] = {0x80};
+  sha256_update(ctx, padding, used < 56 ? 56 - used : 120 - used);
+
+  uint8_t len[8];
+  be32enc(&len[0], (uint32_t)(bits >> 32));
+  be32enc(&len[4], (uint32_t)bits);
+  sha256_update(ctx, len, sizeof len);
+
+  for (int i = 0; i < 8; ++i) {
+    be32enc(&digest[i * 4], ctx->state[i]);
+  }
+  memset(ctx, 0, sizeof *ctx);
+}
+
+// ---------------------------------------------------------------------------
+// HMAC-SHA-256 (RFC 2104)
+
+struct hmac_sha256 {
+  struct sha256 inner;
+  struct sha256 outer;
+};
+
+static void hmac_sha256_init(struct hmac_sha256 *ctx, const void *key,
+                             size_t key_len) {
+  uint8_t khash[32];
+  if (key_len > 64) {
+    struct sha256 tmp;
+    sha256_init(&tmp);
+    sha256_update(&tmp, key, key_len);
+    sha256_final(&tmp, khash);
+    key = khash;
+    key_len = sizeof khash;
+  }
+
+  uint8_t pad[64];
+  memset(pad, 0x36, sizeof pad);
+  for (size_t i = 0; i < key_len; ++i) {
+    pad[i] ^= ((const uint8_t *)key)[i];
+  }
+  sha256_init(&ctx->inner);
+  sha256_update(&ctx->inner, pad, sizeof pad);
+
+  memset(pad, 0x5c, sizeof pad);
+  for (size_t i = 0; i < key_len; ++i) {
+    pad[i] ^= ((const uint8_t *)key)[i];
+  }
+  sha256_init(&ctx->outer);
+  sha256_update(&ctx->outer, pad, sizeof pad);
+
+  memset(khash, 0, sizeof khash);
+  memset(pad, 0, sizeof pad);
+}
+
+static void hmac_sha256_update(struct hmac_sha256 *ctx, const void *data,
+                               const size_t len) {
+  sha256_update(&ctx->inner, data, len);
+}
+
+static void hmac_sha256_final(struct hmac_sha256 *ctx,
+                              uint8_t digest[static 32]) {
+  uint8_t ihash[32];
+  sha256_final(&ctx->inner, ihash);
+  sha256_update(&ctx->outer, ihash, sizeof ihash);
+  sha256_final(&ctx->outer, digest);
+  memset(ihash, 0, sizeof ihash);
+}
+
+// ---------------------------------------------------------------------------
+// PBKDF2-HMAC-SHA-256 (RFC 8018)
+
+// Computes PBKDF2 with a single iteration, which is all that scrypt needs.
+// `prf` is the HMAC keyed with the password and already fed with the salt.
+static void pbkdf2_sha256(const struct hmac_sha256 *prf, uint8_t *buf,
+                          const size_t buf_len) {
+  for (size_t i = 0; i * 32 < buf_len; ++i) {
+    uint8_t ivec[4];
+    be32enc(ivec, (uint32_t)(i + 1));
+
+    struct hmac_sha256 ctx = *prf;
+    hmac_sha256_update(&ctx, ivec, sizeof ivec);
+    uint8_t u[32];
+    hmac_sha256_final(&ctx, u);
+
+    const size_t n = buf_len - i * 32 < 32 ? buf_len - i * 32 : 32;
+    memcpy(&buf[i * 32], u, n);
+    memset(u, 0, sizeof u);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// ROMix kernels
+//
+// A kernel computes `B = ROMix(B)` for one 128·r byte block `B`, using `V` as
+// scratch memory of 128·r·N bytes and `XY` as scratch memory of 256·r + 64
+// bytes.  Both scratch buffers are aligned to 64 bytes.
+
+typedef void scrypt_romix_fn(uint8_t *B, size_t r, uint64_t N, void *V,
+                             void *XY);
+
+// The number of independent ROMix instances computed at once by the
+// multi-lane kernels.
+#define SCRYPT_LANES 8
+
+// A multi-lane kernel computes `B[l] = ROMix(B[l])` for SCRYPT_LANES blocks at
+// once.  The scratch buffers are SCRYPT_LANES times as large as above.
+typedef void scrypt_romix_lanes_fn(uint8_t *const B[static SCRYPT_LANES],
+                                   size_t r, uint64_t N, void *V, void *XY);
+
+static void salsa20_8_generic(uint32_t B[static 16]) {
+  uint32_t x[16];
+  memcpy(x, B, sizeof x);
+  for (int i = 0; i < 8; i += 2) {
+    // operate on columns
+    x[4] ^= rotl32(x[0] + x[12], 7);
+    x[8] ^= rotl32(x[4] + x[0], 9);
+    x[12] ^= rotl32(x[8] + x[4], 13);
+    x[0] ^= rotl32(x[12] + x[8], 18);
+    x[9] ^= rotl32(x[5] + x[1], 7);
+    x[13] ^= rotl32(x[9] + x[5], 9);
+    x[1] ^= rotl32(x[13] + x[9], 13);
+    x[5] ^= rotl32(x[1] + x[13], 18);
+    x[14] ^= rotl32(x[10] + x[6], 7);
+    x[2] ^= rotl32(x[14] + x[10], 9);
+    x[6] ^= rotl32(x[2] + x[14], 13);
+    x[10] ^= rotl32(x[6] + x[2], 18);
+    x[3] ^= rotl32(x[15] + x[11], 7);
+    x[7] ^= rotl32(x[3] + x[15], 9);
+    x[11] ^= rotl32(x[7] + x[3], 13);
+    x[15] ^= rotl32(x[11] + x[7], 18);
+
+    // operate on rows
+    x[1] ^= rotl32(x[0] + x[3], 7);
+    x[2] ^= rotl32(x[1] + x[0], 9);
+    x[3] ^= rotl32(x[2] + x[1], 13);
+    x[0] ^= rotl32(x[3] + x[2], 18);
+    x[6] ^= rotl32(x[5] + x[4], 7);
+    x[7] ^= rotl32(x[6] + x[5], 9);
+    x[4] ^= rotl32(x[7] + x[6], 13);
+    x[5] ^= rotl32(x[4] + x[7], 18);
+    x[11] ^= rotl32(x[10] + x[9], 7);
+    x[8] ^= rotl32(x[11] + x[10], 9);
+    x[9] ^= rotl32(x[8] + x[11], 13);
+    x[10] ^= rotl32(x[9] + x[8], 18);
+    x[12] ^= rotl32(x[15] + x[14], 7);
+    x[13] ^= rotl32(x[12] + x[15], 9);
+    x[14] ^= rotl32(x[13] + x[12], 13);
+    x[15] ^= rotl32(x[14] + x[13], 18);
+  }
+  for (int i = 0; i < 16; ++i) {
+    B[i] += x[i];
+  }
+}
+
+// Computes `Y = BlockMix(B)`.
+static void blockmix_generic(const uint32_t *B, uint32_t *Y, const size_t r) {
+  uint32_t X[16];
+  memcpy(X, &B[(2 * r - 1) * 16], sizeof X);
+  for (size_t i = 0; i < 2 * r; ++i) {
+    for (size_t k = 0; k < 16; ++k) {
+      X[k] ^= B[i * 16 + k];
+    }
+    salsa20_8_generic(X);
+    // even blocks go to the first half of the output, odd ones to the second
+    memcpy(&Y[(i / 2 + (i & 1) * r) * 16], X, sizeof X);
+  }
+}
+
+static void romix_generic(uint8_t *B, const size_t r, const uint64_t N,
+                          void *V, void *XY) {
+  uint32_t *const v = V;
+  uint32_t *const X = XY;
+  uint32_t *const Y = X + 32 * r;
+  const size_t words = 32 * r;
+
+  for (size_t k = 0; k < words; ++k) {
+    X[k] = le32dec(&B[k * 4]);
+  }
+  for (uint64_t i = 0; i < N; ++i) {
+    memcpy(&v[i * words], X, words * 4);
+    blockmix_generic(X, Y, r);
+    memcpy(X, Y, words * 4);
+  }
+  for (uint64_t i = 0; i < N; ++i) {
+    const uint64_t j =
+        ((uint64_t)X[(2 * r - 1) * 16 + 1] << 32 | X[(2 * r - 1) * 16]) &
+        (N - 1);
+    for (size_t k = 0; k < words; ++k) {
+      X[k] ^= v[j * words + k];
+    }
+    blockmix_generic(X, Y, r);
+    memcpy(X, Y, words * 4);
+  }
+  for (size_t k = 0; k < words; ++k) {
+    le32enc(&B[k * 4], X[k]);
+  }
+}
+
+#if SCRYPT_X86
+
+#define KERNEL(name) name##_sse2
+#define KERNEL_TARGET "sse2"
+#define VEC __m128i
+#define VLOAD(p) _mm_load_si128(p)
+#define VSTORE(p, v) _mm_store_si128(p, v)
+#define ROTL(v, c) _mm_or_si128(_mm_slli_epi32(v, c), _mm_srli_epi32(v, 32 - c))
+#include "scrypt_kernel.c"
+
+#define KERNEL(name) name##_avx2
+#define KERNEL_TARGET "avx2"
+#define VEC __m256i
+#define VLOAD(p) _mm256_load_si256(p)
+#define VSTORE(p, v) _mm256_store_si256(p, v)
+#define ROTL(v, c) _mm_or_si128(_mm_slli_epi32(v, c), _mm_srli_epi32(v, 32 - c))
+#include "scrypt_kernel.c"
+
+#define KERNEL(name) name##_avx512
+#define KERNEL_TARGET "avx512f,avx512vl"
+#define VEC __m512i
+#define VLOAD(p) _mm512_load_si512(p)
+#define VSTORE(p, v) _mm512_store_si512(p, v)
+#define ROTL(v, c) _mm_rol_epi32(v, c)
+#include "scrypt_kernel.c"
+
+#define KERNEL(name) name##_avx2
+#define KERNEL_TARGET "avx2"
+#define ROTL(v, c)                                                             \
+  _mm256_or_si256(_mm256_slli_epi32(v, c), _mm256_srli_epi32(v, 32 - c))
+#include "scrypt_lanes_kernel.c"
+
+#define KERNEL(name) name##_avx512
+#define KERNEL_TARGET "avx512f,avx512vl"
+#define ROTL(v, c) _mm256_rol_epi32(v, c)
+#include "scrypt_lanes_kernel.c"
+
+static bool scrypt__has_sse2(void) { return __builtin_cpu_supports("sse2"); }
+
+static bool scrypt__has_avx2(void) { return __builtin_cpu_supports("avx2"); }
+
+static bool scrypt__has_avx512(void) {
+  return __builtin_cpu_supports("avx512f") &&
+         __builtin_cpu_supports("avx512vl");
+}
+
+#endif // SCRYPT_X86
+
+struct scrypt_kernel {
+  const char *name;
+  bool (*supported)(void); // `nullptr` if supported everywhere
+  scrypt_romix_fn *romix;
+  scrypt_romix_lanes_fn *romix_lanes; // `nullptr` if there is none
+};
+
+// All available kernels, the preferred ones first.
+static const struct scrypt_kernel scrypt_kernels[] = {
+#if SCRYPT_X86
+    {"avx512", scrypt__has_avx512, romix_avx512, romix_lanes_avx512},
+    {"avx2", scrypt__has_avx2, romix_avx2, romix_lanes_avx2},
+    {"sse2", scrypt__has_sse2, romix_sse2, nullptr},
+#endif
+    {"generic", nullptr, romix_generic, nullptr},
+};
+
+#define NUM_SCRYPT_KERNELS (sizeof scrypt_kernels / sizeof scrypt_kernels[0])
+
+static bool scrypt_kernel_supported(const struct scrypt_kernel *kernel) {
+  return kernel->supported == nullptr || kernel->supported();
+}
+
+// Returns the fastest kernel supported by the processor.
+static const struct scrypt_kernel *scrypt_select_kernel(void) {
+  for (size_t i = 0; i < NUM_SCRYPT_KERNELS; ++i) {
+    if (scrypt_kernel_supported(&scrypt_kernels[i])) {
+      return &scrypt_kernels[i];
+    }
+  }
+  return &scrypt_kernels[NUM_SCRYPT_KERNELS - 1];
+}
+
+// ---------------------------------------------------------------------------
+// Scratch memory
+
+// The kinds of pages that back the scratch memory, from worst to best.
+enum scrypt_pages {
+  SCRYPT_PAGES_NORMAL,
+  SCRYPT_PAGES_TRANSPARENT_HUGE, // transparent huge pages via madvise()
+  SCRYPT_PAGES_HUGETLB,          // pages reserved in the hugetlbfs pool
+};
+
+static const char *const scrypt_pages_names[] = {
+    [SCRYPT_PAGES_NORMAL] = "normal",
+    [SCRYPT_PAGES_TRANSPARENT_HUGE] = "transparent huge",
+    [SCRYPT_PAGES_HUGETLB] = "hugetlb",
+};
+
+#define SCRYPT_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+// Scratch memory for scrypt that is allocated, locked into RAM and prefaulted
+// once, so that it can be reused for many derivations without paying for the
+// allocation and the page faults each time.  It is wiped after each use.
+//
+// Where possible it is backed by 2 MiB pages, because the second loop of
+// ROMix reads from random places all over V, so that with 4 KiB pages nearly
+// every block costs a TLB miss.
+struct scrypt_ctx {
+  uint8_t *memory;
+  size_t size;
+  void *mapping; // the mapping `memory` lies in
+  size_t mapping_size;
+  enum scrypt_pages pages;
+  bool locked; // whether `memory` could be locked into RAM
+};
+
+static size_t scrypt__round_up(const size_t n, const size_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+// The most threads a single derivation runs on.
+#define KDF_MAX_THREADS 64
+
+// The number of threads a single derivation may run on; 0 for as many as there
+// are processors online.  Argon2id (argon2.c) runs its lanes on as many.
+static size_t kdf_max_threads = 0;
+
+// Returns the number of threads the p instances of ROMix of a derivation, or
+// the p lanes of Argon2id, are computed on.
+static size_t kdf_num_threads(const uint32_t p) {
+  if (p == 1) {
+    return 1;
+  }
+  size_t threads = kdf_max_threads;
+  if (threads == 0) {
+    const long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = nprocs > 0 ? (size_t)nprocs : 1;
+  }
+  if (threads > KDF_MAX_THREADS) {
+    threads = KDF_MAX_THREADS;
+  }
+  return threads < p ? threads : p;
+}
+
+// Returns the number of bytes of `XY` that each thread uses.
+static size_t scrypt__xy_size(const uint32_t r) {
+  return scrypt__round_up(2 * 128 * (size_t)r + 64, 64);
+}
+
+// Returns the number of bytes of scratch memory needed to compute `lanes`
+// derivations at once, or a single one on `threads` threads, with the given
+// parameters.
+static size_t scrypt__scratch_size(const size_t lanes, const size_t threads,
+                                   const uint64_t N, const uint32_t r,
+                                   const uint32_t p) {
+  const size_t block_size = 128 * (size_t)r;
+  const size_t instances = lanes > threads ? lanes : threads;
+  const size_t lanes_xy = scrypt__round_up(lanes * 2 * block_size + 64, 64);
+  const size_t threads_xy = threads * scrypt__xy_size(r);
+  return scrypt__round_up(instances * block_size * (size_t)N, 64) +
+         scrypt__round_up(lanes * block_size * p, 64) +
+         (lanes_xy > threads_xy ? lanes_xy : threads_xy);
+}
+
+// Maps `size` bytes backed by the given kind of pages into `ctx`.
+// Returns 0 on success; -1 in case of a failure.
+static int scrypt__map(struct scrypt_ctx *ctx, const size_t size,
+                       const enum scrypt_pages pages) {
+  switch (pages) {
+  case SCRYPT_PAGES_HUGETLB: {
+    // Fails right away, unless enough huge pages have been reserved.
+    const size_t mapping_size = scrypt__round_up(size, SCRYPT_HUGE_PAGE_SIZE);
+    void *mapping =
+        mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (mapping == MAP_FAILED) {
+      return -1;
+    }
+    ctx->mapping = ctx->memory = mapping;
+    ctx->mapping_size = mapping_size;
+    break;
+  }
+  case SCRYPT_PAGES_TRANSPARENT_HUGE: {
+    // Over-allocate, so that the memory can start on a huge page boundary.
+    const size_t mapping_size =
+        scrypt__round_up(size, SCRYPT_HUGE_PAGE_SIZE) + SCRYPT_HUGE_PAGE_SIZE;
+    void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      return -1;
+    }
+    uint8_t *memory = (uint8_t *)scrypt__round_up((uintptr_t)mapping,
+                                                  SCRYPT_HUGE_PAGE_SIZE);
+    if (madvise(memory, scrypt__round_up(size, SCRYPT_HUGE_PAGE_SIZE),
+                MADV_HUGEPAGE) != 0) {
+      munmap(mapping, mapping_size);
+      return -1;
+    }
+    // prefault, now that the kernel knows to use huge pages
+    for (size_t i = 0; i < size; i += 4096) {
+      ((volatile uint8_t *)memory)[i] = 0;
+    }
+    ctx->mapping = mapping;
+    ctx->mapping_size = mapping_size;
+    ctx->memory = memory;
+    break;
+  }
+  case SCRYPT_PAGES_NORMAL: {
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (mapping == MAP_FAILED) {
+      return -1;
+    }
+    ctx->mapping = ctx->memory = mapping;
+    ctx->mapping_size = size;
+    break;
+  }
+  }
+
+  ctx->size = size;
+  ctx->pages = pages;
+  return 0;
+}
+
+// Maps `size` bytes of scratch memory into `ctx`, backed at best by the given
+// kind of pages.
+// Returns 0 on success; -1 in case of a failure.
+static int scrypt__ctx_init_size(struct scrypt_ctx *ctx, const size_t size,
+                                 const enum scrypt_pages best) {
+  *ctx = (struct scrypt_ctx){.memory = nullptr, .mapping = nullptr};
+
+  enum scrypt_pages pages = best;
+  while (scrypt__map(ctx, size, pages) != 0) {
+    if (pages == SCRYPT_PAGES_NORMAL) {
+      return -1;
+    }
+    pages = pages - 1;
+  }
+
+  // Keep the intermediate state out of swap space and core dumps.  Both are
+  // best effort, as the limit for locked memory is usually rather low.
+  ctx->locked = mlock(ctx->memory, size) == 0;
+  madvise(ctx->mapping, ctx->mapping_size, MADV_DONTDUMP);
+
+  return 0;
+}
+
+// Returns the number of bytes of scratch memory a single derivation with the
+// given parameters takes on up to `threads` threads.
+static size_t scrypt_memory_size(const uint64_t N, const uint32_t r,
+                                 const uint32_t p, const size_t threads) {
+  return scrypt__scratch_size(1, threads < p ? threads : p, N, r, p);
+}
+
+// Returns the number of bytes of scratch memory `scrypt_kdf_lanes()` takes to
+// compute jobs with the given parameters in the lanes of the SIMD unit.
+static size_t scrypt_lanes_memory_size(const uint64_t N, const uint32_t r,
+                                       const uint32_t p) {
+  return scrypt__scratch_size(SCRYPT_LANES, 1, N, r, p);
+}
+
+// Like `scrypt_ctx_init()`, but uses at best the given kind of pages.
+static int scrypt_ctx_init_pages(struct scrypt_ctx *ctx, const size_t lanes,
+                                 const uint64_t N, const uint32_t r,
+                                 const uint32_t p,
+                                 const enum scrypt_pages best) {
+  return scrypt__ctx_init_size(
+      ctx, scrypt__scratch_size(lanes, kdf_num_threads(p), N, r, p), best);
+}
+
+// Prepares `ctx` for derivations with the given parameters, computing up to
+// `lanes` of them at once, or a single one on as many threads as it may use.
+// The memory is backed by huge pages from the
+// hugetlbfs pool if some are reserved, by transparent huge pages if these are
+// enabled, and by normal pages otherwise.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int scrypt_ctx_init(struct scrypt_ctx *ctx, const size_t lanes,
+                           const uint64_t N, const uint32_t r,
+                           const uint32_t p) {
+  return scrypt_ctx_init_pages(ctx, lanes, N, r, p, SCRYPT_PAGES_HUGETLB);
+}
+
+// Prepares `ctx` with `size` bytes of scratch memory, as `scrypt_ctx_init()`
+// does, for other KDFs than scrypt.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int scrypt_ctx_init_size(struct scrypt_ctx *ctx, const size_t size) {
+  return scrypt__ctx_init_size(ctx, size, SCRYPT_PAGES_HUGETLB);
+}
+
+static void scrypt_ctx_free(struct scrypt_ctx *ctx) {
+  if (ctx->memory != nullptr) {
+    explicit_bzero(ctx->memory, ctx->size);
+    munmap(ctx->mapping, ctx->mapping_size);
+  }
+  *ctx = (struct scrypt_ctx){.memory = nullptr, .mapping = nullptr};
+}
+
+// The scratch buffers of one derivation, carved out of a `struct scrypt_ctx`.
+struct scrypt__scratch {
+  struct scrypt_ctx *ctx;
+  struct scrypt_ctx temporary; // used if the caller gave no suitable context
+  size_t used;                 // number of bytes to wipe after use
+  uint8_t *V;
+  uint8_t *B;
+  uint8_t *XY;
+};
+
+static int scrypt__scratch_get(struct scrypt__scratch *scratch,
+                               struct scrypt_ctx *ctx, const size_t lanes,
+                               const size_t threads, const uint64_t N,
+                               const uint32_t r, const uint32_t p) {
+  const size_t size = scrypt__scratch_size(lanes, threads, N, r, p);
+
+  scratch->temporary = (struct scrypt_ctx){.memory = nullptr};
+  if (ctx == nullptr || ctx->size < size) {
+    if (scrypt_ctx_init(&scratch->temporary, lanes, N, r, p) != 0) {
+      return -1;
+    }
+    ctx = &scratch->temporary;
+  }
+
+  const size_t block_size = 128 * (size_t)r;
+  scratch->ctx = ctx;
+  scratch->used = size;
+  scratch->V = ctx->memory;
+  scratch->B = ctx->memory +
+               scrypt__round_up((lanes > threads ? lanes : threads) *
+                                    block_size * N,
+                                64);
+  scratch->XY = scratch->B + scrypt__round_up(lanes * block_size * p, 64);
+  return 0;
+}
+
+static void scrypt__scratch_release(struct scrypt__scratch *scratch) {
+  explicit_bzero(scratch->ctx->memory, scratch->used);
+  scrypt_ctx_free(&scratch->temporary);
+}
+
+// ---------------------------------------------------------------------------
+// scrypt (RFC 7914)
+
+static bool scrypt__valid_params(const uint64_t N, const uint32_t r,
+                                 const uint32_t p, const size_t buf_len) {
+  return N >= 2 && (N & (N - 1)) == 0 && r > 0 && p > 0 &&
+         (uint64_t)r * p < (1 << 30) &&
+         N <= SIZE_MAX / 128 / r / KDF_MAX_THREADS &&
+         buf_len <= ((uint64_t)1 << 32) * 32 - 1;
+}
+
+// Returns whether scrypt can be computed with the given cost parameters.
+static bool scrypt_valid_params(const uint64_t N, const uint32_t r,
+                                const uint32_t p) {
+  return scrypt__valid_params(N, r, p, 0);
+}
+
+// The share of the p instances of ROMix of a derivation that one thread
+// computes: those from `first` on in steps of `step`, in its own `V` and `XY`.
+struct scrypt__romix_share {
+  const struct scrypt_kernel *kernel;
+  uint8_t *B;
+  uint32_t r;
+  uint64_t N;
+  uint32_t p;
+  uint8_t *V;
+  uint8_t *XY;
+  size_t first;
+  size_t step;
+};
+
+static void *scrypt__romix_worker(void *arg) {
+  const struct scrypt__romix_share *share = arg;
+  const size_t block_size = 128 * (size_t)share->r;
+  for (size_t i = share->first; i < share->p; i += share->step) {
+    share->kernel->romix(&share->B[block_size * i], share->r, share->N,
+                         share->V, share->XY);
+  }
+  return nullptr;
+}
+
+// Computes the p instances of ROMix of a derivation in `scratch` on `threads`
+// threads, the calling one included.  Shares whose thread cannot be started
+// are computed by the calling thread, so that this cannot fail.
+static void scrypt__romix_threads(const struct scrypt_kernel *kernel,
+                                  const struct scrypt__scratch *scratch,
+                                  const uint32_t r, const uint64_t N,
+                                  const uint32_t p, const size_t threads) {
+  struct scrypt__romix_share shares[KDF_MAX_THREADS];
+  pthread_t ids[KDF_MAX_THREADS];
+  bool started[KDF_MAX_THREADS] = {false};
+
+  for (size_t t = 0; t < threads; ++t) {
+    shares[t] = (struct scrypt__romix_share){
+        .kernel = kernel,
+        .B = scratch->B,
+        .r = r,
+        .N = N,
+        .p = p,
+        .V = scratch->V + t * 128 * (size_t)r * N,
+        .XY = scratch->XY + t * scrypt__xy_size(r),
+        .first = t,
+        .step = threads,
+    };
+    started[t] = t > 0 && pthread_create(&ids[t], nullptr,
+                                         scrypt__romix_worker, &shares[t]) == 0;
+  }
+  for (size_t t = 0; t < threads; ++t) {
+    if (!started[t]) {
+      scrypt__romix_worker(&shares[t]);
+    }
+  }
+  for (size_t t = 0; t < threads; ++t) {
+    if (started[t]) {
+      pthread_join(ids[t], nullptr);
+    }
+  }
+}
+
+// Like `scrypt_kdf_keyed_with()`, but with the number of threads given
+// explicitly.
+static int scrypt__kdf_keyed(const struct scrypt_kernel *kernel,
+                             struct scrypt_ctx *ctx,
+                             const struct hmac_sha256 *prf,
+                             const uint8_t *salt, const size_t salt_len,
+                             const uint64_t N, const uint32_t r,
+                             const uint32_t p, uint8_t *buf,
+                             const size_t buf_len, const size_t threads) {
+  if (!scrypt__valid_params(N, r, p, buf_len)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct scrypt__scratch scratch;
+  if (scrypt__scratch_get(&scratch, ctx, 1, threads, N, r, p) != 0) {
+    return -1;
+  }
+  const size_t block_size = 128 * (size_t)r;
+
+  struct hmac_sha256 salted = *prf;
+  hmac_sha256_update(&salted, salt, salt_len);
+  pbkdf2_sha256(&salted, scratch.B, block_size * p);
+
+  scrypt__romix_threads(kernel, &scratch, r, N, p, threads);
+
+  salted = *prf;
+  hmac_sha256_update(&salted, scratch.B, block_size * p);
+  pbkdf2_sha256(&salted, buf, buf_len);
+
+  explicit_bzero(&salted, sizeof salted);
+  scrypt__scratch_release(&scratch);
+
+  return 0;
+}
+
+// Like `scrypt_kdf_keyed()`, but on up to `threads` threads rather than on as
+// many as there are processors for.
+static int scrypt_kdf_keyed_threads(struct scrypt_ctx *ctx,
+                                    const struct hmac_sha256 *prf,
+                                    const uint8_t *salt, const size_t salt_len,
+                                    const uint64_t N, const uint32_t r,
+                                    const uint32_t p, uint8_t *buf,
+                                    const size_t buf_len,
+                                    const size_t threads) {
+  return scrypt__kdf_keyed(scrypt_select_kernel(), ctx, prf, salt, salt_len, N,
+                           r, p, buf, buf_len, threads < p ? threads : p);
+}
+
+// Like `scrypt_kdf_keyed()`, but with the ROMix kernel given explicitly.
+static int scrypt_kdf_keyed_with(const struct scrypt_kernel *kernel,
+                                 struct scrypt_ctx *ctx,
+                                 const struct hmac_sha256 *prf,
+                                 const uint8_t *salt, const size_t salt_len,
+                                 const uint64_t N, const uint32_t r,
+                                 const uint32_t p, uint8_t *buf,
+                                 const size_t buf_len) {
+  return scrypt__kdf_keyed(kernel, ctx, prf, salt, salt_len, N, r, p, buf,
+                           buf_len, kdf_num_threads(p));
+}
+
+// Like `scrypt_kdf()`, but with the ROMix kernel given explicitly.
+static int scrypt_kdf_with(const struct scrypt_kernel *kernel,
+                           struct scrypt_ctx *ctx, const uint8_t *passwd,
+                           const size_t passwd_len, const uint8_t *salt,
+                           const size_t salt_len, const uint64_t N,
+                           const uint32_t r, const uint32_t p, uint8_t *buf,
+                           const size_t buf_len) {
+  struct hmac_sha256 prf;
+  hmac_sha256_init(&prf, passwd, passwd_len);
+  const int ret = scrypt_kdf_keyed_with(kernel, ctx, &prf, salt, salt_len, N,
+                                        r, p, buf, buf_len);
+  explicit_bzero(&prf, sizeof prf);
+  return ret;
+}
+
+// Like `scrypt_kdf()`, but with the password given as `prf`, an HMAC-SHA256
+// context keyed with it by `hmac_sha256_init()`.  This saves keying the HMAC
+// for every derivation when many derivations share one password.
+static int scrypt_kdf_keyed(struct scrypt_ctx *ctx,
+                            const struct hmac_sha256 *prf,
+                            const uint8_t *salt, const size_t salt_len,
+                            const uint64_t N, const uint32_t r,
+                            const uint32_t p, uint8_t *buf,
+                            const size_t buf_len) {
+  return scrypt_kdf_keyed_with(scrypt_select_kernel(), ctx, prf, salt,
+                               salt_len, N, r, p, buf, buf_len);
+}
+
+// Computes scrypt(passwd, salt, N, r, p) into `buf`, using the scratch memory
+// of `ctx`.  If `ctx` is `nullptr` or too small, scratch memory is allocated
+// just for this derivation.  For p > 1, the instances of ROMix run on up to p
+// threads, each with scratch memory of its own.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int scrypt_kdf(struct scrypt_ctx *ctx, const uint8_t *passwd,
+                      const size_t passwd_len, const uint8_t *salt,
+                      const size_t salt_len, const uint64_t N,
+                      const uint32_t r, const uint32_t p, uint8_t *buf,
+                      const size_t buf_len) {
+  return scrypt_kdf_with(scrypt_select_kernel(), ctx, passwd, passwd_len,
+                         salt, salt_len, N, r, p, buf, buf_len);
+}
+
+// One derivation of a batch for `scrypt_kdf_lanes()`.
+struct scrypt_job {
+  const uint8_t *passwd;
+  size_t passwd_len;
+  const uint8_t *salt;
+  size_t salt_len;
+  uint8_t *buf;
+  size_t buf_len;
+  const struct hmac_sha256 *prf; // if not `nullptr`, used instead of `passwd`
+};
+
+// Stores the HMAC-SHA256 context keyed with the password of `job` in `prf`.
+static void scrypt__job_prf(const struct scrypt_job *job,
+                            struct hmac_sha256 *prf) {
+  if (job->prf != nullptr) {
+    *prf = *job->prf;
+  } else {
+    hmac_sha256_init(prf, job->passwd, job->passwd_len);
+  }
+}
+
+// Below this many jobs, it is faster to run them one after another than to
+// run them in the lanes of a multi-lane kernel.
+#define SCRYPT_MIN_LANES_USED 3
+
+// Like `scrypt_kdf_lanes()`, but with the kernel given explicitly.
+static int scrypt_kdf_lanes_with(const struct scrypt_kernel *kernel,
+                                 struct scrypt_ctx *ctx,
+                                 const size_t num_jobs,
+                                 const struct scrypt_job jobs[num_jobs],
+                                 const uint64_t N, const uint32_t r,
+                                 const uint32_t p) {
+  for (size_t i = 0; i < num_jobs; ++i) {
+    if (!scrypt__valid_params(N, r, p, jobs[i].buf_len)) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  const size_t block_size = 128 * (size_t)r;
+  const bool lanes =
+      kernel->romix_lanes != nullptr && num_jobs >= SCRYPT_MIN_LANES_USED;
+
+  struct scrypt__scratch scratch;
+  if (lanes &&
+      scrypt__scratch_get(&scratch, ctx, SCRYPT_LANES, 1, N, r, p) != 0) {
+    return -1;
+  }
+  uint8_t *const B = lanes ? scratch.B : nullptr;
+
+  size_t first = 0;
+  for (; lanes && first < num_jobs &&
+         num_jobs - first >= SCRYPT_MIN_LANES_USED;
+       first += SCRYPT_LANES) {
+    const size_t used =
+        num_jobs - first < SCRYPT_LANES ? num_jobs - first : SCRYPT_LANES;
+
+    // unused lanes compute garbage on zeros, which is thrown away
+    memset(B, 0, SCRYPT_LANES * block_size * p);
+    for (size_t l = 0; l < used; ++l) {
+      const struct scrypt_job *job = &jobs[first + l];
+      struct hmac_sha256 prf;
+      scrypt__job_prf(job, &prf);
+      hmac_sha256_update(&prf, job->salt, job->salt_len);
+      pbkdf2_sha256(&prf, &B[l * block_size * p], block_size * p);
+      explicit_bzero(&prf, sizeof prf);
+    }
+
+    for (uint32_t i = 0; i < p; ++i) {
+      uint8_t *blocks[SCRYPT_LANES];
+      for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+        blocks[l] = &B[(l * p + i) * block_size];
+      }
+      kernel->romix_lanes(blocks, r, N, scratch.V, scratch.XY);
+    }
+
+    for (size_t l = 0; l < used; ++l) {
+      const struct scrypt_job *job = &jobs[first + l];
+      struct hmac_sha256 prf;
+      scrypt__job_prf(job, &prf);
+      hmac_sha256_update(&prf, &B[l * block_size * p], block_size * p);
+      pbkdf2_sha256(&prf, job->buf, job->buf_len);
+      explicit_bzero(&prf, sizeof prf);
+    }
+  }
+
+  if (lanes) {
+    scrypt__scratch_release(&scratch);
+  }
+
+  // the remaining jobs are computed one after another, each on one thread
+  for (; first < num_jobs; ++first) {
+    const struct scrypt_job *job = &jobs[first];
+    struct hmac_sha256 prf;
+    scrypt__job_prf(job, &prf);
+    const int ret =
+        scrypt__kdf_keyed(kernel, ctx, &prf, job->salt, job->salt_len, N, r,
+                          p, job->buf, job->buf_len, 1);
+    explicit_bzero(&prf, sizeof prf);
+    if (ret != 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Computes scrypt for each of the independent `jobs`, all with the same cost
+// parameters.  The jobs are computed in the lanes of a multi-lane kernel, if
+// the processor supports one, and all on the calling thread, as the callers
+// run batches on as many threads as there are processors already.  `ctx` is
+// used as in `scrypt_kdf()`; it needs room for SCRYPT_LANES derivations to be
+// used by the multi-lane kernels.
+// Returns 0 on success; -1 in case of a failure, with `errno` set.
+static int scrypt_kdf_lanes(struct scrypt_ctx *ctx, const size_t num_jobs,
+                            const struct scrypt_job jobs[num_jobs],
+                            const uint64_t N, const uint32_t r,
+                            const uint32_t p) {
+  return scrypt_kdf_lanes_with(scrypt_select_kernel(), ctx, num_jobs, jobs, N,
+                               r, p);
+}
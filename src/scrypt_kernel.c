@@ -0,0 +1,157 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// The ROMix kernel for x86 SIMD extensions.  This file is a template that is
+// included by scrypt.c once per instruction set, with the following macros
+// defined beforehand.
+//   KERNEL(name)  — mangles `name` for the instruction set
+//   KERNEL_TARGET — the instruction set as understood by the target attribute
+//   VEC           — the widest vector type, used to copy blocks
+//   VLOAD, VSTORE — aligned load and store of VEC
+//   ROTL(v, c)    — rotates each 32-bit word in the __m128i `v` left by `c`
+//
+// The Salsa20/8 core keeps one 64-byte block in four 128-bit rows.  So that
+// the column and row rounds can be computed on whole rows, the words of each
+// block are stored permuted in the scratch memory, such that the diagonals of
+// the Salsa20 matrix end up in the rows.  Word `i` of the permuted block is
+// word `i * 5 % 16` of the original one.
+
+#define KERNEL_FN static __attribute__((target(KERNEL_TARGET)))
+
+KERNEL_FN void KERNEL(salsa20_8)(__m128i B[static 4]) {
+  __m128i X0 = B[0], X1 = B[1], X2 = B[2], X3 = B[3];
+
+  for (int i = 0; i < 8; i += 2) {
+    // operate on columns
+    X1 = _mm_xor_si128(X1, ROTL(_mm_add_epi32(X0, X3), 7));
+    X2 = _mm_xor_si128(X2, ROTL(_mm_add_epi32(X1, X0), 9));
+    X3 = _mm_xor_si128(X3, ROTL(_mm_add_epi32(X2, X1), 13));
+    X0 = _mm_xor_si128(X0, ROTL(_mm_add_epi32(X3, X2), 18));
+
+    // rearrange the data, so that the rows become columns
+    X1 = _mm_shuffle_epi32(X1, 0x93);
+    X2 = _mm_shuffle_epi32(X2, 0x4e);
+    X3 = _mm_shuffle_epi32(X3, 0x39);
+
+    // operate on rows
+    X3 = _mm_xor_si128(X3, ROTL(_mm_add_epi32(X0, X1), 7));
+    X2 = _mm_xor_si128(X2, ROTL(_mm_add_epi32(X3, X0), 9));
+    X1 = _mm_xor_si128(X1, ROTL(_mm_add_epi32(X2, X3), 13));
+    X0 = _mm_xor_si128(X0, ROTL(_mm_add_epi32(X1, X2), 18));
+
+    // rearrange the data back
+    X1 = _mm_shuffle_epi32(X1, 0x39);
+    X2 = _mm_shuffle_epi32(X2, 0x4e);
+    X3 = _mm_shuffle_epi32(X3, 0x93);
+  }
+
+  B[0] = _mm_add_epi32(B[0], X0);
+  B[1] = _mm_add_epi32(B[1], X1);
+  B[2] = _mm_add_epi32(B[2], X2);
+  B[3] = _mm_add_epi32(B[3], X3);
+}
+
+// Copies `len` bytes, a multiple of 64, from `src` to `dst`.
+KERNEL_FN void KERNEL(blkcpy)(void *restrict dst, const void *restrict src,
+                              const size_t len) {
+  VEC *d = dst;
+  const VEC *s = src;
+  for (size_t i = 0; i < len / sizeof(VEC); ++i) {
+    VSTORE(&d[i], VLOAD(&s[i]));
+  }
+}
+
+// Computes `Y = BlockMix(B ^ V)`, where `V` may be `nullptr`, in which case
+// `Y = BlockMix(B)`.
+KERNEL_FN void KERNEL(blockmix)(const __m128i *restrict B,
+                                const __m128i *restrict V,
+                                __m128i *restrict Y, const size_t r) {
+  __m128i X[4];
+  const __m128i *last = &B[(2 * r - 1) * 4];
+  for (size_t k = 0; k < 4; ++k) {
+    X[k] = V == nullptr ? last[k]
+                        : _mm_xor_si128(last[k], V[(2 * r - 1) * 4 + k]);
+  }
+
+  for (size_t i = 0; i < 2 * r; ++i) {
+    if (V == nullptr) {
+      for (size_t k = 0; k < 4; ++k) {
+        X[k] = _mm_xor_si128(X[k], B[i * 4 + k]);
+      }
+    } else {
+      for (size_t k = 0; k < 4; ++k) {
+        X[k] =
+            _mm_xor_si128(X[k], _mm_xor_si128(B[i * 4 + k], V[i * 4 + k]));
+      }
+    }
+    KERNEL(salsa20_8)(X);
+    // even blocks go to the first half of the output, odd ones to the second
+    __m128i *out = &Y[(i / 2 + (i & 1) * r) * 4];
+    for (size_t k = 0; k < 4; ++k) {
+      out[k] = X[k];
+    }
+  }
+}
+
+// Returns the integer interpretation of the last 64-byte block in `B`.
+KERNEL_FN uint64_t KERNEL(integerify)(const __m128i *B, const size_t r) {
+  const uint32_t *last = (const uint32_t *)&B[(2 * r - 1) * 4];
+  // words 0 and 1 of the original block are at 0 and 13 after permutation
+  return (uint64_t)last[13] << 32 | last[0];
+}
+
+KERNEL_FN void KERNEL(romix)(uint8_t *B, const size_t r, const uint64_t N,
+                             void *V, void *XY) {
+  const size_t block_size = 128 * r;
+  uint8_t *const v = V;
+  __m128i *const X = XY;
+  __m128i *const Y = X + 8 * r;
+  uint32_t *const X32 = XY;
+
+  for (size_t k = 0; k < 2 * r; ++k) {
+    for (size_t i = 0; i < 16; ++i) {
+      X32[k * 16 + i] = le32dec(&B[(k * 16 + i * 5 % 16) * 4]);
+    }
+  }
+
+  for (uint64_t i = 0; i < N; i += 2) {
+    KERNEL(blkcpy)(&v[i * block_size], X, block_size);
+    KERNEL(blockmix)(X, nullptr, Y, r);
+    KERNEL(blkcpy)(&v[(i + 1) * block_size], Y, block_size);
+    KERNEL(blockmix)(Y, nullptr, X, r);
+  }
+
+  for (uint64_t i = 0; i < N; i += 2) {
+    uint64_t j = KERNEL(integerify)(X, r) & (N - 1);
+    KERNEL(blockmix)(X, (const __m128i *)&v[j * block_size], Y, r);
+    j = KERNEL(integerify)(Y, r) & (N - 1);
+    KERNEL(blockmix)(Y, (const __m128i *)&v[j * block_size], X, r);
+  }
+
+  for (size_t k = 0; k < 2 * r; ++k) {
+    for (size_t i = 0; i < 16; ++i) {
+      le32enc(&B[(k * 16 + i * 5 % 16) * 4], X32[k * 16 + i]);
+    }
+  }
+}
+
+#undef KERNEL_FN
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef VEC
+#undef VLOAD
+#undef VSTORE
+#undef ROTL
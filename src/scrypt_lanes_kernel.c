@@ -0,0 +1,225 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// The multi-lane ROMix kernel, which computes SCRYPT_LANES independent ROMix
+// instances at once, one in each 32-bit lane of a 256-bit vector.  This file
+// is a template that is included by scrypt.c once per instruction set, with
+// the following macros defined beforehand.
+//   KERNEL(name)  — mangles `name` for the instruction set
+//   KERNEL_TARGET — the instruction set as understood by the target attribute
+//   ROTL(v, c)    — rotates each 32-bit word in the __m256i `v` left by `c`
+//
+// The blocks being mixed are interleaved word by word, i.e. word `w` of the
+// block of lane `l` is stored at index `w * SCRYPT_LANES + l`.  Thus, Salsa20/8
+// needs no shuffles at all.  The random reads from V of all lanes are issued
+// together, which hides the latency of one behind the others.
+
+#define KERNEL_FN static __attribute__((target(KERNEL_TARGET)))
+
+KERNEL_FN void KERNEL(salsa20_8_lanes)(__m256i B[static 16]) {
+  __m256i x[16];
+  for (int i = 0; i < 16; ++i) {
+    x[i] = B[i];
+  }
+
+#define SALSA_STEP(a, b, c, n)                                                 \
+  x[a] = _mm256_xor_si256(x[a], ROTL(_mm256_add_epi32(x[b], x[c]), n))
+
+  for (int i = 0; i < 8; i += 2) {
+    // operate on columns
+    SALSA_STEP(4, 0, 12, 7);
+    SALSA_STEP(9, 5, 1, 7);
+    SALSA_STEP(14, 10, 6, 7);
+    SALSA_STEP(3, 15, 11, 7);
+    SALSA_STEP(8, 4, 0, 9);
+    SALSA_STEP(13, 9, 5, 9);
+    SALSA_STEP(2, 14, 10, 9);
+    SALSA_STEP(7, 3, 15, 9);
+    SALSA_STEP(12, 8, 4, 13);
+    SALSA_STEP(1, 13, 9, 13);
+    SALSA_STEP(6, 2, 14, 13);
+    SALSA_STEP(11, 7, 3, 13);
+    SALSA_STEP(0, 12, 8, 18);
+    SALSA_STEP(5, 1, 13, 18);
+    SALSA_STEP(10, 6, 2, 18);
+    SALSA_STEP(15, 11, 7, 18);
+
+    // operate on rows
+    SALSA_STEP(1, 0, 3, 7);
+    SALSA_STEP(6, 5, 4, 7);
+    SALSA_STEP(11, 10, 9, 7);
+    SALSA_STEP(12, 15, 14, 7);
+    SALSA_STEP(2, 1, 0, 9);
+    SALSA_STEP(7, 6, 5, 9);
+    SALSA_STEP(8, 11, 10, 9);
+    SALSA_STEP(13, 12, 15, 9);
+    SALSA_STEP(3, 2, 1, 13);
+    SALSA_STEP(4, 7, 6, 13);
+    SALSA_STEP(9, 8, 11, 13);
+    SALSA_STEP(14, 13, 12, 13);
+    SALSA_STEP(0, 3, 2, 18);
+    SALSA_STEP(5, 4, 7, 18);
+    SALSA_STEP(10, 9, 8, 18);
+    SALSA_STEP(15, 14, 13, 18);
+  }
+
+#undef SALSA_STEP
+
+  for (int i = 0; i < 16; ++i) {
+    B[i] = _mm256_add_epi32(B[i], x[i]);
+  }
+}
+
+// Computes `Y = BlockMix(B)` for all lanes.
+KERNEL_FN void KERNEL(blockmix_lanes)(const __m256i *restrict B,
+                                      __m256i *restrict Y, const size_t r) {
+  __m256i X[16];
+  for (size_t k = 0; k < 16; ++k) {
+    X[k] = B[(2 * r - 1) * 16 + k];
+  }
+  for (size_t i = 0; i < 2 * r; ++i) {
+    for (size_t k = 0; k < 16; ++k) {
+      X[k] = _mm256_xor_si256(X[k], B[i * 16 + k]);
+    }
+    KERNEL(salsa20_8_lanes)(X);
+    // even blocks go to the first half of the output, odd ones to the second
+    __m256i *out = &Y[(i / 2 + (i & 1) * r) * 16];
+    for (size_t k = 0; k < 16; ++k) {
+      out[k] = X[k];
+    }
+  }
+}
+
+// Transposes the 8×8 matrix of 32-bit words in `m`, which converts eight
+// consecutive words of all lanes into the words of each lane and vice versa.
+KERNEL_FN void KERNEL(transpose_lanes)(__m256i m[static 8]) {
+  const __m256i t0 = _mm256_unpacklo_epi32(m[0], m[1]);
+  const __m256i t1 = _mm256_unpackhi_epi32(m[0], m[1]);
+  const __m256i t2 = _mm256_unpacklo_epi32(m[2], m[3]);
+  const __m256i t3 = _mm256_unpackhi_epi32(m[2], m[3]);
+  const __m256i t4 = _mm256_unpacklo_epi32(m[4], m[5]);
+  const __m256i t5 = _mm256_unpackhi_epi32(m[4], m[5]);
+  const __m256i t6 = _mm256_unpacklo_epi32(m[6], m[7]);
+  const __m256i t7 = _mm256_unpackhi_epi32(m[6], m[7]);
+
+  const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+  const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+  const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+  const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+  const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+  const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+  const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+  const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  m[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  m[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  m[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  m[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  m[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  m[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  m[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  m[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// Stores the interleaved blocks `X` to `V[i]` of each lane.
+KERNEL_FN void KERNEL(store_v_lanes)(__m256i *restrict V,
+                                     const __m256i *restrict X,
+                                     const size_t r, const uint64_t N,
+                                     const uint64_t i) {
+  const size_t vecs = 4 * r; // vectors per lane and block
+  for (size_t w = 0; w < 8 * vecs; w += 8) {
+    __m256i m[8];
+    for (size_t k = 0; k < 8; ++k) {
+      m[k] = X[w + k];
+    }
+    KERNEL(transpose_lanes)(m);
+    for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+      V[(l * N + i) * vecs + w / 8] = m[l];
+    }
+  }
+}
+
+// Computes `X ^= V[Integerify(X) mod N]` for all lanes.
+KERNEL_FN void KERNEL(xor_v_lanes)(__m256i *restrict X,
+                                   const __m256i *restrict V, const size_t r,
+                                   const uint64_t N) {
+  const size_t vecs = 4 * r; // vectors per lane and block
+  uint32_t lo[SCRYPT_LANES], hi[SCRYPT_LANES];
+  _mm256_storeu_si256((__m256i *)lo, X[(2 * r - 1) * 16]);
+  _mm256_storeu_si256((__m256i *)hi, X[(2 * r - 1) * 16 + 1]);
+
+  const __m256i *blocks[SCRYPT_LANES];
+  for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+    const uint64_t j = ((uint64_t)hi[l] << 32 | lo[l]) & (N - 1);
+    blocks[l] = &V[(l * N + j) * vecs];
+  }
+
+  for (size_t w = 0; w < 8 * vecs; w += 8) {
+    __m256i m[8];
+    for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+      m[l] = blocks[l][w / 8];
+    }
+    KERNEL(transpose_lanes)(m);
+    for (size_t k = 0; k < 8; ++k) {
+      X[w + k] = _mm256_xor_si256(X[w + k], m[k]);
+    }
+  }
+}
+
+// Computes `B[l] = ROMix(B[l])` for each lane `l`.  `V` must provide
+// SCRYPT_LANES·128·r·N bytes and `XY` SCRYPT_LANES·256·r bytes of scratch
+// memory, both aligned to 64 bytes.  Unlike `XY`, `V` holds the blocks of
+// each lane contiguously, so that reading a random block of a lane touches
+// as few cache lines and pages as possible.
+KERNEL_FN void KERNEL(romix_lanes)(uint8_t *const B[static SCRYPT_LANES],
+                                   const size_t r, const uint64_t N, void *V,
+                                   void *XY) {
+  const size_t words = 32 * r; // per lane and block
+  __m256i *const X = XY;
+  __m256i *const Y = X + words;
+  uint32_t *const X32 = XY;
+
+  for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+    for (size_t w = 0; w < words; ++w) {
+      X32[w * SCRYPT_LANES + l] = le32dec(&B[l][w * 4]);
+    }
+  }
+
+  for (uint64_t i = 0; i < N; i += 2) {
+    KERNEL(store_v_lanes)(V, X, r, N, i);
+    KERNEL(blockmix_lanes)(X, Y, r);
+    KERNEL(store_v_lanes)(V, Y, r, N, i + 1);
+    KERNEL(blockmix_lanes)(Y, X, r);
+  }
+
+  for (uint64_t i = 0; i < N; i += 2) {
+    KERNEL(xor_v_lanes)(X, V, r, N);
+    KERNEL(blockmix_lanes)(X, Y, r);
+    KERNEL(xor_v_lanes)(Y, V, r, N);
+    KERNEL(blockmix_lanes)(Y, X, r);
+  }
+
+  for (size_t l = 0; l < SCRYPT_LANES; ++l) {
+    for (size_t w = 0; w < words; ++w) {
+      le32enc(&B[l][w * 4], X32[w * SCRYPT_LANES + l]);
+    }
+  }
+}
+
+#undef KERNEL_FN
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef ROTL
@@ -0,0 +1,365 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// Incremental fuzzy search over the items of the menu.  An item matches if
+// the characters of the query appear in its fields in the same order, though
+// not necessarily next to each other, ignoring case.  The items whose first
+// field starts with the query come first, then those whose first field
+// contains it, then the others, each in their original order.
+//
+// Each item has a signature of the characters it contains, computed when the
+// first character is typed, so that most items that do not match are ruled
+// out without looking at their text.  As the query grows one character at a
+// time, the items that match it are searched for among those that matched
+// before, continuing where their match ended.  The earlier results are kept,
+// so that deleting a character does not search at all.
+
+#include "padre.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_MAX_QUERY 64
+
+// The number of fields of an item that are searched, in this order.
+#define SEARCH_FIELDS 2
+
+// Stores the fields of the item at `index` in `fields`; `nullptr` for those
+// that it does not have.
+typedef void search_fields_fn(void *arg, size_t index,
+                              const char *fields[static SEARCH_FIELDS]);
+
+// An item that matches the query.
+struct search__result {
+  size_t item;
+  size_t end_field;
+  uint32_t end; // the offset behind the match of the last character
+  // the offset of the query in the first field; `SEARCH__NONE` if it is not
+  // in there
+  uint32_t occurrence;
+};
+
+#define SEARCH__NONE UINT32_MAX
+
+struct search {
+  search_fields_fn *fields_fn;
+  void *arg;
+  size_t num_items;
+  uint64_t *signatures; // of each item; `nullptr` until they are needed
+
+  char query[SEARCH_MAX_QUERY + 1];
+  size_t len;
+  // The items that match the first `i` characters of the query, in their
+  // original order, and their indexes by rank; `nullptr` for all items if `i`
+  // is 0.
+  struct search__result *results[SEARCH_MAX_QUERY + 1];
+  size_t *ranked[SEARCH_MAX_QUERY + 1];
+  size_t num_results[SEARCH_MAX_QUERY + 1];
+};
+
+// The position of a character of the query in an item.
+struct search_position {
+  size_t field;
+  size_t offset;
+};
+
+static inline char search__fold(const char c) {
+  return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+// Returns the bit of `c` in a signature.  Letters and digits have a bit of
+// their own, the other characters share the remaining ones.
+static uint64_t search__bit(const char c) {
+  const char folded = search__fold(c);
+  unsigned bit;
+  if (folded >= 'a' && folded <= 'z') {
+    bit = (unsigned)(folded - 'a');
+  } else if (folded >= '0' && folded <= '9') {
+    bit = 26 + (unsigned)(folded - '0');
+  } else {
+    bit = 36 + (uint8_t)folded % 28;
+  }
+  return (uint64_t)1 << bit;
+}
+
+static uint64_t search__signature(const char *fields[static SEARCH_FIELDS]) {
+  uint64_t signature = 0;
+  for (size_t f = 0; f < SEARCH_FIELDS; ++f) {
+    for (const char *c = fields[f]; c != nullptr && *c != '\0'; ++c) {
+      signature |= search__bit(*c);
+    }
+  }
+  return signature;
+}
+
+// Finds the characters of `query` in `fields`, in order, and stores where
+// in `positions`, unless it is `nullptr`.
+// Returns whether all characters were found.
+static bool search__match(const char *query, const size_t len,
+                          const char *fields[static SEARCH_FIELDS],
+                          struct search_position *positions) {
+  size_t i = 0;
+  for (size_t f = 0; f < SEARCH_FIELDS && i < len; ++f) {
+    for (const char *c = fields[f]; c != nullptr && *c != '\0' && i < len;
+         ++c) {
+      if (search__fold(*c) == search__fold(query[i])) {
+        if (positions != nullptr) {
+          positions[i] = (struct search_position){f, (size_t)(c - fields[f])};
+        }
+        ++i;
+      }
+    }
+  }
+  return i == len;
+}
+
+// The ranks of matches, from best to worst.
+enum search_rank {
+  SEARCH_PREFIX,    // the first field starts with the query
+  SEARCH_SUBSTRING, // the first field contains the query
+  SEARCH_FUZZY,
+  NUM_SEARCH_RANKS
+};
+
+// Returns the first character of `str` that is `c`, ignoring case; `nullptr`
+// if there is none.
+static const char *search__find(const char *str, const char c) {
+  const char folded = search__fold(c);
+  if (folded < 'a' || folded > 'z') {
+    return strchr(str, c);
+  }
+  // setting the bit that tells the cases of a letter apart only turns an
+  // upper-case `folded` into `folded`
+  for (; *str != '\0'; ++str) {
+    if ((*str | 0x20) == folded) {
+      return str;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the first occurrence of `query` of `len` characters in `str`,
+// ignoring case; `nullptr` if there is none.  Both are short, which makes a
+// plain search faster than `strcasestr()`.
+static const char *search__find_string(const char *str, const char *query,
+                                       const size_t len) {
+  for (; (str = search__find(str, query[0])) != nullptr; ++str) {
+    size_t i = 1;
+    while (i < len && search__fold(str[i]) == search__fold(query[i])) {
+      ++i;
+    }
+    if (i == len) {
+      return str;
+    }
+  }
+  return nullptr;
+}
+
+// Extends the match of `result` in `fields` by the character `c`, which has
+// been appended to `query` of `len` characters.
+// Returns whether the item still matches.
+static bool search__extend(struct search__result *result, const char *query,
+                           const size_t len,
+                           const char *fields[static SEARCH_FIELDS]) {
+  const char c = query[len - 1];
+
+  // the characters of the query in order, continuing behind the last one
+  const char *found = nullptr;
+  size_t f = result->end_field;
+  for (size_t offset = result->end; f < SEARCH_FIELDS; ++f, offset = 0) {
+    if ((found = search__find(fields[f] + offset, c)) != nullptr) {
+      break;
+    }
+  }
+  if (found == nullptr) {
+    return false;
+  }
+  result->end_field = f;
+  result->end = (uint32_t)(found - fields[f]) + 1;
+
+  // the query as a whole, which cannot occur before it did without `c`
+  const uint32_t occurrence = result->occurrence;
+  if (occurrence == SEARCH__NONE ||
+      search__fold(fields[0][occurrence + len - 1]) == search__fold(c)) {
+    return true;
+  }
+  found = fields[0][occurrence] != '\0'
+              ? search__find_string(fields[0] + occurrence + 1, query, len)
+              : nullptr;
+  result->occurrence =
+      found != nullptr ? (uint32_t)(found - fields[0]) : SEARCH__NONE;
+  return true;
+}
+
+static enum search_rank search__rank(const struct search__result *result) {
+  switch (result->occurrence) {
+  case 0:
+    return SEARCH_PREFIX;
+  case SEARCH__NONE:
+    return SEARCH_FUZZY;
+  default:
+    return SEARCH_SUBSTRING;
+  }
+}
+
+// Stores the fields of `item` in `fields`, with "" for those it does not have.
+static void search__fields(const struct search *search, const size_t item,
+                           const char *fields[static SEARCH_FIELDS]) {
+  search->fields_fn(search->arg, item, fields);
+  for (size_t f = 0; f < SEARCH_FIELDS; ++f) {
+    if (fields[f] == nullptr) {
+      fields[f] = "";
+    }
+  }
+}
+
+// Computes the signatures of all items.
+// Returns 0 on success; -1 in case of a failure.
+static int search__sign(struct search *search) {
+  const size_t num_items = search->num_items;
+  search->signatures =
+      malloc((num_items > 0 ? num_items : 1) * sizeof(uint64_t));
+  if (search->signatures == nullptr) {
+    return -1;
+  }
+  for (size_t i = 0; i < num_items; ++i) {
+    const char *fields[SEARCH_FIELDS];
+    search->fields_fn(search->arg, i, fields);
+    search->signatures[i] = search__signature(fields);
+  }
+  return 0;
+}
+
+// Prepares a search over `num_items` items, whose fields `fields_fn` returns.
+// Nothing is looked at before the first character of a query is pushed.
+static void search_init(struct search *search, const size_t num_items,
+                        search_fields_fn *fields_fn, void *arg) {
+  *search = (struct search){
+      .fields_fn = fields_fn,
+      .arg = arg,
+      .num_items = num_items,
+  };
+  search->num_results[0] = num_items;
+}
+
+// Returns the number of items that match the query.
+static size_t search_size(const struct search *search) {
+  return search->num_results[search->len];
+}
+
+// Returns the index of the `i`-th item that matches the query.
+static size_t search_item(const struct search *search, const size_t i) {
+  return search->len == 0 ? i : search->ranked[search->len][i];
+}
+
+// Appends `c` to the query, looking only at the items that matched before.
+// Returns 0 on success; -1 if the query is too long or in case of a failure.
+static int search_push(struct search *search, const char c) {
+  if (search->len == SEARCH_MAX_QUERY || c == '\0') {
+    return -1;
+  }
+  if (search->signatures == nullptr && search__sign(search) != 0) {
+    return -1;
+  }
+  const size_t num_candidates = search_size(search);
+  const size_t size = num_candidates > 0 ? num_candidates : 1;
+  struct search__result *results = malloc(size * sizeof *results);
+  uint8_t *ranks = malloc(size);
+  size_t *ranked = malloc(size * sizeof *ranked);
+  if (results == nullptr || ranks == nullptr || ranked == nullptr) {
+    free(results);
+    free(ranks);
+    free(ranked);
+    return -1;
+  }
+
+  const size_t len = search->len + 1;
+  search->query[len - 1] = c;
+  search->query[len] = '\0';
+  uint64_t signature = 0;
+  for (size_t i = 0; i < len; ++i) {
+    signature |= search__bit(search->query[i]);
+  }
+
+  size_t num_results = 0;
+  size_t rank_sizes[NUM_SEARCH_RANKS] = {0};
+  for (size_t i = 0; i < num_candidates; ++i) {
+    // the empty query matches everything, at the very start
+    struct search__result result =
+        search->len == 0 ? (struct search__result){.item = i}
+                         : search->results[search->len][i];
+    if ((search->signatures[result.item] & signature) != signature) {
+      continue;
+    }
+    const char *fields[SEARCH_FIELDS];
+    search__fields(search, result.item, fields);
+    if (search__extend(&result, search->query, len, fields)) {
+      const enum search_rank rank = search__rank(&result);
+      results[num_results] = result;
+      ranks[num_results] = (uint8_t)rank;
+      ++rank_sizes[rank];
+      ++num_results;
+    }
+  }
+
+  // order the matches by rank, keeping the order within each rank
+  size_t rank_starts[NUM_SEARCH_RANKS] = {0};
+  for (size_t r = 1; r < NUM_SEARCH_RANKS; ++r) {
+    rank_starts[r] = rank_starts[r - 1] + rank_sizes[r - 1];
+  }
+  for (size_t i = 0; i < num_results; ++i) {
+    ranked[rank_starts[ranks[i]]++] = results[i].item;
+  }
+  free(ranks);
+
+  search->len = len;
+  search->results[len] = results;
+  search->ranked[len] = ranked;
+  search->num_results[len] = num_results;
+  return 0;
+}
+
+// Removes the last character of the query, if any.
+static void search_pop(struct search *search) {
+  if (search->len > 0) {
+    free(search->results[search->len]);
+    free(search->ranked[search->len]);
+    search->results[search->len] = nullptr;
+    search->ranked[search->len] = nullptr;
+    search->query[--search->len] = '\0';
+  }
+}
+
+// Stores where the characters of the query are in the `fields` of an item
+// that matches it in `positions`.
+// Returns whether the item matches.
+static bool
+search_positions(const struct search *search,
+                 const char *fields[static SEARCH_FIELDS],
+                 struct search_position positions[static SEARCH_MAX_QUERY]) {
+  return search__match(search->query, search->len, fields, positions);
+}
+
+static void search_free(struct search *search) {
+  while (search->len > 0) {
+    search_pop(search);
+  }
+  free(search->signatures);
+  search->signatures = nullptr;
+}
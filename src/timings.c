@@ -0,0 +1,122 @@
+//
+//   Copyright 2024 Darius Kellermann
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+// The time spent in each phase of a run, for `--timings`.  Unless the timings
+// have been enabled, measuring a phase costs no more than a branch.  Phases
+// may be measured from several threads, whose times add up, so that the
+// derivations in the background may take longer than the run itself.
+
+#include "padre.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum timing_phase {
+  TIMING_READ,     // loading the database into memory
+  TIMING_PARSE,    // parsing, indexing or searching the database
+  TIMING_TERMINAL, // setting up the terminal
+  TIMING_USER,     // waiting for the user to type
+  TIMING_MENU,     // drawing and searching the menu
+  TIMING_KDF,      // deriving the raw passwords
+  TIMING_CHARSET,  // mapping the raw passwords to characters
+  NUM_TIMING_PHASES
+};
+
+static const char *const timing_phase_names[] = {
+    "reading the database", "parsing",         "terminal setup",
+    "waiting for the user", "menu",            "key derivation",
+    "charset mapping",
+};
+
+struct timings {
+  bool enabled;
+  pid_t pid;      // of the process that enabled the timings
+  uint64_t start; // when the timings were enabled
+  _Atomic uint64_t ns[NUM_TIMING_PHASES];
+  _Atomic uint64_t count[NUM_TIMING_PHASES];
+  _Atomic uint64_t kdf_calls;
+};
+
+static struct timings timings;
+
+static uint64_t timings__now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Starts measuring a phase.
+// Returns the time to pass to `timing_stop()`.
+static uint64_t timing_start(void) {
+  return timings.enabled ? timings__now() : 0;
+}
+
+// Adds the time since `start` to `phase`.
+static void timing_stop(const enum timing_phase phase, const uint64_t start) {
+  if (timings.enabled) {
+    atomic_fetch_add_explicit(&timings.ns[phase], timings__now() - start,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&timings.count[phase], 1, memory_order_relaxed);
+  }
+}
+
+// Counts `n` calls of the KDF.
+static void timings_count_kdf(const size_t n) {
+  if (timings.enabled) {
+    atomic_fetch_add_explicit(&timings.kdf_calls, n, memory_order_relaxed);
+  }
+}
+
+// Writes the breakdown of the timings to the standard error.  Only the process
+// that enabled the timings reports them, not the agent it starts.
+static void timings__report(void) {
+  if (getpid() != timings.pid) {
+    return;
+  }
+  const uint64_t total = timings__now() - timings.start;
+
+  fputs("timings:\n", stderr);
+  for (size_t p = 0; p < NUM_TIMING_PHASES; ++p) {
+    fprintf(stderr, "  %-22s %11.3f ms in %" PRIu64 " part(s)\n",
+            timing_phase_names[p], (double)timings.ns[p] / 1e6,
+            (uint64_t)timings.count[p]);
+  }
+  fprintf(stderr, "  %-22s %11.3f ms\n", "total", (double)total / 1e6);
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    fprintf(stderr, "  %-22s %8ld KiB\n", "peak RSS", usage.ru_maxrss);
+  }
+  fprintf(stderr, "  %-22s %8" PRIu64 "\n", "KDF calls",
+          (uint64_t)timings.kdf_calls);
+}
+
+// Starts measuring the phases, which are reported when the process exits.
+// Returns 0 on success; -1 in case of a failure.
+static int timings_enable(void) {
+  timings.enabled = true;
+  timings.pid = getpid();
+  timings.start = timings__now();
+  return atexit(timings__report) == 0 ? 0 : -1;
+}
@@ -16,75 +16,246 @@
 
 #include "padre.h"
 
+#include "search.c"
+
 #include <curses.h>
-#include <menu.h>
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-struct tui_item {
-  const char *name;
-  char description[256];
+// Stores the name and the detail, shown after the name, of the item at `index`
+// in `fields`.  Both are searched.
+typedef search_fields_fn tui_fields_fn;
+
+// Stores the description of the item at `index`, shown after its detail, in
+// `description` of `size` bytes.
+typedef void tui_describe_fn(void *arg, size_t index, char *description,
+                             size_t size);
+
+// Called with the index of the item that has just been highlighted.
+typedef void tui_highlight_fn(void *arg, size_t index);
+
+// The items of the menu that match the search, of which a window is shown.
+// Only the items in the window are looked at to draw it, so that the menu
+// appears at once, no matter how many items there are.
+struct tui__list {
+  tui_describe_fn *describe;
+  void *arg;
+  struct search search;
+  size_t selected; // among the matching items
+  size_t top;      // the first matching item shown
 };
 
-static int tui__wait_user_selection(MENU *menu) {
-  for (int c; (c = getch()) != 'q'; refresh()) {
+#define TUI__KEY_ESCAPE 27
+
+// The maximum length of the description of an item.
+#define TUI__DESCRIPTION_SIZE 128
+
+// Returns the number of rows the items are shown in.
+static size_t tui__rows(void) { return LINES > 3 ? (size_t)LINES - 2 : 1; }
+
+static int tui__min(const int a, const int b) { return a < b ? a : b; }
+
+static int tui__max(const int a, const int b) { return a > b ? a : b; }
+
+static size_t tui__min_size(const size_t a, const size_t b) {
+  return a < b ? a : b;
+}
+
+// Draws `text` into `width` columns at `x`, and highlights the characters of
+// field `field` in `positions`.
+static void tui__draw_field(const int y, const int x, const int width,
+                            const char *text, const size_t field,
+                            const struct search *search,
+                            const struct search_position *positions,
+                            const attr_t attr) {
+  if (width <= 0) {
+    return;
+  }
+  mvaddnstr(y, x, text, width);
+  for (size_t i = 0; i < search->len; ++i) {
+    if (positions[i].field == field && positions[i].offset < (size_t)width) {
+      mvchgat(y, x + (int)positions[i].offset, 1, attr | A_BOLD | A_UNDERLINE,
+              0, nullptr);
+    }
+  }
+}
+
+// Stores the fields of the `row`-th item shown in `fields`.
+// Returns the index of the item.
+static size_t tui__row_fields(const struct tui__list *list, const size_t row,
+                              const char *fields[static SEARCH_FIELDS]) {
+  const size_t item = search_item(&list->search, list->top + row);
+  search__fields(&list->search, item, fields);
+  return item;
+}
+
+static void tui__draw(const struct tui__list *list) {
+  erase();
+
+  const size_t num_matches = search_size(&list->search);
+  const size_t rows = tui__min_size(tui__rows(), num_matches - list->top);
+
+  // the columns are as wide as the widest field shown, but long names must not
+  // push the details off the screen
+  int name_width = 0;
+  int detail_width = 0;
+  for (size_t row = 0; row < rows; ++row) {
+    const char *fields[SEARCH_FIELDS];
+    tui__row_fields(list, row, fields);
+    name_width = tui__max(name_width, (int)strlen(fields[0]));
+    detail_width = tui__max(detail_width, (int)strlen(fields[1]));
+  }
+  name_width = tui__min(name_width, COLS / 2);
+  detail_width = tui__min(detail_width, COLS / 4);
+
+  for (size_t row = 0; row < rows; ++row) {
+    const char *fields[SEARCH_FIELDS];
+    const size_t item = tui__row_fields(list, row, fields);
+    const attr_t attr =
+        list->top + row == list->selected ? A_REVERSE : A_NORMAL;
+    const int y = (int)row;
+
+    attrset((int)attr);
+    mvhline(y, 0, ' ', COLS);
+    struct search_position positions[SEARCH_MAX_QUERY];
+    search_positions(&list->search, fields, positions);
+    const int detail_x = name_width + 2;
+    const int description_x = detail_x + detail_width + 2;
+    tui__draw_field(y, 0, tui__min(name_width, COLS), fields[0], 0,
+                    &list->search, positions, attr);
+    tui__draw_field(y, detail_x, tui__min(detail_width, COLS - detail_x),
+                    fields[1], 1, &list->search, positions, attr);
+    if (description_x < COLS) {
+      char description[TUI__DESCRIPTION_SIZE];
+      list->describe(list->arg, item, description, sizeof description);
+      mvaddnstr(y, description_x, description, COLS - description_x);
+    }
+  }
+
+  attrset(A_REVERSE);
+  mvhline(LINES - 2, 0, ' ', COLS);
+  mvprintw(LINES - 2, 0,
+           "Type to search, [ENTER] to select, [ESC] to quit. %zu out of %zu"
+           " items match.",
+           num_matches, list->search.num_items);
+  attrset(A_NORMAL);
+  mvprintw(LINES - 1, 0, "Search: %s", list->search.query);
+  refresh();
+}
+
+// Moves the window of the items shown so that the selected one is in it.
+static void tui__scroll(struct tui__list *list) {
+  const size_t rows = tui__rows();
+  if (list->selected < list->top) {
+    list->top = list->selected;
+  } else if (list->selected >= list->top + rows) {
+    list->top = list->selected - rows + 1;
+  }
+}
+
+static int tui__wait_user_selection(struct tui__list *list,
+                                    tui_highlight_fn *on_highlight,
+                                    void *arg) {
+  size_t highlighted = SIZE_MAX;
+  for (;;) {
+    const size_t num_matches = search_size(&list->search);
+    const size_t rows = tui__rows();
+    uint64_t start = timing_start();
+    tui__scroll(list);
+    tui__draw(list);
+    if (on_highlight != nullptr && num_matches > 0 &&
+        search_item(&list->search, list->selected) != highlighted) {
+      highlighted = search_item(&list->search, list->selected);
+      on_highlight(arg, highlighted);
+    }
+    timing_stop(TIMING_MENU, start);
+
+    start = timing_start();
+    const int c = getch();
+    timing_stop(TIMING_USER, start);
     switch (c) {
+    case ERR: // the input has ended
+    case TUI__KEY_ESCAPE:
+      return -1;
+    case '\n':
+    case KEY_ENTER:
+      if (num_matches > 0) {
+        return (int)search_item(&list->search, list->selected);
+      }
+      break;
     case KEY_DOWN:
-      menu_driver(menu, REQ_DOWN_ITEM);
+      if (list->selected + 1 < num_matches) {
+        ++list->selected;
+      }
       break;
     case KEY_UP:
-      menu_driver(menu, REQ_UP_ITEM);
+      if (list->selected > 0) {
+        --list->selected;
+      }
+      break;
+    case KEY_NPAGE:
+      list->selected = list->selected + rows < num_matches
+                           ? list->selected + rows
+                           : (num_matches > 0 ? num_matches - 1 : 0);
+      break;
+    case KEY_PPAGE:
+      list->selected = list->selected > rows ? list->selected - rows : 0;
+      break;
+    case KEY_BACKSPACE:
+    case '\b':
+    case 127:
+      start = timing_start();
+      search_pop(&list->search);
+      timing_stop(TIMING_MENU, start);
+      list->selected = 0;
       break;
-    case '\n':
-      return item_index(current_item(menu));
     default:
+      start = timing_start();
+      if (c >= ' ' && c < 256 && search_push(&list->search, (char)c) == 0) {
+        list->selected = 0;
+      }
+      timing_stop(TIMING_MENU, start);
       break;
     }
   }
-  return -1;
 }
 
-static int tui_show_menu(const size_t num_items,
-                         const struct tui_item items[static num_items]) {
-  initscr();
-  cbreak(); // get characters immediately, don't cache until line break
-  noecho();
-  keypad(stdscr, TRUE);
+// Shows a menu of `num_items` items and returns the index of the one the user
+// selected; -1 if the user quit.  `fields` and `describe` are called with
+// `items_arg` for the items as they are shown or searched.  The user may
+// narrow the items down by typing a part of their names and details.  If
+// `on_highlight` is not `nullptr`, it is called whenever another item is
+// highlighted.
+static int tui_show_menu(const size_t num_items, tui_fields_fn *fields,
+                         tui_describe_fn *describe, void *items_arg,
+                         tui_highlight_fn *on_highlight, void *arg) {
+  struct tui__list list = {.describe = describe, .arg = items_arg};
+  search_init(&list.search, num_items, fields, items_arg);
 
-  ITEM **nc_items = malloc((num_items + 1) * sizeof(ITEM *));
-
-  for (size_t i = 0; i < num_items; ++i) {
-    nc_items[i] = new_item(items[i].name, items[i].description);
-  }
-  nc_items[num_items] = nullptr;
-
-  attron(A_REVERSE);
-  mvprintw(
-      LINES - 2, 0,
-      "Press [q] to quit or [ENTER] to select. Showing %d out of %zu items.",
-      LINES - 2, num_items);
-  attroff(A_REVERSE);
-  mvprintw(LINES - 1, 0, "Type to search: not yet implemented :-(");
-
-  MENU *menu = new_menu(nc_items);
-  set_menu_format(menu, LINES - 3, 1);
-  const int ret = post_menu(menu);
-  if (ret != E_OK) {
-    fprintf(stderr, "Error trying to show ncurses menu: %d\n", ret);
-    endwin();
+  const uint64_t start = timing_start();
+  nofilter(); // the password prompt may have been shown before
+  // Like the password prompt, the menu goes to the standard error.
+  SCREEN *screen = newterm(nullptr, stderr, stdin);
+  if (screen == nullptr) {
+    fputs("Error: cannot show the menu without a terminal\n", stderr);
     return -1;
   }
-  refresh();
+  set_term(screen);
+  cbreak(); // get characters immediately, don't cache until line break
+  noecho();
+  keypad(stdscr, TRUE);
+  set_escdelay(25); // nobody types escape sequences by hand
+  timing_stop(TIMING_TERMINAL, start);
 
-  const int selected_item = tui__wait_user_selection(menu);
+  const int selected_item =
+      tui__wait_user_selection(&list, on_highlight, arg);
 
-  for (size_t i = 0; i < num_items; ++i) {
-    free_item(nc_items[i]);
-  }
-  free_menu(menu);
   endwin();
-  free(nc_items);
+  delscreen(screen);
+  search_free(&list.search);
 
   return selected_item;
 }
@@ -95,19 +266,30 @@ static int tui_show_menu(const size_t num_items,
 //         string not including the terminating null byte.
 // Returns 0 on success; -1 in case of a failure.
 static int tui_ask_password(char *passwd, size_t *len) {
+  uint64_t start = timing_start();
   filter(); // only affect the current line
-  initscr();
+  // The prompt goes to the standard error, so that the standard output only
+  // carries the derived password(s), even if it is redirected to a file.
+  SCREEN *screen = newterm(nullptr, stderr, stdin);
+  if (screen == nullptr) {
+    errno = ENOTTY;
+    return -1;
+  }
+  set_term(screen);
   cbreak(); // don't cache the characters
   noecho(); // don't print the password
   keypad(stdscr, TRUE);
 
   printw("Enter the master password: ");
+  timing_stop(TIMING_TERMINAL, start);
 
+  start = timing_start();
   size_t curr_len = 0;
   int c;
   for (; (c = getch()) != EOF && c != '\n' && curr_len < *len; ++curr_len) {
     passwd[curr_len] = (char)c;
   }
+  timing_stop(TIMING_USER, start);
   passwd[curr_len] = '\0';
 
   *len = curr_len;